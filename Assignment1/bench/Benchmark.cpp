@@ -0,0 +1,259 @@
+//==--- Benchmark.cpp - Microbenchmarks of the AST interpreter --------------===//
+//===----------------------------------------------------------------------===//
+// 按参数生成若干压力测试程序，用 ast-interpreter --stats 逐个执行，
+// 汇总每个结点的耗时、每秒调用次数和峰值内存，以 JSON 输出以便跨提交对比
+
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// 一类客户程序：scale 控制规模，生成的程序只依赖四个内建函数
+struct Workload
+{
+    const char *name;
+    std::string (*generate)(unsigned scale);
+    unsigned scale; // --scale 为 1 时的规模
+};
+
+static const char *Prelude =
+    "extern int GET();\n"
+    "extern void *MALLOC(int);\n"
+    "extern void FREE(void *);\n"
+    "extern void PRINT(int);\n";
+
+/// 深递归：线性递归的深度为 scale，再加上一棵指数规模的递归树
+static std::string recursion(unsigned scale)
+{
+    return llvm::formatv("{0}"
+        "int depth(int n) {{ if (n == 0) return 0; return depth(n - 1) + 1; }\n"
+        "int fib(int n) {{ if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+        "int main() {{\n"
+        "    int i, sum = 0;\n"
+        "    for (i = 0; i < 20; i++) sum = sum + depth({1});\n"
+        "    PRINT(sum);\n"
+        "    PRINT(fib({2}));\n"
+        "    return 0;\n"
+        "}\n", Prelude, scale, scale >= 2000 ? 22 : 18).str();
+}
+
+/// 嵌套循环：在大数组上做前缀和与二重循环的累加
+static std::string loops(unsigned scale)
+{
+    return llvm::formatv("{0}"
+        "int main() {{\n"
+        "    int a[{1}];\n"
+        "    int i, j, sum = 0;\n"
+        "    for (i = 0; i < {1}; i++) a[i] = i % 7;\n"
+        "    for (i = 1; i < {1}; i++) a[i] = a[i] + a[i - 1];\n"
+        "    for (i = 0; i < {2}; i++)\n"
+        "        for (j = 0; j < {2}; j++)\n"
+        "            sum = (sum + (a[i * {2} + j] ^ j)) & 65535;\n"
+        "    PRINT(sum);\n"
+        "    return 0;\n"
+        "}\n", Prelude, scale * scale, scale).str();
+}
+
+/// 指针追逐：用 MALLOC 建立链表，反复遍历后释放
+static std::string pointers(unsigned scale)
+{
+    return llvm::formatv("{0}"
+        "struct Node {{ int val; struct Node *next; };\n"
+        "int main() {{\n"
+        "    struct Node *head = 0;\n"
+        "    struct Node *node;\n"
+        "    int i, round, sum = 0;\n"
+        "    for (i = 0; i < {1}; i++) {{\n"
+        "        node = (struct Node *)MALLOC(sizeof(struct Node));\n"
+        "        node->val = i;\n"
+        "        node->next = head;\n"
+        "        head = node;\n"
+        "    }\n"
+        "    for (round = 0; round < 20; round++)\n"
+        "        for (node = head; node != 0; node = node->next)\n"
+        "            sum = sum + (node->val & round);\n"
+        "    while (head != 0) {{\n"
+        "        node = head->next;\n"
+        "        FREE(head);\n"
+        "        head = node;\n"
+        "    }\n"
+        "    PRINT(sum);\n"
+        "    return 0;\n"
+        "}\n", Prelude, scale).str();
+}
+
+/// 全局变量：在被调函数和循环中反复读写全局变量
+static std::string globals(unsigned scale)
+{
+    return llvm::formatv("{0}"
+        "int counter;\n"
+        "int total = 1;\n"
+        "int flags[16];\n"
+        "void touch(int i) {{ counter = counter + 1; flags[i & 15] = total; }\n"
+        "int main() {{\n"
+        "    int i;\n"
+        "    for (i = 0; i < {1}; i++) {{\n"
+        "        total = total ^ (counter + i);\n"
+        "        if ((i & 3) == 0) touch(i);\n"
+        "    }\n"
+        "    PRINT(counter);\n"
+        "    PRINT(total);\n"
+        "    return 0;\n"
+        "}\n", Prelude, scale).str();
+}
+
+/// 密集调用：参数少、函数体很小的调用
+static std::string calls(unsigned scale)
+{
+    return llvm::formatv("{0}"
+        "int add(int a, int b) {{ return a + b; }\n"
+        "int square(int x) {{ return x * x; }\n"
+        "int step(int x, int i) {{ return add(square(x & 255), i); }\n"
+        "int main() {{\n"
+        "    int i, x = 1;\n"
+        "    for (i = 0; i < {1}; i++) x = step(x, i);\n"
+        "    PRINT(x);\n"
+        "    return 0;\n"
+        "}\n", Prelude, scale).str();
+}
+
+static const Workload Workloads[] = {
+    {"recursion", recursion, 1000},
+    {"loops", loops, 300},
+    {"pointers", pointers, 20000},
+    {"globals", globals, 200000},
+    {"calls", calls, 100000},
+};
+
+static llvm::cl::opt<std::string> InterpreterOption("interpreter", llvm::cl::desc("Path to ast-interpreter"), llvm::cl::value_desc("path"));
+static llvm::cl::opt<std::string> OutputOption("o", llvm::cl::desc("Write the JSON report to <file>"), llvm::cl::value_desc("file"), llvm::cl::init("-"));
+static llvm::cl::opt<unsigned> ScaleOption("scale", llvm::cl::desc("Multiply the size of every workload by <n>"), llvm::cl::init(1));
+static llvm::cl::opt<unsigned> RepeatOption("repeat", llvm::cl::desc("Run each workload <n> times and keep the fastest run"), llvm::cl::init(3));
+static llvm::cl::list<std::string> FilterOption("only", llvm::cl::desc("Only run the named workload (repeatable)"), llvm::cl::value_desc("name"));
+static llvm::cl::opt<std::string> DumpOption("dump", llvm::cl::desc("Write the generated programs to <dir> instead of running them"), llvm::cl::value_desc("dir"));
+
+/// 执行一次，成功时返回 --stats 输出的 JSON 对象
+static llvm::Optional<llvm::json::Object> runOnce(llvm::StringRef source, llvm::StringRef stats)
+{
+    std::string error;
+    llvm::StringRef args[] = {InterpreterOption, "-f", source, "--stats", stats};
+    // 丢弃客户程序的输出
+    llvm::Optional<llvm::StringRef> redirects[] = {llvm::None, llvm::StringRef(""), llvm::None};
+    int status = llvm::sys::ExecuteAndWait(InterpreterOption, args, llvm::None, redirects, 0, 0, &error);
+    if (status != 0) {
+        llvm::errs() << "[Error] " << InterpreterOption << " exited with " << status << " " << error << "\n";
+        return llvm::None;
+    }
+
+    auto buffer = llvm::MemoryBuffer::getFile(stats);
+    if (!buffer) return llvm::None;
+    llvm::Expected<llvm::json::Value> value = llvm::json::parse((*buffer)->getBuffer());
+    if (!value) {
+        llvm::errs() << "[Error] " << llvm::toString(value.takeError()) << "\n";
+        return llvm::None;
+    }
+    if (llvm::json::Object *object = value->getAsObject()) return std::move(*object);
+    return llvm::None;
+}
+
+static bool selected(llvm::StringRef name)
+{
+    if (FilterOption.empty()) return true;
+    for (const std::string &filter : FilterOption)
+        if (name == filter) return true;
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Microbenchmarks of the Clang AST interpreter.\n");
+
+    if (!DumpOption.empty()) {
+        llvm::sys::fs::create_directories(DumpOption);
+        for (const Workload &workload : Workloads)
+        {
+            if (!selected(workload.name)) continue;
+            llvm::SmallString<128> path(DumpOption);
+            llvm::sys::path::append(path, llvm::Twine(workload.name) + ".c");
+            std::error_code EC;
+            llvm::raw_fd_ostream out(path, EC);
+            if (EC) {
+                llvm::errs() << "[Error] Fail to write " << path << ".\n";
+                return 1;
+            }
+            out << workload.generate(workload.scale * ScaleOption);
+        }
+        return 0;
+    }
+
+    if (InterpreterOption.empty()) {
+        llvm::errs() << "[Error] Missing --interpreter.\n";
+        return 1;
+    }
+
+    llvm::json::Array results;
+    int status = 0;
+    for (const Workload &workload : Workloads)
+    {
+        if (!selected(workload.name)) continue;
+        unsigned scale = workload.scale * ScaleOption;
+
+        llvm::SmallString<128> source, stats;
+        int fd;
+        if (llvm::sys::fs::createTemporaryFile(workload.name, "c", fd, source) ||
+            llvm::sys::fs::createTemporaryFile(workload.name, "json", stats)) {
+            llvm::errs() << "[Error] Fail to create temporary files.\n";
+            return 1;
+        }
+        {
+            llvm::raw_fd_ostream out(fd, true);
+            out << workload.generate(scale);
+        }
+
+        // 保留耗时最短的一次，减小调度等噪声的影响
+        llvm::Optional<llvm::json::Object> best;
+        for (unsigned i = 0; i < std::max(1u, (unsigned)RepeatOption); ++i)
+        {
+            llvm::Optional<llvm::json::Object> run = runOnce(source, stats);
+            if (!run) break;
+            if (!best || *run->getNumber("elapsed_ms") < *best->getNumber("elapsed_ms")) best = std::move(run);
+        }
+        llvm::sys::fs::remove(source);
+        llvm::sys::fs::remove(stats);
+
+        if (!best) {
+            llvm::errs() << "[Error] Workload " << workload.name << " failed.\n";
+            status = 1;
+            continue;
+        }
+        llvm::errs() << llvm::formatv("[Bench] {0,-10} {1,10} nodes {2,8:f2} ns/node {3,12:f0} calls/s {4,8} KiB\n",
+                                      workload.name, *best->getInteger("nodes"), *best->getNumber("ns_per_node"),
+                                      *best->getNumber("calls_per_sec"), *best->getInteger("peak_rss_kb"));
+        (*best)["name"] = workload.name;
+        (*best)["scale"] = (int64_t)scale;
+        results.push_back(std::move(*best));
+    }
+
+    std::error_code EC;
+    llvm::raw_fd_ostream out(OutputOption, EC);
+    if (EC) {
+        llvm::errs() << "[Error] Fail to write " << OutputOption << ".\n";
+        return 1;
+    }
+    llvm::json::Object report{
+        {"scale", (int64_t)ScaleOption},
+        {"repeat", (int64_t)RepeatOption},
+        {"workloads", std::move(results)},
+    };
+    out << llvm::formatv("{0:2}", llvm::json::Value(std::move(report))) << "\n";
+    return status;
+}
@@ -0,0 +1,398 @@
+//==--- Fuzzer.cpp - Differential fuzzing of the AST interpreter ------------===//
+//===----------------------------------------------------------------------===//
+// libFuzzer 的输入不直接当作源码，而是驱动一个按文法生成受支持子集程序的生成器：
+// 生成的程序在进程内带步数预算解释执行，再与本地编译运行的输出比较，
+// 解释器崩溃或输出不一致时 abort，由 libFuzzer 保存输入，fuzz.sh 负责最小化
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fuzzer/FuzzedDataProvider.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Interpreter.h"
+
+/// 生成的程序没有递归，循环次数有上界，正常情况下远达不到这个步数
+static const uint64_t MaxSteps = 2000000;
+/// 每个程序最多生成的语句数，控制本地编译和解释执行的耗时
+static const unsigned MaxStmts = 48;
+/// 本地运行的超时（秒）
+static const unsigned NativeTimeout = 5;
+
+/// 按文法生成程序。所有算术结果都对 1009 取模，数组下标与 7 按位与，除数恒为正，
+/// 调用只出现在语句中：生成的程序没有未定义行为，也不依赖求值顺序，两边的输出必须完全一致
+class Generator
+{
+  public:
+    explicit Generator(FuzzedDataProvider &data)
+        : mData(data), mOut(), mScalars(), mLocals(), mArrays(), mReadOnly(), mCallees(0), mLoops(0), mStmts(0) {}
+
+    std::string generate();
+
+  private:
+    unsigned choose(unsigned max) { return mData.ConsumeIntegralInRange<unsigned>(0, max); }
+    template <typename T> const T &pick(const std::vector<T> &items) { return items[choose(items.size() - 1)]; }
+
+    void function(unsigned index);
+    void mainFunction();
+    void globals();
+    void stmts(const std::string &indent);
+    void stmt(const std::string &indent);
+    std::string lvalue();
+    std::string element(const std::string &array, const std::string &index);
+    std::string expr(unsigned depth);
+    std::string leaf(unsigned depth);
+
+    FuzzedDataProvider &mData;
+    std::string mOut;
+    std::vector<std::string> mScalars; // 可读写的标量，包括全局变量、结构体成员和 *q
+    std::vector<std::string> mLocals; // 接收调用结果的局部变量
+    std::vector<std::string> mArrays; // 长度为 8 的 int 数组，p 表示经由指针访问
+    std::vector<std::string> mReadOnly; // 当前所在循环的归纳变量
+    unsigned mCallees; // 只能调用编号更小的函数，保证程序终止
+    unsigned mLoops;
+    unsigned mStmts;
+};
+
+std::string Generator::generate()
+{
+    mOut = "extern int GET();\n"
+           "extern void *MALLOC(int);\n"
+           "extern void FREE(void *);\n"
+           "extern void PRINT(int);\n";
+    globals();
+    std::string prelude;
+    prelude.swap(mOut);
+
+    // 输入从前往后消耗，先生成 main 使其得到最多的语句，最后按定义顺序拼接
+    unsigned functions = choose(3);
+    mCallees = functions;
+    mainFunction();
+    std::string entry;
+    entry.swap(mOut);
+    for (unsigned i = 0; i < functions; ++i)
+        function(i);
+    return prelude + mOut + entry;
+}
+
+void Generator::globals()
+{
+    mOut += "int g0, g1 = " + std::to_string(choose(100)) + ", g2;\n"
+            "int ga[8];\n"
+            "struct S { int x; int y; } gs;\n";
+}
+
+void Generator::function(unsigned index)
+{
+    mOut += "int f" + std::to_string(index) + "(int p0, int p1)\n{\n"
+            "    int x0 = 0, x1 = 0;\n"
+            "    int i0, i1;\n"
+            "    int la[8];\n"
+            // 局部数组在本地编译时不会清零
+            "    for (i0 = 0; i0 < 8; i0++) la[i0] = 0;\n";
+    mScalars = {"g0", "g1", "g2", "gs.x", "gs.y", "p0", "p1", "x0", "x1"};
+    mLocals = {"x0", "x1"};
+    mArrays = {"ga", "la"};
+    mCallees = index;
+    stmts("    ");
+    mOut += "    return " + expr(0) + ";\n}\n";
+}
+
+void Generator::mainFunction()
+{
+    mOut += "int main()\n{\n"
+            "    int x0 = 0, x1 = 0, x2 = 0;\n"
+            "    int i0, i1;\n"
+            "    int a[8];\n"
+            "    int *p = a;\n"
+            "    int *q = &x0;\n"
+            "    for (i0 = 0; i0 < 8; i0++) a[i0] = 0;\n";
+    mScalars = {"g0", "g1", "g2", "gs.x", "gs.y", "x0", "x1", "x2", "(*q)"};
+    mLocals = {"x0", "x1", "x2"};
+    mArrays = {"ga", "a", "p"};
+    stmts("    ");
+    mOut += "    return 0;\n}\n";
+}
+
+void Generator::stmts(const std::string &indent)
+{
+    unsigned count = 1 + choose(3);
+    for (unsigned i = 0; i < count; ++i)
+        stmt(indent);
+}
+
+void Generator::stmt(const std::string &indent)
+{
+    // 语句数达到上限或输入耗尽后只生成赋值
+    unsigned kind = ++mStmts > MaxStmts || mData.remaining_bytes() == 0 ? 0 : choose(8);
+    std::string inner = indent + "    ";
+    switch (kind)
+    {
+        case 2:
+            mOut += indent + "PRINT(" + expr(0) + ");\n";
+            return;
+        case 3: {
+            mOut += indent + "if (" + expr(0) + ") {\n";
+            stmts(inner);
+            if (choose(1)) {
+                mOut += indent + "} else {\n";
+                stmts(inner);
+            }
+            mOut += indent + "}\n";
+            return;
+        }
+        case 4: {
+            if (mLoops >= 2) break;
+            std::string var = "i" + std::to_string(mLoops);
+            mOut += indent + "for (" + var + " = 0; " + var + " < " + std::to_string(1 + choose(7)) + "; " + var + "++) {\n";
+            mReadOnly.push_back(var);
+            ++mLoops;
+            stmts(inner);
+            --mLoops;
+            mReadOnly.pop_back();
+            mOut += indent + "}\n";
+            return;
+        }
+        case 5: {
+            mOut += indent + "switch (" + expr(1) + " & 3) {\n";
+            for (unsigned label = 0; label < 4; ++label)
+            {
+                if (!choose(1)) continue;
+                mOut += indent + "case " + std::to_string(label) + ":\n";
+                stmts(inner);
+                if (choose(1)) mOut += inner + "break;\n";
+            }
+            mOut += indent + "default:\n";
+            stmts(inner);
+            mOut += indent + "}\n";
+            return;
+        }
+        case 6: {
+            if (mCallees == 0) break;
+            std::string callee = "f" + std::to_string(choose(mCallees - 1));
+            std::string call = callee + "(" + expr(1) + ", " + expr(1) + ")";
+            if (choose(1)) mOut += indent + call + ";\n";
+            else mOut += indent + pick(mLocals) + " = " + call + ";\n";
+            return;
+        }
+        case 7: {
+            if (mLoops == 0) break;
+            mOut += indent + "if (" + expr(1) + ") " + (choose(1) ? "break" : "continue") + ";\n";
+            return;
+        }
+        default:
+            break;
+    }
+    mOut += indent + lvalue() + " = " + expr(0) + ";\n";
+}
+
+std::string Generator::lvalue()
+{
+    if (choose(2)) return pick(mScalars);
+    return element(pick(mArrays), expr(1));
+}
+
+std::string Generator::element(const std::string &array, const std::string &index)
+{
+    if (array == "p") return "*(p + (" + index + " & 7))";
+    return array + "[" + index + " & 7]";
+}
+
+/// 叶子结点的绝对值不超过 1012，取模后的乘积不会溢出 int
+std::string Generator::expr(unsigned depth)
+{
+    if (depth >= 3) return leaf(depth);
+
+    static const char *Arith[] = {"+", "-", "*", "&", "|", "^"};
+    static const char *Compare[] = {"<", "<=", ">", ">=", "==", "!=", "&&", "||"};
+    static const char *Unary[] = {"-", "~", "!"};
+    switch (choose(7))
+    {
+        case 1: return "((" + expr(depth + 1) + " " + Arith[choose(5)] + " " + expr(depth + 1) + ") % 1009)";
+        case 2: return "(" + expr(depth + 1) + " " + Compare[choose(7)] + " " + expr(depth + 1) + ")";
+        case 3: return "(" + std::string(Unary[choose(2)]) + expr(depth + 1) + ")";
+        case 4: return "(" + expr(depth + 1) + (choose(1) ? " / " : " % ") + "((" + expr(depth + 1) + " & 7) + 1))";
+        case 5:
+            if (choose(1)) return "(((" + expr(depth + 1) + " & 255) << (" + expr(depth + 1) + " & 7)) % 1009)";
+            return "(" + expr(depth + 1) + " >> (" + expr(depth + 1) + " & 7))";
+        case 6: return "(" + expr(depth + 1) + " ? " + expr(depth + 1) + " : " + expr(depth + 1) + ")";
+        default: return leaf(depth);
+    }
+}
+
+std::string Generator::leaf(unsigned depth)
+{
+    switch (choose(3))
+    {
+        case 1: return pick(mScalars);
+        case 2:
+            if (mReadOnly.empty()) return pick(mScalars);
+            return pick(mReadOnly);
+        case 3:
+            if (depth >= 3) return pick(mScalars);
+            return element(pick(mArrays), expr(depth + 1));
+        default: return std::to_string(choose(100));
+    }
+}
+
+/// 客户程序不读输入，输出写入缓冲区
+class StringIO : public GuestIO
+{
+  public:
+    explicit StringIO(std::string &output) : mOut(output) {}
+
+    virtual bool input(int64_t &) { return false; }
+    virtual llvm::raw_ostream &output() { return mOut; }
+
+  private:
+    llvm::raw_string_ostream mOut;
+};
+
+/// 吞吐量是一等指标：libFuzzer 的 exec/s 包含本地编译，这里单独统计解释执行的耗时
+struct FuzzStats
+{
+    uint64_t execs;
+    uint64_t compared;
+    uint64_t exhausted;
+    uint64_t skipped; // 本地编译或运行失败，无法比较
+    double interpretMs;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point lastReport;
+};
+
+static FuzzStats Stats;
+static std::string Compiler;
+static std::string Extern;
+static std::string WorkDir;
+static unsigned CompareEvery;
+static bool PrintPrograms;
+
+static void report()
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - Stats.start;
+    double seconds = elapsed.count();
+    llvm::errs() << llvm::format("[Fuzz] %llu execs, %.1f execs/s, interpreter %.1f execs/s, "
+                                 "%llu compared, %llu exhausted, %llu skipped\n",
+                                 (unsigned long long)Stats.execs, seconds > 0 ? Stats.execs / seconds : 0.0,
+                                 Stats.interpretMs > 0 ? Stats.execs * 1e3 / Stats.interpretMs : 0.0,
+                                 (unsigned long long)Stats.compared, (unsigned long long)Stats.exhausted,
+                                 (unsigned long long)Stats.skipped);
+    Stats.lastReport = std::chrono::steady_clock::now();
+}
+
+static void finish()
+{
+    report();
+    if (!WorkDir.empty()) llvm::sys::fs::remove_directories(WorkDir);
+}
+
+/// 与 regress/ 相同的本地参考：extern_func.c 加上生成的程序
+static bool runNative(const std::string &source, std::string &output)
+{
+    std::string program = WorkDir + "/program.c";
+    std::string exe = WorkDir + "/program.out";
+    std::string out = WorkDir + "/output.txt";
+    {
+        std::error_code EC;
+        llvm::raw_fd_ostream file(program, EC);
+        if (EC) return false;
+        file << source;
+    }
+
+    std::string error;
+    llvm::StringRef compile[] = {Compiler, "-w", Extern, program, "-o", exe};
+    llvm::Optional<llvm::StringRef> quiet[] = {llvm::None, llvm::StringRef(""), llvm::StringRef("")};
+    if (llvm::sys::ExecuteAndWait(Compiler, compile, llvm::None, quiet, 0, 0, &error) != 0) return false;
+
+    llvm::Optional<llvm::StringRef> redirects[] = {llvm::StringRef(""), llvm::StringRef(out), llvm::StringRef("")};
+    if (llvm::sys::ExecuteAndWait(exe, {exe}, llvm::None, redirects, NativeTimeout, 0, &error) != 0) return false;
+
+    auto buffer = llvm::MemoryBuffer::getFile(out);
+    if (!buffer) return false;
+    output = (*buffer)->getBuffer().str();
+    return true;
+}
+
+static const char *getEnv(const char *name, const char *fallback)
+{
+    const char *value = getenv(name);
+    return value && *value ? value : fallback;
+}
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    // 默认值由 CMake 传入：构建解释器所用的 Clang 和 testcases/extern_func.c
+    Compiler = getEnv("FUZZ_CC", FUZZ_CC);
+    Extern = getEnv("FUZZ_EXTERN", FUZZ_EXTERN);
+    // 本地编译是瓶颈，每 N 个程序只比较一个以换取吞吐量，其余只检查解释器是否崩溃
+    CompareEvery = std::max(1, atoi(getEnv("FUZZ_COMPARE_EVERY", "1")));
+    PrintPrograms = getenv("FUZZ_PRINT") != nullptr;
+
+    llvm::SmallString<128> dir;
+    if (llvm::sys::fs::createUniqueDirectory("fuzz", dir)) {
+        llvm::errs() << "[Error] Fail to create a temporary directory.\n";
+        exit(1);
+    }
+    WorkDir = dir.str().str();
+
+    Stats = FuzzStats();
+    Stats.start = Stats.lastReport = std::chrono::steady_clock::now();
+    atexit(finish);
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    FuzzedDataProvider provider(data, size);
+    std::string source = Generator(provider).generate();
+    if (PrintPrograms) llvm::errs() << source;
+
+    std::string actual;
+    StringIO io(actual);
+    bool exhausted = false;
+    InterpreterOptions options;
+    options.io = &io;
+    options.maxSteps = MaxSteps;
+    options.exhausted = &exhausted;
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = interpret(source, options);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    io.output().flush();
+    Stats.interpretMs += elapsed.count();
+    ++Stats.execs;
+
+    // 生成器只产生受支持的程序，被拒绝说明生成器和 Verifier 不一致
+    if (!ok) {
+        llvm::errs() << "[Fuzz] The interpreter rejected the generated program:\n" << source;
+        abort();
+    }
+
+    if (exhausted) {
+        ++Stats.exhausted;
+    } else if (Stats.execs % CompareEvery == 0) {
+        std::string expected;
+        if (!runNative(source, expected)) {
+            ++Stats.skipped;
+        } else {
+            ++Stats.compared;
+            if (expected != actual) {
+                llvm::errs() << "[Fuzz] Output mismatch.\n== program ==\n" << source
+                             << "== native ==\n" << expected << "\n== interpreter ==\n" << actual << "\n";
+                abort();
+            }
+        }
+    }
+
+    if (std::chrono::steady_clock::now() - Stats.lastReport >= std::chrono::seconds(10)) report();
+    return 0;
+}
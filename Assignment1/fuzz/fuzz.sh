@@ -0,0 +1,35 @@
+#!/usr/bin/env bash
+# 用法：fuzz.sh <interpreter-fuzz> [libFuzzer 参数...]
+# 运行差分模糊测试，结束后把每个崩溃或输出不一致的输入最小化，并打印最小化后的程序
+
+if [ $# -lt 1 ]; then
+    echo -e "\e[31m[Error]\e[0m Path to interpreter-fuzz is required."
+    exit 1
+fi
+
+FUZZER=$1
+shift
+CORPUS_DIR=fuzz-corpus
+ARTIFACT_DIR=fuzz-artifacts
+
+mkdir -p $CORPUS_DIR $ARTIFACT_DIR
+echo -e "\e[32m[Info]\e[0m Fuzzing, corpus in $CORPUS_DIR, artifacts in $ARTIFACT_DIR"
+$FUZZER -artifact_prefix=$ARTIFACT_DIR/ -print_final_stats=1 "$@" $CORPUS_DIR
+
+# 输入越短生成的程序越小，libFuzzer 的 -minimize_crash 在保持失败的前提下缩短输入
+status=0
+for crash in $ARTIFACT_DIR/crash-* $ARTIFACT_DIR/timeout-*; do
+    [ -f "$crash" ] || continue
+    minimized=$ARTIFACT_DIR/minimized-$(basename $crash)
+    if ! [ -f "$minimized" ]; then
+        echo -e "\e[33m[Minimize]\e[0m $crash"
+        $FUZZER -minimize_crash=1 -runs=20000 -exact_artifact_path=$minimized $crash > /dev/null 2>&1
+        [ -f "$minimized" ] || cp $crash $minimized
+    fi
+    echo -e "\e[31m[Failure]\e[0m $minimized"
+    FUZZ_PRINT=1 $FUZZER -runs=1 $minimized 2>&1 | sed -n '/^extern int GET/,$p'
+    status=1
+done
+
+echo -e "\e[32m[Info]\e[0m All done!"
+exit $status
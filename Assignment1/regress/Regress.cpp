@@ -0,0 +1,349 @@
+//==--- Regress.cpp - Parallel regression driver of the interpreter ---------===//
+//===----------------------------------------------------------------------===//
+// 取代 all-check.sh：本地编译得到的参考输出按源码哈希缓存，
+// 所有测试用例在同一进程内并发解释执行，各自的输出写入独立的缓冲区
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Interpreter.h"
+#include "Replay.h"
+#include "Residual.h"
+#include "ThreadPool.h"
+
+static llvm::cl::list<std::string> DirsOption(llvm::cl::Positional, llvm::cl::desc("<testcase dirs>"), llvm::cl::OneOrMore);
+static llvm::cl::opt<std::string> CacheOption("cache", llvm::cl::desc("Directory of cached native reference outputs"), llvm::cl::value_desc("dir"), llvm::cl::init("native-cache"));
+static llvm::cl::opt<std::string> CCOption("cc", llvm::cl::desc("C compiler for the native reference"), llvm::cl::init("clang"));
+static llvm::cl::opt<std::string> ExternOption("extern", llvm::cl::desc("Native implementation of GET/MALLOC/FREE/PRINT"), llvm::cl::value_desc("file"), llvm::cl::Required);
+static llvm::cl::opt<std::string> InputOption("input", llvm::cl::desc("Input of tests without a <test>.in file"), llvm::cl::init("10 20 30 40 50"));
+static llvm::cl::opt<unsigned> TraceThresholdOption("trace-threshold", llvm::cl::desc("Interpret with hot loops compiled into traces after <n> iterations"), llvm::cl::init(0));
+static llvm::cl::opt<unsigned> InlineSizeOption("inline-size", llvm::cl::desc("Interpret with guest functions of at most <n> AST nodes inlined"), llvm::cl::init(0));
+static llvm::cl::opt<unsigned> ParallelLoopsOption("parallel-loops", llvm::cl::desc("Interpret with provably independent for loops run on <n> threads"), llvm::cl::init(0));
+static llvm::cl::opt<unsigned> ParallelCallsOption("parallel-calls", llvm::cl::desc("Interpret with independent calls to pure functions forked on <n> threads"), llvm::cl::init(0));
+static llvm::cl::opt<bool> ReplayCheckOption("replay-check", llvm::cl::desc("Record the I/O of each test and check that replaying it reproduces the same events"));
+static llvm::cl::opt<unsigned> CheckpointStepsOption("checkpoint-steps", llvm::cl::desc("Save a checkpoint every <n> steps and check that resuming from the last one reproduces the output"), llvm::cl::init(0));
+static llvm::cl::opt<int> ResidualKnownOption("residual-known", llvm::cl::desc("Specialize each test to the first <n> input values and check that the residual program reproduces the output"), llvm::cl::init(-1));
+static llvm::cl::opt<unsigned> JobsOption("j", llvm::cl::desc("Number of threads (0 = hardware concurrency)"), llvm::cl::init(0));
+
+/// 一个测试用例：源码、输入和两边的输出
+struct TestCase
+{
+    std::string path;
+    std::string source;
+    std::string input;
+    std::string expected;
+    std::string actual;
+    std::string error; // 非空表示无法得到参考输出
+    bool passed;
+    double elapsedMs; // 解释执行（包括 Clang 前端）的耗时
+};
+
+/// 从字符串读取输入，输出写入测试用例自己的缓冲区
+class BufferIO : public GuestIO
+{
+  public:
+    BufferIO(const std::string &input, std::string &output) : mInputs(), mOut(output)
+    {
+        llvm::StringRef rest(input), token;
+        while (true)
+        {
+            std::tie(token, rest) = llvm::getToken(rest, " \t\r\n");
+            if (token.empty()) break;
+            int64_t val;
+            if (!token.getAsInteger(10, val)) mInputs.push_back(val);
+        }
+    }
+
+    virtual bool input(int64_t &val)
+    {
+        if (mInputs.empty()) return false;
+        val = mInputs.front();
+        mInputs.pop_front();
+        return true;
+    }
+    virtual llvm::raw_ostream &output() { return mOut; }
+    virtual void print(int64_t val)
+    {
+        mOut << val;
+        mPrinted.push_back(mOut.str().size());
+    }
+
+    /// 第 i 个 PRINT 之后输出的长度
+    const std::vector<size_t> &printed() const { return mPrinted; }
+
+  private:
+    std::deque<int64_t> mInputs;
+    llvm::raw_string_ostream mOut;
+    std::vector<size_t> mPrinted;
+};
+
+static bool readFile(llvm::StringRef path, std::string &content)
+{
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer) return false;
+    content = (*buffer)->getBuffer().str();
+    return true;
+}
+
+static bool writeFile(llvm::StringRef path, llvm::StringRef content)
+{
+    std::error_code EC;
+    llvm::raw_fd_ostream out(path, EC);
+    if (EC) return false;
+    out << content;
+    return true;
+}
+
+/// 与 all-check.sh 相同，只收集 testNN.c
+static void collect(llvm::StringRef dir, std::vector<TestCase> &tests)
+{
+    std::error_code EC;
+    std::vector<std::string> paths;
+    for (llvm::sys::fs::directory_iterator it(dir, EC), end; it != end && !EC; it.increment(EC))
+    {
+        llvm::StringRef name = llvm::sys::path::filename(it->path());
+        if (name.size() == 8 && name.startswith("test") && name.endswith(".c") &&
+            llvm::isDigit(name[4]) && llvm::isDigit(name[5]))
+            paths.push_back(it->path());
+    }
+    std::sort(paths.begin(), paths.end());
+
+    for (const std::string &path : paths)
+    {
+        TestCase test;
+        test.path = path;
+        test.passed = false;
+        test.elapsedMs = 0;
+        readFile(path, test.source);
+        if (!readFile(llvm::StringRef(path).drop_back(2).str() + ".in", test.input)) test.input = InputOption;
+        tests.push_back(test);
+    }
+}
+
+/// 参考输出只取决于源码、内建函数的本地实现、输入和编译器
+static std::string cacheKey(const TestCase &test, llvm::StringRef externSource)
+{
+    llvm::MD5 hash;
+    hash.update(test.source);
+    hash.update(externSource);
+    hash.update(test.input);
+    hash.update(CCOption);
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    return result.digest().str().str();
+}
+
+/// 在独立的临时目录中编译并运行，避免并发的测试共用文件
+static bool runNative(TestCase &test)
+{
+    llvm::SmallString<128> dir;
+    if (llvm::sys::fs::createUniqueDirectory("regress", dir)) {
+        test.error = "cannot create a temporary directory";
+        return false;
+    }
+    std::string exe = (dir + "/test.out").str();
+    std::string in = (dir + "/input.txt").str();
+    std::string out = (dir + "/output.txt").str();
+    std::string error;
+
+    bool ok = false;
+    llvm::ErrorOr<std::string> cc = llvm::sys::findProgramByName(CCOption);
+    if (!cc) {
+        test.error = "cannot find " + CCOption;
+    } else {
+        llvm::StringRef compile[] = {*cc, "-w", ExternOption, test.path, "-o", exe};
+        llvm::Optional<llvm::StringRef> quiet[] = {llvm::None, llvm::StringRef(""), llvm::StringRef("")};
+        llvm::Optional<llvm::StringRef> redirects[] = {llvm::StringRef(in), llvm::StringRef(out), llvm::StringRef("")};
+        if (llvm::sys::ExecuteAndWait(*cc, compile, llvm::None, quiet, 0, 0, &error) != 0) {
+            test.error = "native compilation failed " + error;
+        } else if (!writeFile(in, test.input)) {
+            test.error = "cannot write the input";
+        } else if (llvm::sys::ExecuteAndWait(exe, {exe}, llvm::None, redirects, 0, 0, &error) < 0) {
+            test.error = "native run failed " + error;
+        } else {
+            ok = readFile(out, test.expected);
+        }
+    }
+    llvm::sys::fs::remove_directories(dir);
+    return ok;
+}
+
+/// 不读取输入，只从录制的日志回放，输出和每个事件都应与录制时相同
+static void replayTest(TestCase &test, const std::string &log, const InterpreterOptions &recorded)
+{
+    std::string output;
+    BufferIO io("", output);
+    IOReplayer replayer(&io);
+    if (!replayer.load(log)) {
+        test.error = "invalid I/O log";
+        test.passed = false;
+        return;
+    }
+    InterpreterOptions options = recorded;
+    options.io = &replayer;
+    options.specializer = nullptr;
+    interpret(test.source, options);
+    io.output().flush();
+    if (replayer.diverged() || output != test.actual) {
+        llvm::raw_string_ostream report(test.error);
+        replayer.report(report);
+        test.error.pop_back();
+        test.passed = false;
+    }
+}
+
+/// 从执行中最后保存的检查点恢复：检查点之前的输出加上恢复后的输出应与完整的输出相同
+static void resumeTest(TestCase &test, llvm::StringRef path, const std::vector<size_t> &printed,
+                       const InterpreterOptions &saved)
+{
+    Checkpoint checkpoint;
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    // 入口函数中没有执行过循环时不会保存检查点
+    if (!buffer || (*buffer)->getBufferSize() == 0) return;
+    if (!checkpoint.load((*buffer)->getBuffer()) || checkpoint.outputs > printed.size()) {
+        test.error = "invalid checkpoint";
+        test.passed = false;
+        return;
+    }
+    std::string output = test.actual.substr(0, checkpoint.outputs ? printed[checkpoint.outputs - 1] : 0);
+    BufferIO io(test.input, output);
+    InterpreterOptions options = saved;
+    options.io = &io;
+    options.checkpointFile.clear();
+    options.resume = &checkpoint;
+    interpret(test.source, options);
+    io.output().flush();
+    if (output != test.actual) {
+        test.error = "resumed output differs after " + std::to_string(checkpoint.outputs) + " outputs";
+        test.passed = false;
+    }
+}
+
+/// 剩余程序折叠了已知输入部分的输出，读取其余的输入，其输出应与完整的输出相同
+static void residualTest(TestCase &test, const Specializer &specializer, const InterpreterOptions &specialized)
+{
+    // 入口函数体的第一条顶层语句就读取了未知的输入
+    if (specializer.residual().empty()) return;
+    std::string output;
+    BufferIO io(test.input, output);
+    int64_t val;
+    for (size_t skipped = 0; skipped < specializer.residualInputs() && io.input(val);)
+        ++skipped;
+    InterpreterOptions options = specialized;
+    options.io = &io;
+    options.specializer = nullptr;
+    interpret(specializer.residual(), options);
+    io.output().flush();
+    if (output != test.actual) {
+        test.error = "residual output differs after " + std::to_string(specializer.residualInputs()) + " inputs";
+        test.passed = false;
+    }
+}
+
+static void interpretTest(TestCase &test)
+{
+    BufferIO io(test.input, test.actual);
+    IORecorder recorder(&io);
+    InterpreterOptions options;
+    options.io = ReplayCheckOption ? (GuestIO *)&recorder : &io; // 不设置 log：客户程序的调试信息在并发执行时没有意义
+    Specializer specializer(options.io, ResidualKnownOption < 0 ? AllInputs : (size_t)ResidualKnownOption);
+    if (ResidualKnownOption >= 0) {
+        options.io = &specializer;
+        options.specializer = &specializer;
+    }
+    options.traceThreshold = TraceThresholdOption;
+    options.inlineSize = InlineSizeOption;
+    options.parallelLoops = ParallelLoopsOption;
+    options.parallelCalls = ParallelCallsOption;
+    llvm::SmallString<128> checkpoint;
+    if (CheckpointStepsOption && !llvm::sys::fs::createTemporaryFile("regress", "ckpt", checkpoint)) {
+        options.checkpointFile = checkpoint.str().str();
+        options.checkpointSteps = CheckpointStepsOption;
+    }
+    auto start = std::chrono::steady_clock::now();
+    interpret(test.source, options);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    io.output().flush();
+    test.elapsedMs = elapsed.count();
+    test.passed = test.error.empty() && test.actual == test.expected;
+    if (ReplayCheckOption && test.passed) replayTest(test, recorder.log(), options);
+    if (ResidualKnownOption >= 0 && test.passed) residualTest(test, specializer, options);
+    if (!options.checkpointFile.empty()) {
+        if (test.passed) resumeTest(test, checkpoint, io.printed(), options);
+        llvm::sys::fs::remove(checkpoint);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Parallel regression driver of the Clang AST interpreter.\n");
+
+    std::vector<TestCase> tests;
+    for (const std::string &dir : DirsOption)
+        collect(dir, tests);
+    if (tests.empty()) {
+        llvm::errs() << "[Error] No testcases found.\n";
+        return 1;
+    }
+
+    std::string externSource;
+    if (!readFile(ExternOption, externSource)) {
+        llvm::errs() << "[Error] Fail to read " << ExternOption << ".\n";
+        return 1;
+    }
+    llvm::sys::fs::create_directories(CacheOption);
+
+    unsigned jobs = JobsOption ? (unsigned)JobsOption : std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(jobs);
+    std::atomic<unsigned> compiled(0);
+    auto start = std::chrono::steady_clock::now();
+    pool.parallelFor(0, tests.size(), 1, [&](int64_t lo, int64_t hi) {
+        for (int64_t i = lo; i < hi; ++i)
+        {
+            TestCase &test = tests[i];
+            llvm::SmallString<128> cached(CacheOption);
+            llvm::sys::path::append(cached, cacheKey(test, externSource) + ".out");
+            if (!readFile(cached, test.expected) && runNative(test)) {
+                writeFile(cached, test.expected);
+                ++compiled;
+            }
+            interpretTest(test);
+        }
+    });
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    unsigned passed = 0;
+    for (const TestCase &test : tests)
+    {
+        llvm::StringRef name = test.path;
+        if (test.passed) {
+            ++passed;
+            llvm::outs() << "\e[34m" << name << "\e[0m: \e[32mAC\e[0m";
+        } else {
+            llvm::outs() << "\e[34m" << name << "\e[0m: \e[31mWa\e[0m";
+        }
+        llvm::outs() << llvm::format(" (%.2f ms)", test.elapsedMs);
+        if (!test.error.empty()) llvm::outs() << " " << test.error;
+        llvm::outs() << "\n";
+    }
+    llvm::outs() << "[Info] " << passed << "/" << tests.size() << " passed, " << compiled
+                 << " native references rebuilt, " << llvm::format("%.1f", elapsed.count()) << " ms on "
+                 << jobs << " threads.\n";
+    return passed == tests.size() ? 0 : 1;
+}
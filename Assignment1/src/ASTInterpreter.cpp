@@ -6,19 +6,77 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
-#include "llvm/Support/CommandLine.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+
+#include <sys/resource.h>
 
 using namespace clang;
 
-#include "Environment.h"
+#include "Interpreter.h"
+#include "Residual.h"
+#include "ThreadPool.h"
+#include "Verifier.h"
 
 class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor>
 {
   public:
+    /// 并行循环的执行统计：执行次数和迭代次数
+    struct LoopStats
+    {
+        uint64_t runs;
+        uint64_t iterations;
+    };
+    typedef std::map<const ForStmt *, LoopStats> LoopReport;
+
     explicit InterpreterVisitor(const ASTContext &context, Environment *env)
-        : EvaluatedExprVisitor(context), mEnv(env){}
+        : EvaluatedExprVisitor(context), mEnv(env), mPool(nullptr), mReport(nullptr), mTasks(nullptr),
+          mForks(nullptr), mMaxForkDepth(0), mRecorder(nullptr), mCheckpoint(nullptr), mNoCheckpoint(), mSpecializer(nullptr){}
     virtual ~InterpreterVisitor(){}
 
+    /// pool 非空时，迭代相互独立的 for 循环切块到线程池中执行
+    void setPool(ThreadPool *pool, LoopReport *report)
+    {
+        mPool = pool;
+        mReport = report;
+    }
+
+    /// tasks 非空时，两个操作数都是纯函数调用的二元运算一个交给线程池、一个在当前线程求值
+    void setTasks(ThreadPool *tasks, std::atomic<uint64_t> *forks)
+    {
+        mTasks = tasks;
+        mForks = forks;
+        // 粒度控制：分叉的两半都加深一层，每层使任务数翻倍，分出约 8 倍于线程数的任务后，更深的调用都顺序执行。
+        // 因此一次求值最多分叉 2^mMaxForkDepth - 1 次
+        mMaxForkDepth = 3;
+        for (unsigned threads = tasks ? tasks->size() : 0; threads > 1; threads >>= 1)
+            ++mMaxForkDepth;
+    }
+
+    /// policy 非空时，每隔 policy->interval 步在入口函数的循环回边处保存检查点
+    void setCheckpoint(CheckpointPolicy *policy) { mCheckpoint = policy; }
+
+    /// specializer 非空时，入口函数体的顶层语句逐条执行，每条之前向 specializer 报告
+    void setSpecializer(Specializer *specializer) { mSpecializer = specializer; }
+
+    // 所有结点都经由此处分派，在这里向 Environment 发布当前执行的结点
+    void Visit(Stmt *stmt)
+    {
+        mEnv->trace(stmt);
+        if (mEnv->fold(stmt)) return;
+        EvaluatedExprVisitor::Visit(stmt);
+    }
+
+    // 覆盖 EvaluatedExprVisitorBase::VisitStmt，使子结点也经由上面的 Visit 分派
+    virtual void VisitStmt(Stmt *stmt)
+    {
+        for (auto *SubStmt : stmt->children())
+        {
+            if (SubStmt) Visit(SubStmt);
+        }
+    }
+
     virtual void VisitIntegerLiteral(IntegerLiteral *intl)
     {
         mEnv->intliteral(intl);
@@ -37,7 +95,9 @@ class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor>
 
     virtual void VisitBinaryOperator(BinaryOperator *bop)
     {
-        VisitStmt(bop);
+        const ForkJoin *fork = mTasks ? mEnv->getForkJoin(bop) : nullptr;
+        if (fork && mEnv->getForkDepth() < mMaxForkDepth) forkJoin(*fork);
+        else VisitStmt(bop);
         mEnv->binop(bop);
     }
     virtual void VisitUnaryOperator(UnaryOperator *uop)
@@ -57,22 +117,27 @@ class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor>
     }
     virtual void VisitCallExpr(CallExpr *call)
     {
-        VisitStmt(call);
-        
+        // 只求值实参，被调函数在预处理时已经解析
+        for (auto *arg : call->arguments())
+            Visit(arg);
+
         if(mEnv->isBuildIn(call)) {
             mEnv->callbuildin(call);
             return;
         }
 
-        mEnv->call(call);
-        FunctionDecl *callee = call->getDirectCallee();
-        if(callee->isDefined()) {
-            callee = callee->getDefinition();
+        if (FunctionDecl *callee = mEnv->enterInline(call)) {
+            runInline(callee->getBody(), call);
+            mEnv->exitInline();
+            return;
         }
+
+        // 调用点在预处理时已经解析到函数定义
+        FunctionDecl *callee = mEnv->call(call);
         try {
             VisitStmt(callee->getBody());
         } catch (self::ReturnException &e) {
-            self::errs() << e.what() << "\n";
+            mEnv->log() << e.what() << "\n";
         }
         
         mEnv->exit(call);
@@ -87,8 +152,22 @@ class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor>
 
     virtual void VisitArraySubscriptExpr(ArraySubscriptExpr *arraysub)
     {
-        VisitStmt(arraysub);
-        mEnv->arraysub(arraysub);
+        VisitAccessPath(arraysub);
+    }
+
+    virtual void VisitMemberExpr(MemberExpr *member)
+    {
+        VisitAccessPath(member);
+    }
+
+    // a[i][j].x 整条访问链只求值起点和各级下标，中间的结点不再访问
+    void VisitAccessPath(Expr *expr)
+    {
+        const AccessPath &path = mEnv->getAccessPath(expr);
+        Visit(path.base);
+        for (auto &index : path.indices)
+            Visit(index.first);
+        mEnv->access(expr, path);
     }
 
     virtual void VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *ueott)
@@ -117,7 +196,9 @@ class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor>
         
         if(condExpr == nullptr) return;
         Visit(condExpr);
-        if(mEnv->cond(condExpr)) {
+        bool taken = mEnv->cond(condExpr);
+        if (mRecorder) mRecorder->record(ifstmt, taken);
+        if(taken) {
             Visit(thenStmt);
         } else if (elseStmt) {
             Visit(elseStmt);
@@ -134,7 +215,9 @@ class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor>
           return;
 
         Visit(condExpr);
-        if(mEnv->cond(condExpr)) {
+        bool taken = mEnv->cond(condExpr);
+        if (mRecorder) mRecorder->record(condop, taken);
+        if(taken) {
             Visit(trueExpr);
             mEnv->condop(condop, trueExpr);
         } else {
@@ -148,20 +231,7 @@ class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor>
         Expr *condExpr = whstmt->getCond();
         Stmt *bodyStmt = whstmt->getBody();
         if(condExpr == nullptr) return;
-
-        Visit(condExpr);
-        while(mEnv->cond(condExpr))
-        {
-            try {
-                Visit(bodyStmt); // At least: NullStmt
-            } catch (self::BreakException &e) {
-                self::errs() << e.what() << "\n";
-                break;
-            } catch (self::ContinueException &e) {
-                self::errs() << e.what() << "\n";
-            }
-            Visit(condExpr);
-        }
+        runLoop(whstmt, condExpr, bodyStmt, nullptr);
     }
 
     virtual void VisitForStmt(ForStmt *forstmt)
@@ -172,24 +242,47 @@ class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor>
         Stmt *bodyStmt = forstmt->getBody();
             
         if(initStmt) Visit(initStmt);
-        
-        while(true) 
-        {
-            if(condExpr) {
-                Visit(condExpr);
-                // for(;;); -> condExpr is nullptr
-                if(!mEnv->cond(condExpr)) break;
-            }
-            try {
-                Visit(bodyStmt); // At least: NullStmt
-            } catch (self::BreakException &e) {
-                self::errs() << e.what() << "\n";
-                break;
-            } catch (self::ContinueException &e) {
-                self::errs() << e.what() << "\n";
-            }
-            if(incExpr) Visit(incExpr);
+
+        // 能识别为批量数组运算的循环直接交给 SIMD 内核
+        if (const LoopIdiom *idiom = mEnv->getLoopIdiom(forstmt)) {
+            Visit(idiom->bound);
+            if (idiom->value) Visit(idiom->value);
+            if (mEnv->idiom(*idiom)) return;
+        }
+
+        if (mPool) {
+            const ParallelLoop *loop = mEnv->getParallelLoop(forstmt);
+            if (loop && runParallel(forstmt, *loop)) return;
         }
+
+        // for(;;); -> condExpr is nullptr
+        runLoop(forstmt, condExpr, bodyStmt, incExpr);
+    }
+
+    /// 按预处理生成的分派表跳到匹配的 case，从那里顺序执行到 switch 体结束或 break
+    virtual void VisitSwitchStmt(SwitchStmt *switchstmt)
+    {
+        Expr *condExpr = switchstmt->getCond();
+        Visit(condExpr);
+
+        const SwitchTable &table = mEnv->getSwitchTable(switchstmt);
+        try {
+            for (unsigned i = table.lookup(mEnv->getStmtVal(condExpr)); i < table.stmts.size(); ++i)
+                Visit(table.stmts[i]);
+        } catch (self::BreakException &e) {
+            mEnv->log() << e.what() << "\n";
+        }
+    }
+
+    // 标号本身不执行，case 的常量表达式已经编译进分派表
+    virtual void VisitCaseStmt(CaseStmt *casestmt)
+    {
+        Visit(casestmt->getSubStmt());
+    }
+
+    virtual void VisitDefaultStmt(DefaultStmt *defaultstmt)
+    {
+        Visit(defaultstmt->getSubStmt());
     }
 
     virtual void VisitBreakStmt(BreakStmt *breakstmt)
@@ -212,117 +305,528 @@ class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor>
         mEnv->vardecl(vardecl);
     }
 
-    virtual void VisitFunctionDecl(FunctionDecl *fdecl)
+    /// 程序没有通过 Verifier 时不执行，返回 false；resume 非空时从检查点所在的循环继续执行
+    bool Init(TranslationUnitDecl *unit, const Checkpoint *resume = nullptr)
     {
-        mEnv->fdecl(fdecl);
-    }
+        mEnv->init(unit);
+        Verifier verifier(Context, *mEnv);
+        if (!verifier.verify(unit)) return false;
+        mEnv->initGlobals(unit, verifier.getAddressTaken());
 
-    void Init(TranslationUnitDecl *unit)
-    {
         for (auto *SubDecl : unit->decls())
         {
             if(SubDecl == nullptr) continue;
-            if(FunctionDecl *fdecl = dyn_cast<FunctionDecl>(SubDecl)) {
-                VisitFunctionDecl(fdecl);
-            } else if(VarDecl *vardecl = dyn_cast<VarDecl>(SubDecl)) {
+            if(VarDecl *vardecl = dyn_cast<VarDecl>(SubDecl)) {
                 VisitVarDecl(vardecl);
             }
             // more decl
         }
-        mEnv->init(unit);
-        FunctionDecl *entry = mEnv->getEntry();
+        FunctionDecl *entry = mEnv->start();
+        std::vector<Stmt *> path;
+        if (resume) {
+            uint64_t index = 0;
+            if (!locate(entry->getBody(), nullptr, resume->loop, index, path) || !isResumable(path)) {
+                // 作为错误诊断报告，interpret() 因此返回 false
+                DiagnosticsEngine &diags = Context.getDiagnostics();
+                diags.Report(entry->getLocation(),
+                             diags.getCustomDiagID(DiagnosticsEngine::Error, "the checkpoint does not match the program"));
+                return false;
+            }
+            mEnv->restore(*resume);
+        }
+        if (mCheckpoint) mCheckpoint->next = mEnv->budget().steps() + mCheckpoint->interval;
         try {
-            VisitStmt(entry->getBody());
+            if (resume) resumeAt(path, 0);
+            else if (mSpecializer) runSpecialized(entry);
+            else VisitStmt(entry->getBody());
         } catch (self::ReturnException &e) {
-            self::errs() << e.what() << "\n";
+            mEnv->log() << e.what() << "\n";
         }
+        return true;
     }
 
   private:
+    /// 录制期间让 if 和三目运算符向 recorder 报告方向，离开作用域（包括异常）时恢复
+    struct RecordScope
+    {
+        TraceRecorder *&slot;
+        TraceRecorder *outer;
+        RecordScope(TraceRecorder *&slot, TraceRecorder *recorder) : slot(slot), outer(slot)
+        {
+            if (recorder) slot = recorder;
+        }
+        ~RecordScope() { slot = outer; }
+    };
+
+    /// while 和 for 的顺序执行：开启 trace 时，热循环的一次迭代被录制并编译为直线代码，
+    /// 之后的迭代执行 trace，守卫失败时从侧出口回到逐个结点的解释执行
+    void runLoop(Stmt *loop, Expr *condExpr, Stmt *bodyStmt, Expr *incExpr)
+    {
+        TraceState *state = mEnv->getTraceState(loop);
+        while(true)
+        {
+            // 求值循环条件之前没有进行到一半的表达式，可以保存检查点
+            if (mCheckpoint && mEnv->budget().steps() >= mCheckpoint->next) checkpoint(loop);
+            if (state && state->trace) {
+                std::shared_ptr<const Trace> trace = state->trace;
+                unsigned exit;
+                if (mEnv->runTrace(*state, exit)) break;
+                if (!resume(trace->exits[exit])) break;
+                if(incExpr) Visit(incExpr);
+                continue;
+            }
+
+            if(condExpr) {
+                Visit(condExpr);
+                if(!mEnv->cond(condExpr)) break;
+            }
+            mEnv->budget().iteration(); // 循环回边
+            bool record = state && mEnv->shouldRecord(*state);
+            TraceRecorder recorder;
+            try {
+                RecordScope scope(mRecorder, record ? &recorder : nullptr);
+                Visit(bodyStmt); // At least: NullStmt
+            } catch (self::BreakException &e) {
+                mEnv->log() << e.what() << "\n";
+                break;
+            } catch (self::ContinueException &e) {
+                mEnv->log() << e.what() << "\n";
+                record = false;
+            }
+            if (record) mEnv->compileTrace(*state, condExpr, bodyStmt, incExpr, recorder);
+            if(incExpr) Visit(incExpr);
+        }
+    }
+
+    static void loopParts(Stmt *loop, Expr *&condExpr, Stmt *&bodyStmt, Expr *&incExpr)
+    {
+        if (WhileStmt *whstmt = dyn_cast<WhileStmt>(loop)) {
+            condExpr = whstmt->getCond();
+            bodyStmt = whstmt->getBody();
+            incExpr = nullptr;
+        } else {
+            ForStmt *forstmt = llvm::cast<ForStmt>(loop);
+            condExpr = forstmt->getCond();
+            bodyStmt = forstmt->getBody();
+            incExpr = forstmt->getInc();
+        }
+    }
+
+    /// 按先序遍历在 stmt 中查找 loop 或先序编号为 target 的语句，path 为从 stmt 到它经过的各层语句
+    static bool locate(Stmt *stmt, Stmt *loop, uint64_t target, uint64_t &index, std::vector<Stmt *> &path)
+    {
+        path.push_back(stmt);
+        if (stmt == loop || index == target) return true;
+        for (Stmt *child : stmt->children())
+        {
+            if (child == nullptr) continue;
+            ++index;
+            if (locate(child, loop, target, index, path)) return true;
+        }
+        path.pop_back();
+        return false;
+    }
+
+    /// 检查点所在的循环与函数体之间只能是复合语句、if 和循环，恢复时才能沿 path 重新进入
+    static bool isResumable(const std::vector<Stmt *> &path)
+    {
+        for (size_t i = 0; i < path.size(); ++i)
+        {
+            bool loop = isa<WhileStmt>(path[i]) || isa<ForStmt>(path[i]);
+            if (i + 1 == path.size()) return loop;
+            if (!loop && !isa<CompoundStmt>(path[i]) && !isa<IfStmt>(path[i])) return false;
+        }
+        return false;
+    }
+
+    /// 只有入口函数的栈帧时才保存：被调函数的栈帧中有求值到一半的调用表达式，无法重新进入
+    void checkpoint(Stmt *loop)
+    {
+        if (mEnv->depth() != 1 || mNoCheckpoint.count(loop)) return;
+        Checkpoint checkpoint;
+        std::vector<Stmt *> path;
+        // 内联展开的函数中的循环不在入口函数体中
+        if (!locate(mEnv->getEntry()->getBody(), loop, ~0ull, checkpoint.loop, path) || !isResumable(path)) {
+            mNoCheckpoint.insert(loop);
+            return;
+        }
+        checkpoint.source = mCheckpoint->source;
+        mEnv->capture(checkpoint);
+        if (checkpoint.save(mCheckpoint->path)) ++mCheckpoint->written;
+        else llvm::errs() << "[Error] Fail to write checkpoint: " << mCheckpoint->path << ".\n";
+        mCheckpoint->next = mEnv->budget().steps() + mCheckpoint->interval;
+    }
+
+    /// 与 VisitStmt 相同地执行入口函数体，顶层语句之间只有入口函数的栈帧
+    void runSpecialized(FunctionDecl *entry)
+    {
+        CompoundStmt *body = llvm::cast<CompoundStmt>(entry->getBody());
+        unsigned index = 0;
+        for (Stmt *stmt : body->body())
+        {
+            mSpecializer->boundary(Context, *mEnv, entry, index++);
+            Visit(stmt);
+        }
+        mSpecializer->boundary(Context, *mEnv, entry, index);
+    }
+
+    /// 从检查点恢复：沿 path 进入各层语句，跳过已经执行的部分，从最内层循环的条件处继续
+    void resumeAt(const std::vector<Stmt *> &path, size_t i)
+    {
+        Stmt *stmt = path[i];
+        Expr *condExpr, *incExpr;
+        Stmt *bodyStmt;
+        if (i + 1 == path.size()) {
+            loopParts(stmt, condExpr, bodyStmt, incExpr);
+            runLoop(stmt, condExpr, bodyStmt, incExpr);
+            return;
+        }
+        if (CompoundStmt *compound = dyn_cast<CompoundStmt>(stmt)) {
+            auto iter = std::find(compound->body_begin(), compound->body_end(), path[i + 1]);
+            resumeAt(path, i + 1);
+            for (++iter; iter != compound->body_end(); ++iter)
+                Visit(*iter);
+            return;
+        }
+        if (isa<IfStmt>(stmt)) {
+            resumeAt(path, i + 1);
+            return;
+        }
+        // 外层循环：先执行完本次迭代余下的部分，再照常继续
+        loopParts(stmt, condExpr, bodyStmt, incExpr);
+        try {
+            resumeAt(path, i + 1);
+        } catch (self::BreakException &e) {
+            mEnv->log() << e.what() << "\n";
+            return;
+        } catch (self::ContinueException &e) {
+            mEnv->log() << e.what() << "\n";
+        }
+        if(incExpr) Visit(incExpr);
+        runLoop(stmt, condExpr, bodyStmt, incExpr);
+    }
+
+    /// 内联展开的函数体：return 只出现在复合语句和 if 中，执行到 return 时直接结束，返回 true
+    bool runInline(Stmt *stmt, CallExpr *call)
+    {
+        if (stmt == nullptr) return false;
+        if (ReturnStmt *returnstmt = dyn_cast<ReturnStmt>(stmt)) {
+            mEnv->trace(returnstmt);
+            Expr *retVal = returnstmt->getRetValue();
+            if (retVal) Visit(retVal);
+            if (retVal && !retVal->getType()->isVoidType()) mEnv->bindStmt(call, mEnv->getStmtVal(retVal));
+            return true;
+        }
+        if (CompoundStmt *compound = dyn_cast<CompoundStmt>(stmt)) {
+            mEnv->trace(compound);
+            for (auto iter = compound->body_begin(); iter != compound->body_end(); ++iter)
+                if (runInline(*iter, call)) return true;
+            return false;
+        }
+        if (IfStmt *ifstmt = dyn_cast<IfStmt>(stmt)) {
+            mEnv->trace(ifstmt);
+            Visit(ifstmt->getCond());
+            bool taken = mEnv->cond(ifstmt->getCond());
+            if (mRecorder) mRecorder->record(ifstmt, taken);
+            return runInline(taken ? ifstmt->getThen() : ifstmt->getElse(), call);
+        }
+        Visit(stmt);
+        return false;
+    }
+
+    /// 侧出口：解释执行本次迭代余下的语句，遇到 break 时返回 false
+    bool resume(const std::vector<Stmt *> &stmts)
+    {
+        try {
+            for (Stmt *stmt : stmts)
+                Visit(stmt);
+        } catch (self::BreakException &e) {
+            mEnv->log() << e.what() << "\n";
+            return false;
+        } catch (self::ContinueException &e) {
+            mEnv->log() << e.what() << "\n";
+        }
+        return true;
+    }
+
+    // 迭代次数太少时切分到线程上的开销大于收益
+    static const int64_t MinParallelTrips = 1024;
+
+    /// 在线程池上执行迭代相互独立的循环，不满足运行时条件时返回 false，由调用方顺序执行
+    bool runParallel(ForStmt *forstmt, const ParallelLoop &loop)
+    {
+        int64_t start = mEnv->getDeclVal(loop.induction);
+        Visit(loop.bound);
+        int64_t end = mEnv->getStmtVal(loop.bound) + (loop.inclusive ? 1 : 0);
+        if (end - start < MinParallelTrips) return false;
+
+        // 指针基址可能互为别名，只有在运行时才能确定
+        std::vector<int64_t> bases;
+        for (auto &access : loop.accesses)
+            bases.push_back(mEnv->getDeclVal(access.base));
+        if (!loop.independent(bases, start, end)) return false;
+
+        Environment *parent = mEnv;
+        const ASTContext &context = Context;
+        std::atomic<uint64_t> nodes(0);
+        std::mutex joinLock;
+        int64_t grain = std::max<int64_t>(64, (end - start) / (mPool->size() * 4));
+        mPool->parallelFor(start, end, grain, [parent, &context, forstmt, &loop, &nodes, &joinLock](int64_t lo, int64_t hi) {
+            Environment worker(context);
+            worker.fork(*parent);
+            InterpreterVisitor visitor(context, &worker);
+            visitor.runIterations(forstmt, loop, lo, hi);
+            nodes += worker.nodes();
+            // 循环体内的调用和内层循环的步数；parent 在 parallelFor 期间不计数
+            std::lock_guard<std::mutex> guard(joinLock);
+            parent->budget().join(worker.budget());
+        });
+
+        // 与顺序执行结束时的状态一致
+        mEnv->addNodes(nodes);
+        mEnv->bindDecl(loop.induction, end);
+        mEnv->budget().iteration(end - start);
+        LoopStats &stats = (*mReport)[forstmt];
+        stats.runs += 1;
+        stats.iterations += end - start;
+        return true;
+    }
+
+    void runIterations(ForStmt *forstmt, const ParallelLoop &loop, int64_t lo, int64_t hi)
+    {
+        for (int64_t i = lo; i < hi; ++i)
+        {
+            mEnv->bindDecl(loop.induction, i);
+            try {
+                Visit(forstmt->getBody());
+            } catch (self::ContinueException &e) {
+            }
+        }
+    }
+
+    /// 两个调用都是纯函数调用，各自只写新压入的栈帧：工作线程复制当前栈帧用于求值实参，
+    /// 与当前线程并发执行，汇合后把结果绑定到当前栈帧
+    void forkJoin(const ForkJoin &fork)
+    {
+        Environment worker(Context);
+        worker.fork(*mEnv);
+        const ASTContext &context = Context;
+        ThreadPool *tasks = mTasks;
+        std::atomic<uint64_t> *forks = mForks;
+        mEnv->enterFork();
+        mTasks->invoke([this, &fork]() { Visit(fork.local); },
+                       [&worker, &context, &fork, tasks, forks]() {
+                           InterpreterVisitor visitor(context, &worker);
+                           visitor.setTasks(tasks, forks);
+                           visitor.Visit(fork.spawned);
+                       });
+        mEnv->leaveFork();
+
+        mEnv->bindStmt(fork.spawned, worker.getStmtVal(fork.spawned));
+        mEnv->addNodes(worker.nodes());
+        mEnv->budget().join(worker.budget());
+        ++*mForks;
+    }
+
     Environment *mEnv;
+    ThreadPool *mPool;
+    LoopReport *mReport;
+    ThreadPool *mTasks;
+    std::atomic<uint64_t> *mForks;
+    unsigned mMaxForkDepth;
+    TraceRecorder *mRecorder; // 仅在录制热循环的一次迭代时非空
+    CheckpointPolicy *mCheckpoint; // 仅在 --checkpoint 的主线程上非空
+    llvm::SmallPtrSet<Stmt *, 8> mNoCheckpoint; // 不在入口函数体中或无法重新进入的循环
+    Specializer *mSpecializer;
 };
 
 class InterpreterConsumer : public ASTConsumer
 {
   public:
-    explicit InterpreterConsumer(const ASTContext &context) : mEnv(context), mVisitor(context, &mEnv){}
+    explicit InterpreterConsumer(const ASTContext &context, const InterpreterOptions &options, const std::string &source)
+        : mEnv(context), mVisitor(context, &mEnv), mOptions(options), mSource(source){}
     virtual ~InterpreterConsumer(){}
 
     virtual void HandleTranslationUnit(clang::ASTContext &Context)
     {
         TranslationUnitDecl *decl = Context.getTranslationUnitDecl();
-        mVisitor.Init(decl);
+        Budget &budget = mEnv.budget();
+        budget.setMaxSteps(mOptions.maxSteps);
+        budget.setTimeout(mOptions.timeoutMs);
+        if (mOptions.yield) budget.setYield(mOptions.timeSlice, mOptions.yield);
+        mEnv.setIO(mOptions.io);
+        mEnv.setLog(mOptions.log);
+        mEnv.setTraceThreshold(mOptions.traceThreshold);
+        mEnv.setInline(mOptions.inlineSize, mOptions.inlineDepth);
+        CheckpointPolicy checkpoint = {mOptions.checkpointFile, mSource, std::max<uint64_t>(1, mOptions.checkpointSteps), 0, 0};
+        if (!mOptions.checkpointFile.empty()) mVisitor.setCheckpoint(&checkpoint);
+        mEnv.setPointerTracking(!mOptions.checkpointFile.empty());
+        mVisitor.setSpecializer(mOptions.specializer);
+
+        std::unique_ptr<ThreadPool> pool;
+        InterpreterVisitor::LoopReport loops;
+        if (mOptions.parallelLoops > 1) {
+            pool.reset(new ThreadPool(mOptions.parallelLoops));
+            mVisitor.setPool(pool.get(), &loops);
+        }
+        std::unique_ptr<ThreadPool> tasks;
+        std::atomic<uint64_t> forks(0);
+        if (mOptions.parallelCalls > 1) {
+            tasks.reset(new ThreadPool(mOptions.parallelCalls));
+            mEnv.setForkJoin(true);
+            mVisitor.setTasks(tasks.get(), &forks);
+        }
+
+        // 只对解释执行阶段采样，不包括 Clang 前端的解析时间
+        Profiler profiler;
+        if (!mOptions.profileFile.empty()) {
+            mEnv.setProfiler(&profiler);
+            if (!profiler.start(mOptions.profileHz))
+                mEnv.log() << "[Error] Fail to start the sampling profiler.\n";
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        bool exhausted = false, ran = true;
+        if (mOptions.io) mOptions.io->begin(budget);
+        try {
+            ran = mVisitor.Init(decl, mOptions.resume);
+        } catch (self::BudgetException &e) {
+            // 先输出已经产生的部分结果，再报告统计信息
+            llvm::outs().flush();
+            llvm::errs() << "\n[Budget] " << e.what() << " Stopped after " << budget.steps() << " steps ("
+                         << budget.calls() << " calls, " << budget.iterations() << " loop iterations, "
+                         << llvm::format("%.1f", budget.elapsedMs()) << " ms).\n";
+            exhausted = true;
+            if (mOptions.exhausted) *mOptions.exhausted = true;
+        }
+        if (mOptions.io) mOptions.io->end(exhausted);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        // 没有通过检查的程序没有执行，错误已经报告，不输出任何统计
+        if (!ran) {
+            if (!mOptions.profileFile.empty()) {
+                profiler.stop();
+                mEnv.setProfiler(nullptr);
+            }
+            return;
+        }
+
+        if (pool) {
+            mVisitor.setPool(nullptr, nullptr);
+            reportLoops(loops, Context);
+        }
+        if (tasks) {
+            mVisitor.setTasks(nullptr, nullptr);
+            mEnv.log() << "[Parallel] " << forks << " pure calls forked on " << mOptions.parallelCalls << " threads.\n";
+        }
+        if (mOptions.traceThreshold) {
+            const TraceStats &traces = mEnv.traceStats();
+            mEnv.log() << "[Trace] " << traces.compiled << " loops compiled, " << traces.iterations
+                       << " iterations traced, " << traces.sideExits << " side exits, " << traces.abandoned
+                       << " traces abandoned.\n";
+        }
+        if (!mOptions.checkpointFile.empty()) {
+            mVisitor.setCheckpoint(nullptr);
+            mEnv.log() << "[Checkpoint] " << checkpoint.written << " checkpoints written to " << checkpoint.path << ".\n";
+        }
+        if (mOptions.inlineSize) {
+            mEnv.log() << "[Inline] " << mEnv.inlinedSites() << " call sites inlined, " << mEnv.inlinedCalls()
+                       << " inlined calls.\n";
+        }
+
+        if (!mOptions.profileFile.empty()) {
+            profiler.stop();
+            mEnv.setProfiler(nullptr);
+            writeProfile(profiler, Context);
+        }
+
+        if (!mOptions.statsFile.empty()) writeStats(elapsed.count(), exhausted);
     }
 
   private:
+    void reportLoops(const InterpreterVisitor::LoopReport &loops, const ASTContext &context)
+    {
+        // 按源码顺序输出
+        std::vector<std::pair<unsigned, const InterpreterVisitor::LoopStats *>> lines;
+        for (auto &pair : loops)
+            lines.emplace_back(context.getSourceManager().getPresumedLineNumber(pair.first->getBeginLoc()), &pair.second);
+        std::sort(lines.begin(), lines.end());
+        for (auto &line : lines)
+            mEnv.log() << "[Parallel] for loop at line " << line.first << ": " << line.second->runs << " runs, "
+                       << line.second->iterations << " iterations on " << mOptions.parallelLoops << " threads.\n";
+    }
+
+    void writeProfile(Profiler &profiler, const ASTContext &context)
+    {
+        std::error_code EC;
+        llvm::raw_fd_ostream out(mOptions.profileFile, EC);
+        if (EC) {
+            llvm::errs() << "[Error] Fail to write profile: " << mOptions.profileFile << ".\n";
+            return;
+        }
+        profiler.report(out, context, mEnv.getEntry());
+        mEnv.log() << "[Profile] " << profiler.samples() << " samples, "
+                   << profiler.dropped() << " dropped.\n";
+    }
+
+    /// 以 JSON 输出解释执行阶段（不包括 Clang 前端）的统计，供 bench/ 中的基准测试跨提交对比
+    void writeStats(double elapsedMs, bool exhausted)
+    {
+        std::error_code EC;
+        llvm::raw_fd_ostream out(mOptions.statsFile, EC);
+        if (EC) {
+            llvm::errs() << "[Error] Fail to write stats: " << mOptions.statsFile << ".\n";
+            return;
+        }
+
+        Budget &budget = mEnv.budget();
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        uint64_t nodes = mEnv.nodes();
+        llvm::json::Object stats{
+            {"nodes", (int64_t)nodes},
+            {"calls", (int64_t)budget.calls()},
+            {"iterations", (int64_t)budget.iterations()},
+            {"elapsed_ms", elapsedMs},
+            {"ns_per_node", nodes ? elapsedMs * 1e6 / nodes : 0.0},
+            {"calls_per_sec", elapsedMs > 0 ? budget.calls() * 1e3 / elapsedMs : 0.0},
+            {"peak_rss_kb", (int64_t)usage.ru_maxrss},
+            {"traced_iterations", (int64_t)mEnv.traceStats().iterations},
+            {"inlined_sites", (int64_t)mEnv.inlinedSites()},
+            {"inlined_calls", (int64_t)mEnv.inlinedCalls()},
+            {"exhausted", exhausted},
+        };
+        out << llvm::json::Value(std::move(stats)) << "\n";
+    }
+
     Environment mEnv;
     InterpreterVisitor mVisitor;
+    InterpreterOptions mOptions;
+    std::string mSource; // 源码的指纹，只在保存检查点时计算
 };
 
 class InterpreterClassAction : public ASTFrontendAction
 {
   public:
+    explicit InterpreterClassAction(const InterpreterOptions &options, const std::string &source)
+        : mOptions(options), mSource(source){}
+
     virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance &Compiler,
                                                                   llvm::StringRef InFile)
     {
         return std::unique_ptr<clang::ASTConsumer>(
-            new InterpreterConsumer(Compiler.getASTContext()));
+            new InterpreterConsumer(Compiler.getASTContext(), mOptions, mSource));
     }
-};
 
-llvm::cl::opt<std::string> InputFilename(llvm::cl::Positional, llvm::cl::desc("<source>.c"), llvm::cl::Required);
-llvm::cl::opt<bool> FileOption("file", llvm::cl::desc("Enable read from file"));
-llvm::cl::alias FileOptionShort("f", llvm::cl::aliasopt(FileOption));
-llvm::cl::opt<bool> StdErrOption("stderr", llvm::cl::desc("Enable stderr output"));
-llvm::cl::alias StdErrOptionShort("e", llvm::cl::aliasopt(StdErrOption));
-std::string readFileContent(std::string);
+  private:
+    InterpreterOptions mOptions;
+    std::string mSource;
+};
 
-int main(int argc, char *argv[])
+bool interpret(const std::string &sourceCode, const InterpreterOptions &options)
 {
-    llvm::cl::ParseCommandLineOptions(argc, argv, "Clang AST Interpreter for tiny C.\n");
-
-    if (InputFilename.empty()) {
-        self::errs() << "[Error] Missing required C source file parameter.\n";
-        llvm::cl::PrintHelpMessage(false, true);
-        return 1;
-    }
-
-    // 获取必需参数的值
-    std::string inputFile = InputFilename;
-    // 获取可选参数的值
-    bool useFile = FileOption;
-    bool enableStdErrOutput = StdErrOption;
-
-    std::string sourceCode;
-    // 判断直接传入源代码字符串还是从源代码文件读取
-    if (!useFile) sourceCode = inputFile;
-    else {
-        sourceCode = readFileContent(inputFile);
-        if(sourceCode.empty()) return 1;
-    }
-
-    self::useErrs = enableStdErrOutput;
-
-    clang::tooling::runToolOnCode(
-        std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction),
+    std::string source = options.checkpointFile.empty() ? "" : Checkpoint::fingerprint(sourceCode);
+    return clang::tooling::runToolOnCode(
+        std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction(options, source)),
         sourceCode
     );
-    return 0;
 }
-
-std::string readFileContent(std::string filePath) 
-{
-    llvm::StringRef InputFilename(filePath);
-    std::string FileContent;
-    // 打开输入文件
-    auto FileOrErr = llvm::MemoryBuffer::getFile(InputFilename);
-    if (FileOrErr) {
-        auto File = std::move(FileOrErr.get());
-
-        // 将文件内容保存到 std::string
-        FileContent = File->getBuffer().str();
-    } else {
-        self::errs() << "[Error] Fail to read file: " << InputFilename << ".\n";
-    }
-    return FileContent;
-}
\ No newline at end of file
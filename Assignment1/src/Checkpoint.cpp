@@ -0,0 +1,213 @@
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+
+// 格式改变时修改版本，旧版本的检查点拒绝恢复
+static const char Magic[] = "TCCK";
+static const uint64_t Version = 2;
+
+std::string Checkpoint::fingerprint(const std::string &sourceCode)
+{
+    llvm::MD5 hash;
+    hash.update(sourceCode);
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    return result.digest().str().str();
+}
+
+static void writeBytes(llvm::raw_ostream &out, const std::string &bytes)
+{
+    llvm::encodeULEB128(bytes.size(), out);
+    out << bytes;
+}
+
+static void writeBlock(llvm::raw_ostream &out, const Checkpoint::Block &block)
+{
+    llvm::encodeULEB128(block.addr, out);
+    writeBytes(out, block.bytes);
+    llvm::encodeULEB128(block.pointers.size(), out);
+    for (uint64_t offset : block.pointers)
+        llvm::encodeULEB128(offset, out);
+}
+
+static void writeValues(llvm::raw_ostream &out, const std::vector<int64_t> &values)
+{
+    llvm::encodeULEB128(values.size(), out);
+    for (int64_t val : values)
+        llvm::encodeSLEB128(val, out);
+}
+
+bool Checkpoint::save(llvm::StringRef path) const
+{
+    llvm::SmallString<128> model(path), temp;
+    model += ".%%%%%%.tmp";
+    int fd;
+    if (llvm::sys::fs::createUniqueFile(model, fd, temp)) return false;
+    {
+        llvm::raw_fd_ostream out(fd, true);
+        out << Magic;
+        llvm::encodeULEB128(Version, out);
+        writeBytes(out, source);
+        for (uint64_t val : {loop, inputs, outputs, calls, iterations})
+            llvm::encodeULEB128(val, out);
+        writeValues(out, slots);
+        writeValues(out, globals);
+        writeBlock(out, frame);
+        llvm::encodeULEB128(heap.size(), out);
+        for (const Block &block : heap)
+            writeBlock(out, block);
+        out.close();
+        if (out.has_error()) {
+            out.clear_error();
+            llvm::sys::fs::remove(temp);
+            return false;
+        }
+    }
+    if (llvm::sys::fs::rename(temp, path)) {
+        llvm::sys::fs::remove(temp);
+        return false;
+    }
+    return true;
+}
+
+/// 顺序读取 LEB128 编码，任何一次越界之后的读取都失败
+class Reader
+{
+  public:
+    Reader(llvm::StringRef data) : mPtr(data.bytes_begin()), mEnd(data.bytes_end()), mError(nullptr) {}
+
+    uint64_t uleb()
+    {
+        unsigned size = 0;
+        uint64_t val = mError ? 0 : llvm::decodeULEB128(mPtr, &size, mEnd, &mError);
+        if (!mError) mPtr += size;
+        return val;
+    }
+    int64_t sleb()
+    {
+        unsigned size = 0;
+        int64_t val = mError ? 0 : llvm::decodeSLEB128(mPtr, &size, mEnd, &mError);
+        if (!mError) mPtr += size;
+        return val;
+    }
+    std::string bytes()
+    {
+        uint64_t size = uleb();
+        if (mError || size > (uint64_t)(mEnd - mPtr)) {
+            mError = "truncated";
+            return "";
+        }
+        std::string val((const char *)mPtr, size);
+        mPtr += size;
+        return val;
+    }
+    void values(std::vector<int64_t> &values)
+    {
+        uint64_t size = uleb();
+        // 每个值至少占一个字节
+        if (mError || size > (uint64_t)(mEnd - mPtr)) {
+            mError = "truncated";
+            return;
+        }
+        values.resize(size);
+        for (int64_t &val : values)
+            val = sleb();
+    }
+    void block(Checkpoint::Block &block)
+    {
+        block.addr = uleb();
+        block.bytes = bytes();
+        uint64_t size = uleb();
+        if (mError || size > (uint64_t)(mEnd - mPtr)) {
+            mError = "truncated";
+            return;
+        }
+        block.pointers.resize(size);
+        for (uint64_t &offset : block.pointers) {
+            offset = uleb();
+            // 指针必须完整地落在块内
+            if (block.bytes.size() < sizeof(int64_t) || offset > block.bytes.size() - sizeof(int64_t)) mError = "pointer outside block";
+        }
+    }
+
+    bool ok() const { return mError == nullptr; }
+    bool atEnd() const { return mPtr == mEnd; }
+
+  private:
+    const uint8_t *mPtr;
+    const uint8_t *mEnd;
+    const char *mError;
+};
+
+bool Checkpoint::load(llvm::StringRef data)
+{
+    if (!data.consume_front(Magic)) return false;
+    Reader reader(data);
+    if (reader.uleb() != Version) return false;
+    source = reader.bytes();
+    for (uint64_t *val : {&loop, &inputs, &outputs, &calls, &iterations})
+        *val = reader.uleb();
+    reader.values(slots);
+    reader.values(globals);
+    reader.block(frame);
+    uint64_t blocks = reader.uleb();
+    for (uint64_t i = 0; i < blocks && reader.ok(); ++i)
+    {
+        heap.emplace_back();
+        reader.block(heap.back());
+    }
+    return reader.ok() && reader.atEnd();
+}
+
+void Relocator::add(uint64_t oldAddr, uint64_t size, uint64_t newAddr)
+{
+    Mapping mapping = {oldAddr, size, newAddr};
+    mBlocks.insert(std::upper_bound(mBlocks.begin(), mBlocks.end(), mapping), mapping);
+}
+
+int64_t Relocator::map(int64_t val) const
+{
+    Mapping key = {(uint64_t)val, 0, 0};
+    auto iter = std::upper_bound(mBlocks.begin(), mBlocks.end(), key);
+    if (iter == mBlocks.begin()) return val;
+    --iter;
+    uint64_t offset = (uint64_t)val - iter->oldAddr;
+    return offset <= iter->size ? (int64_t)(iter->newAddr + offset) : val;
+}
+
+void Relocator::relocate(char *memory, const std::vector<uint64_t> &pointers) const
+{
+    for (uint64_t offset : pointers)
+    {
+        int64_t val;
+        memcpy(&val, memory + offset, sizeof(val));
+        val = map(val);
+        memcpy(memory + offset, &val, sizeof(val));
+    }
+}
+
+void PointerMap::store(int64_t addr, uint64_t size, bool pointer)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    // 起点在 addr 之前 8 字节以内的指针也被覆盖
+    auto iter = mAddrs.lower_bound(addr - (int64_t)sizeof(int64_t) + 1);
+    while (iter != mAddrs.end() && *iter < addr + (int64_t)size)
+        iter = mAddrs.erase(iter);
+    if (pointer) mAddrs.insert(addr);
+}
+
+std::vector<uint64_t> PointerMap::offsets(int64_t addr, uint64_t size)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    std::vector<uint64_t> offsets;
+    for (auto iter = mAddrs.lower_bound(addr); iter != mAddrs.end() && *iter + sizeof(int64_t) <= addr + size; ++iter)
+        offsets.push_back(*iter - addr);
+    return offsets;
+}
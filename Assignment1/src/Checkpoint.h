@@ -0,0 +1,91 @@
+//==--- Checkpoint.h - On-disk checkpoints of the guest state -----------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+/// 入口函数某个循环回边处的客户程序状态：此时只有入口函数的栈帧，没有求值到一半的表达式，
+/// 因此除了循环语句的位置之外，只需要保存变量和内存
+struct Checkpoint
+{
+    /// 一块客户内存：保存时的地址、内容和其中存放指针的偏移
+    struct Block
+    {
+        uint64_t addr;
+        std::string bytes;
+        std::vector<uint64_t> pointers;
+    };
+
+    std::string source; // 源码的指纹，只能在同一个程序上恢复
+    uint64_t loop;      // 循环语句在入口函数体中的先序编号
+    uint64_t inputs;    // 已经读取的输入个数
+    uint64_t outputs;   // 已经输出的个数
+    uint64_t calls;
+    uint64_t iterations;
+    std::vector<int64_t> slots;   // 入口函数栈帧的槽位
+    std::vector<int64_t> globals; // 全局变量的槽位
+    Block frame;                  // 入口函数栈帧的内联存储
+    std::vector<Block> heap;      // MALLOC 和全局数组的空间
+
+    Checkpoint() : source(), loop(0), inputs(0), outputs(0), calls(0), iterations(0), slots(), globals(), frame{0, "", {}}, heap() {}
+
+    static std::string fingerprint(const std::string &sourceCode);
+    /// 先写入临时文件再改名，写到一半被中止时原来的检查点仍然完整
+    bool save(llvm::StringRef path) const;
+    /// 格式错误时返回 false
+    bool load(llvm::StringRef data);
+};
+
+/// --checkpoint：每隔 interval 步在下一个可以保存的循环回边处覆盖写入 path
+struct CheckpointPolicy
+{
+    std::string path;
+    std::string source;
+    uint64_t interval;
+    uint64_t next;    // 下一次保存的步数
+    uint64_t written; // 已经保存的次数
+};
+
+/// 客户内存中存放指针的地址。客户内存不带类型，只能在写入时按左值的类型登记：
+/// 指针类型的写入登记写入的地址，其他写入清除覆盖到的登记。只在 --checkpoint 时开启，
+/// 并行循环的工作线程与主线程共享同一个 PointerMap
+class PointerMap
+{
+  public:
+    PointerMap() : mLock(), mAddrs() {}
+
+    void store(int64_t addr, uint64_t size, bool pointer);
+    /// [addr, addr + size) 中存放指针的偏移
+    std::vector<uint64_t> offsets(int64_t addr, uint64_t size);
+
+  private:
+    std::mutex mLock;
+    std::set<int64_t> mAddrs;
+};
+
+/// 恢复时把保存时的地址映射到新分配的内存，落在某块内存中（包括末尾）的指针指向对应的新地址。
+/// 只重定位已知是指针的值：类型为指针的变量和 PointerMap 登记过的内存
+class Relocator
+{
+  public:
+    Relocator() : mBlocks() {}
+
+    void add(uint64_t oldAddr, uint64_t size, uint64_t newAddr);
+    int64_t map(int64_t) const;
+    /// 重定位一块内存中 pointers 偏移处的值
+    void relocate(char *memory, const std::vector<uint64_t> &pointers) const;
+
+  private:
+    struct Mapping
+    {
+        uint64_t oldAddr;
+        uint64_t size;
+        uint64_t newAddr;
+        bool operator<(const Mapping &other) const { return oldAddr < other.oldAddr; }
+    };
+    std::vector<Mapping> mBlocks; // 按保存时的地址排序
+};
@@ -1,24 +1,28 @@
 #include "Environment.h"
+#include "Checkpoint.h"
+#include "Kernels.h"
 
-namespace self {
-    bool useErrs = true;
-    llvm::raw_ostream &errs() {
-        return useErrs ? llvm::errs() : llvm::nulls();
-    }
-}
+#include <algorithm>
+#include <cstring>
 
+StackFrame StackFrame::fork() const
+{
+    StackFrame frame(mInfo);
+    frame.mSlots = mSlots;
+    return frame;
+}
 void StackFrame::bindDecl(Decl *decl, int64_t val)
 {
-    mVars[decl] = val;
+    mSlots[mInfo->getSlot(decl)] = val;
 }
 bool StackFrame::findDecl(Decl *decl)
 {
-    return mVars.find(decl) != mVars.end();
+    return mInfo->hasSlot(decl);
 }
 int64_t StackFrame::getDeclVal(Decl *decl)
 {
     assert(this->findDecl(decl));
-    return mVars.find(decl)->second;
+    return mSlots[mInfo->getSlot(decl)];
 }
 void StackFrame::bindStmt(Stmt *stmt, int64_t val)
 {
@@ -57,17 +61,6 @@ int64_t StackFrame::getReturnValue()
     return returnValue;
 }
 
-void GlobalVars::bindDecl(Decl *decl, int64_t val)
-{
-    mVars[decl] = val;
-}
-int64_t GlobalVars::getDeclVal(Decl *decl)
-{
-    assert(mVars.find(decl) != mVars.end());
-    return mVars.find(decl)->second;
-}
-
-
 void *Heap::Malloc(int size)
 {
     void *ptr = malloc(size);
@@ -80,6 +73,154 @@ void Heap::Free(void *ptr)
     mSpace.erase(ptr);
     free(ptr);
 }
+void Heap::clear()
+{
+    for (auto &pair : mSpace)
+        free(pair.first);
+    mSpace.clear();
+}
+
+
+bool GuestIO::input(int64_t &val)
+{
+    return scanf("%ld", &val) == 1;
+}
+llvm::raw_ostream &GuestIO::output()
+{
+    return llvm::outs();
+}
+void GuestIO::print(int64_t val)
+{
+    output() << val;
+}
+
+
+void Budget::setMaxSteps(uint64_t steps)
+{
+    mMaxSteps = steps;
+    schedule();
+}
+
+void Budget::setTimeout(unsigned ms)
+{
+    mStart = std::chrono::steady_clock::now();
+    mHasDeadline = ms > 0;
+    mDeadline = mStart + std::chrono::milliseconds(ms);
+}
+
+void Budget::setYield(uint64_t slice, std::function<void()> yield)
+{
+    mSlice = yield ? slice : 0;
+    mYield = yield;
+    mNextYield = steps() + mSlice;
+    schedule();
+}
+
+void Budget::inherit(const Budget &parent)
+{
+    // 同时运行的工作线程从同一个总数中扣除，合计不会超出上限；时间片回调只在调度器的线程上进行
+    mMaxSteps = parent.mMaxSteps;
+    mTotal = parent.mTotal;
+    mHasDeadline = parent.mHasDeadline;
+    mStart = parent.mStart;
+    mDeadline = parent.mDeadline;
+    schedule();
+}
+
+void Budget::join(const Budget &worker)
+{
+    // 工作线程最后一次检查之后的步数还没有计入总数
+    *mTotal += worker.steps() - worker.mPublished;
+    mCalls += worker.mCalls;
+    mIterations += worker.mIterations;
+    mPublished += worker.steps();
+}
+
+double Budget::elapsedMs() const
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - mStart;
+    return elapsed.count();
+}
+
+void Budget::check()
+{
+    uint64_t now = steps();
+    uint64_t total = *mTotal += now - mPublished;
+    mPublished = now;
+    if (mMaxSteps && total >= mMaxSteps)
+        throw self::BudgetException("Step budget exhausted.");
+    if (now >= mNextClock) {
+        mNextClock = now + ClockInterval;
+        if (mHasDeadline && std::chrono::steady_clock::now() >= mDeadline)
+            throw self::BudgetException("Deadline exceeded.");
+    }
+    if (mSlice && now >= mNextYield) {
+        mNextYield = now + mSlice;
+        mYield();
+    }
+    schedule();
+}
+
+/// 计算下一次需要进入 check 的步数
+void Budget::schedule()
+{
+    uint64_t next = mNextClock;
+    if (mMaxSteps) {
+        // 本地再走到这里时总数达到上限；没有其他工作线程时总数就是本地步数，恰好在上限处停下
+        uint64_t total = mTotal->load();
+        next = std::min(next, mMaxSteps > total ? mPublished + (mMaxSteps - total) : steps());
+    }
+    if (mSlice && mNextYield < next) next = mNextYield;
+    mNextCheck = next;
+}
+
+
+/// 按类型读写客户程序的内存，与栈帧中的值一致：字符按 char、整数按 int、指针按 8 字节存放
+/// 数组和结构体的值是其地址，不经过内存
+static int64_t load(int64_t addr, QualType type)
+{
+    if(type->isCharType()) {
+        return *((char *)addr);
+    } else if(type->isIntegerType()) {
+        return *((int *)addr);
+    } else if(type->isPointerType()) {
+        return *((int64_t *)addr);
+    }
+    return addr;
+}
+
+static void store(int64_t addr, QualType type, int64_t val)
+{
+    if(type->isCharType()) {
+        *((char *)addr) = (char)val;
+    } else if(type->isIntegerType()) {
+        *((int *)addr) = (int)val;
+    } else if(type->isPointerType()) {
+        *((int64_t *)addr) = val;
+    }
+}
+
+/// store 写入的字节数，其他类型不写
+static uint64_t storeSize(QualType type)
+{
+    if (type->isCharType()) return sizeof(char);
+    if (type->isIntegerType()) return sizeof(int);
+    if (type->isPointerType()) return sizeof(int64_t);
+    return 0;
+}
+
+/// 槽位中存放地址的变量：指针、数组、结构体和放在内存中的标量
+static bool holdsAddress(const VarDecl *vardecl, bool memoryBacked)
+{
+    QualType type = vardecl->getType();
+    return memoryBacked || type->isPointerType() || type->isArrayType() || type->isRecordType();
+}
+
+void Environment::write(int64_t addr, QualType type, int64_t val)
+{
+    store(addr, type, val);
+    if (mPointers) mPointers->store(addr, storeSize(type), type->isPointerType());
+}
 
 
 /// Initialize the Environment
@@ -87,23 +228,254 @@ void Environment::init(TranslationUnitDecl *unit)
 {
     for (auto *SubDecl : unit->decls())
     {
-        if (VarDecl *vardecl = dyn_cast<VarDecl>(SubDecl)) {
-            int64_t val = getDeclVal(vardecl);
-            mGlobal.bindDecl(vardecl, val);
+        if (isa<FunctionDecl>(SubDecl)) {
+            fdecl(SubDecl);
         }
         // more decl
     }
-    // 清除用于全局变量的栈帧
+}
+
+void Environment::initGlobals(TranslationUnitDecl *unit, const llvm::DenseSet<const VarDecl *> &addressTaken)
+{
+    // 全局作用域只处理全局变量的初始化表达式，函数体留到第一次调用时再预处理
+    mGlobalInfo.reset(new FunctionInfo(nullptr));
+    Preparer(context, *this, *mGlobalInfo).prepareGlobals(unit, addressTaken);
+    mGlobal.resize(mGlobalInfo->getNumSlots());
+    // 用于计算全局变量初始值的栈帧
+    mStack.push_back(StackFrame(mGlobalInfo.get()));
+}
+
+FunctionDecl *Environment::start()
+{
+    // 清除用于全局变量的栈帧，全局变量的值已经直接写入 mGlobal
     mStack.pop_back();
+    if (mForkJoin) prepareForkJoin();
     // 添加 main 函数的栈帧
-    mStack.push_back(StackFrame());
+    FunctionInfo *info = prepare(mEntry);
+    mStack.push_back(StackFrame(info));
+    // 内联存储可能复用了之前写过指针的内存
+    if (mPointers) mPointers->store((int64_t)mStack.back().getMemory(), info->getFrameSize(), false);
+    return info->getDecl();
+}
+
+/// 分叉出的工作线程只会调用纯函数，预先处理好之后工作线程不再需要访问 Preparer
+void Environment::prepareForkJoin()
+{
+    std::shared_ptr<PurityAnalyzer> purity(new PurityAnalyzer(*this));
+    purity->analyze(mEntry->getDefinition());
+    mPurity = purity;
+
+    std::shared_ptr<FunctionMap> functions(new FunctionMap());
+    for (FunctionDecl *fdecl : mPurity->getPureFunctions())
+    {
+        std::unique_ptr<FunctionInfo> &info = (*functions)[fdecl];
+        info.reset(new FunctionInfo(fdecl));
+        Preparer(context, *this, *info).prepareFunction();
+    }
+    mPureFunctions = functions;
+}
+
+FunctionInfo *Environment::prepare(FunctionDecl *fdecl)
+{
+    if (fdecl->isDefined()) fdecl = fdecl->getDefinition();
+    if (mPureFunctions) {
+        auto iter = mPureFunctions->find(fdecl);
+        if (iter != mPureFunctions->end()) return iter->second.get();
+    }
+    std::unique_ptr<FunctionInfo> &info = mFunctions[fdecl];
+    if (!info) {
+        info.reset(new FunctionInfo(fdecl));
+        Preparer(context, *this, *info).prepareFunction();
+    }
+    return info.get();
+}
+
+bool Environment::fold(Stmt *stmt)
+{
+    Expr *expr = dyn_cast<Expr>(stmt);
+    int64_t val;
+    if (expr == nullptr || !mStack.back().getInfo()->getConstant(expr, val)) return false;
+    bindStmt(expr, val);
+    return true;
+}
+
+void Environment::setPointerTracking(bool enabled)
+{
+    mPointers.reset(enabled ? new PointerMap() : nullptr);
+}
+
+void Environment::capture(Checkpoint &checkpoint)
+{
+    assert(mStack.size() == 1);
+    StackFrame &frame = mStack.back();
+    FunctionInfo *info = frame.getInfo();
+    checkpoint.inputs = mInputs;
+    checkpoint.outputs = mOutputs;
+    checkpoint.calls = mBudget.calls();
+    checkpoint.iterations = mBudget.iterations();
+    checkpoint.slots.assign(frame.getSlots(), frame.getSlots() + info->getNumSlots());
+    checkpoint.globals.assign(mGlobal.data(), mGlobal.data() + mGlobalInfo->getNumSlots());
+    checkpoint.frame.addr = (uint64_t)frame.getMemory();
+    checkpoint.frame.bytes.assign(frame.getMemory(), info->getFrameSize());
+    checkpoint.frame.pointers.clear();
+    if (mPointers) checkpoint.frame.pointers = mPointers->offsets((int64_t)frame.getMemory(), info->getFrameSize());
+    checkpoint.heap.clear();
+    for (auto &block : mHeap.blocks())
+    {
+        std::vector<uint64_t> pointers;
+        if (mPointers) pointers = mPointers->offsets((int64_t)block.first, block.second);
+        checkpoint.heap.push_back({(uint64_t)block.first, std::string((char *)block.first, block.second), pointers});
+    }
+}
+
+void Environment::restore(const Checkpoint &checkpoint)
+{
+    StackFrame &frame = mStack.back();
+    FunctionInfo *info = frame.getInfo();
+    assert(checkpoint.slots.size() == info->getNumSlots() && checkpoint.frame.bytes.size() == info->getFrameSize());
+
+    // 全局变量初始化时分配的数组也在检查点的堆中
+    Relocator relocator;
+    mHeap.clear();
+    std::vector<char *> blocks;
+    for (const Checkpoint::Block &block : checkpoint.heap)
+    {
+        char *addr = (char *)mHeap.Malloc(block.bytes.size());
+        memcpy(addr, block.bytes.data(), block.bytes.size());
+        relocator.add(block.addr, block.bytes.size(), (uint64_t)addr);
+        blocks.push_back(addr);
+    }
+    char *memory = frame.getMemory();
+    if (memory) {
+        memcpy(memory, checkpoint.frame.bytes.data(), checkpoint.frame.bytes.size());
+        relocator.add(checkpoint.frame.addr, checkpoint.frame.bytes.size(), (uint64_t)memory);
+    }
+
+    // 恰好等于某个旧地址的整数保持不变
+    for (unsigned i = 0; i < checkpoint.slots.size(); ++i)
+    {
+        VarDecl *vardecl = info->getVar(i);
+        int64_t val = checkpoint.slots[i];
+        frame.getSlot(i) = holdsAddress(vardecl, info->isMemoryBacked(vardecl)) ? relocator.map(val) : val;
+    }
+    for (unsigned i = 0; i < checkpoint.globals.size(); ++i)
+    {
+        VarDecl *vardecl = mGlobalInfo->getVar(i);
+        int64_t val = checkpoint.globals[i];
+        mGlobal.getSlot(i) = holdsAddress(vardecl, mGlobalInfo->isMemoryBacked(vardecl)) ? relocator.map(val) : val;
+    }
+    for (unsigned i = 0; i < blocks.size(); ++i)
+    {
+        const Checkpoint::Block &block = checkpoint.heap[i];
+        relocator.relocate(blocks[i], block.pointers);
+        if (mPointers) {
+            mPointers->store((int64_t)blocks[i], block.bytes.size(), false);
+            for (uint64_t offset : block.pointers) mPointers->store((int64_t)blocks[i] + offset, sizeof(int64_t), true);
+        }
+    }
+    if (memory) {
+        relocator.relocate(memory, checkpoint.frame.pointers);
+        if (mPointers) {
+            mPointers->store((int64_t)memory, checkpoint.frame.bytes.size(), false);
+            for (uint64_t offset : checkpoint.frame.pointers) mPointers->store((int64_t)memory + offset, sizeof(int64_t), true);
+        }
+    }
+
+    // 输入的位置：重新提供同样的输入时跳过已经读取的部分
+    for (int64_t val; mInputs < checkpoint.inputs && mIO->input(val);)
+        ++mInputs;
+    mInputs = checkpoint.inputs;
+    mOutputs = checkpoint.outputs;
+    mBudget.restore(checkpoint.calls, checkpoint.iterations);
+}
+
+void Environment::fork(const Environment &parent)
+{
+    mFree = parent.mFree;
+    mMalloc = parent.mMalloc;
+    mInput = parent.mInput;
+    mOutput = parent.mOutput;
+    mEntry = parent.mEntry;
+    // 循环体不写循环外的标量，全局变量的副本与父环境始终一致
+    mGlobal = parent.mGlobal;
+    mGlobalInfo = parent.mGlobalInfo;
+    mPurity = parent.mPurity;
+    mPureFunctions = parent.mPureFunctions;
+    mForkDepth = parent.mForkDepth + 1;
+    mInlineSize = parent.mInlineSize;
+    mInlineDepth = parent.mInlineDepth;
+    mBudget.inherit(parent.mBudget);
+    mPointers = parent.mPointers;
+    mStack.push_back(parent.mStack.back().fork());
+}
+
+uint64_t Environment::inlinedSites() const
+{
+    uint64_t sites = 0;
+    for (auto &entry : mFunctions)
+        sites += entry.second->getNumInlined();
+    if (mPureFunctions) {
+        for (auto &entry : *mPureFunctions)
+            sites += entry.second->getNumInlined();
+    }
+    return sites;
+}
+
+const ParallelLoop *Environment::getParallelLoop(ForStmt *forstmt)
+{
+    return mStack.back().getInfo()->getParallelLoop(forstmt);
+}
+
+const ForkJoin *Environment::getForkJoin(BinaryOperator *bop)
+{
+    return mStack.back().getInfo()->getForkJoin(bop);
+}
+
+const LoopIdiom *Environment::getLoopIdiom(ForStmt *forstmt)
+{
+    return mStack.back().getInfo()->getLoopIdiom(forstmt);
+}
+
+const SwitchTable &Environment::getSwitchTable(SwitchStmt *switchstmt)
+{
+    return mStack.back().getInfo()->getSwitchTable(switchstmt);
 }
 
-FunctionDecl *Environment::getEntry()
+FunctionDecl *Environment::getEntry() const
 {
     return mEntry;
 }
 
+unsigned Environment::getGlobalSlot(const VarDecl *vardecl) const
+{
+    return mGlobalInfo->getSlot(vardecl->getCanonicalDecl());
+}
+
+bool Environment::isGlobalMemoryBacked(const VarDecl *vardecl) const
+{
+    return mGlobalInfo->isMemoryBacked(vardecl->getCanonicalDecl());
+}
+
+bool Environment::isMemoryBacked(VarDecl *vardecl)
+{
+    if (vardecl->hasGlobalStorage()) return isGlobalMemoryBacked(vardecl);
+    return mStack.back().getInfo()->isMemoryBacked(vardecl);
+}
+
+int64_t &Environment::slotOf(Decl *decl)
+{
+    VarDecl *vardecl = llvm::cast<VarDecl>(decl);
+    if (vardecl->hasGlobalStorage()) return mGlobal.getSlot(getGlobalSlot(vardecl));
+    StackFrame &frame = mStack.back();
+    return frame.getSlot(frame.getInfo()->getSlot(vardecl));
+}
+
+/// 热路径：预处理时已经区分了局部变量和全局变量
+int64_t &Environment::slotOf(const FunctionInfo::VarRef &ref)
+{
+    return ref.global ? mGlobal.getSlot(ref.slot) : mStack.back().getSlot(ref.slot);
+}
+
 int64_t Environment::getStmtVal(Expr *expr)
 {
     int64_t val;
@@ -114,13 +486,18 @@ int64_t Environment::getStmtVal(Expr *expr)
 
 int64_t Environment::getDeclVal(Decl *decl)
 { 
-    int64_t val;
-    // 如果当前栈帧中没有此变量，则应该在全局中
-    if(mStack.back().findDecl(decl)) 
-        val = mStack.back().getDeclVal(decl);
+    VarDecl *vardecl = llvm::cast<VarDecl>(decl);
+    int64_t slot = slotOf(vardecl);
+    return isMemoryBacked(vardecl) ? load(slot, vardecl->getType()) : slot;
+}
+
+void Environment::bindDecl(Decl *decl, int64_t val)
+{
+    VarDecl *vardecl = llvm::cast<VarDecl>(decl);
+    if (isMemoryBacked(vardecl))
+        write(slotOf(vardecl), vardecl->getType(), val);
     else
-        val = mGlobal.getDeclVal(decl);
-    return val;
+        slotOf(vardecl) = val;
 }
 
 int64_t Environment::getPtrVal(Expr *expr)
@@ -142,35 +519,21 @@ void Environment::bindPtr(Expr *expr, int64_t val)
 
 void Environment::bindDecl(Expr *expr, int64_t val)
 {
+    expr = expr->IgnoreParens();
     if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(expr))
     {
-        Decl *decl = declexpr->getFoundDecl();
-        mStack.back().bindDecl(decl, val);
+        const FunctionInfo::VarRef &ref = mStack.back().getInfo()->getVarRef(declexpr);
+        if (ref.memory)
+            write(slotOf(ref), expr->getType(), val);
+        else
+            slotOf(ref) = val;
     }
-    else if (ArraySubscriptExpr *arraysub = dyn_cast<ArraySubscriptExpr>(expr))
-    {
-        int64_t addr = getPtrVal(arraysub);
-        QualType type = arraysub->getType();
-        if(type->isCharType()) {
-            *((char *)addr) = (char)val;
-        } else if(type->isIntegerType()) {
-            *((int *)addr) = (int)val;
-        } else if(type->isPointerType()) {
-            *((int64_t *)addr) = val;
-        }
-    }
-    else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+    else
     {
-        assert(uop->getOpcode() == UO_Deref);
-        int64_t addr = getPtrVal(uop);
-        QualType type = uop->getType();
-        if(type->isCharType()) {
-            *((char *)addr) = (char)val;
-        } else if(type->isIntegerType()) {
-            *((int *)addr) = (int)val;
-        } else if(type->isPointerType()) {
-            *((int64_t *)addr) = val;
-        }
+        // 数组元素、结构体成员或者 *p
+        assert(isa<ArraySubscriptExpr>(expr) || isa<MemberExpr>(expr) ||
+               llvm::cast<UnaryOperator>(expr)->getOpcode() == UO_Deref);
+        write(getPtrVal(expr), expr->getType(), val);
     }
 }
 
@@ -205,8 +568,7 @@ void Environment::charliteral(Expr *charl) {
 
 void Environment::paren(Expr *expr)
 {
-    ParenExpr * paren = dyn_cast<ParenExpr>(expr);
-    if(paren == nullptr) return;
+    ParenExpr *paren = llvm::cast<ParenExpr>(expr);
 
     // 将子节点的val绑定到paren
     bindStmt(
@@ -237,6 +599,8 @@ void Environment::binop(BinaryOperator *bop)
             rightVal *= sizeof(int);
         } else if (peType->isPointerType()) {
             rightVal *= sizeof(void *);
+        } else if (peType->isRecordType() || peType->isArrayType()) {
+            rightVal *= context.getTypeSizeInChars(peType).getQuantity();
         }
     }
     else if ((leftType->isCharType() || leftType->isIntegerType()) && rightType->isPointerType())
@@ -248,6 +612,8 @@ void Environment::binop(BinaryOperator *bop)
             leftVal *= sizeof(int);
         } else if (peType->isPointerType()) {
             leftVal *= sizeof(void *);
+        } else if (peType->isRecordType() || peType->isArrayType()) {
+            leftVal *= context.getTypeSizeInChars(peType).getQuantity();
         }        
     }
 
@@ -331,9 +697,7 @@ void Environment::binop(BinaryOperator *bop)
             case BO_LOr:
                 val = leftVal || rightVal; break;
             default:
-                self::errs() << "[Error] Unsupported BinaryOperator.\n";
-                bop->dump(self::errs());
-                break;
+                llvm_unreachable("BinaryOperator rejected by the Verifier");
         }
     }
     bindStmt(bop, val);
@@ -359,6 +723,8 @@ void Environment::unaryop(UnaryOperator *uop)
                 unit = sizeof(int);
             } else if (peType->isPointerType()) {
                 unit = sizeof(void *);
+            } else if (peType->isRecordType() || peType->isArrayType()) {
+                unit = context.getTypeSizeInChars(peType).getQuantity();
             }
         }
 
@@ -402,27 +768,20 @@ void Environment::unaryop(UnaryOperator *uop)
                 val = !exprVal;
                 break;
 
-            case UO_Deref: {
-                QualType type = uop->getType();
-                if(type->isCharType()) {
-                    val = *((char *)exprVal);
-                } else if (type->isIntegerType()) {
-                    val = *((int *)exprVal);
-                } else if (type->isPointerType()) {
-                    val = *((int64_t *)exprVal);
-                }
+            case UO_Deref:
+                // (*p).x：结构体的值为其地址
+                val = load(exprVal, uop->getType());
                 bindPtr(uop, exprVal);
                 break;
-            }
             case UO_AddrOf: {
-                // Extra TODO: Support UO_AddrOf like `int *p = &a;`
+                // 数组和结构体的值就是其地址，其余的左值在求值时记录了地址
+                Expr *lvalue = expr->IgnoreParens();
+                QualType type = lvalue->getType();
+                val = (type->isArrayType() || type->isRecordType()) ? exprVal : getPtrVal(lvalue);
                 break;
             }
-
             default:
-                self::errs() << "[Error] Unsupported UnaryOperator.\n";
-                uop->dump(self::errs());
-                break;
+                llvm_unreachable("UnaryOperator rejected by the Verifier");
         }
     }
     bindStmt(uop, val);
@@ -438,27 +797,21 @@ void Environment::condop(ConditionalOperator *condop, Expr *expr)
 
 void Environment::ueott(UnaryExprOrTypeTraitExpr *ueott)
 {
-    UnaryExprOrTypeTrait uett = ueott->getKind();
-    int64_t size = 0;
-    if (uett == UETT_SizeOf)
-    {
-        QualType argType = ueott->getTypeOfArgument();
-        CharUnits sizeInChars = context.getTypeSizeInChars(argType);
-        size = sizeInChars.getQuantity();
-    }
-    else
-    {
-        self::errs() << "[Error] Unsupported UnaryExprOrTypeTraitExpr.\n";
-        ueott->dump(self::errs());
-    }
-    bindStmt(ueott, size);
+    // 只有 sizeof 能通过 Verifier
+    QualType argType = ueott->getTypeOfArgument();
+    CharUnits sizeInChars = context.getTypeSizeInChars(argType);
+    bindStmt(ueott, sizeInChars.getQuantity());
 }
 
 
 void Environment::vardecl(Decl *decl)
 {
-    VarDecl *vardecl = dyn_cast<VarDecl>(decl);
-    if(vardecl == nullptr) return;
+    VarDecl *vardecl = llvm::cast<VarDecl>(decl);
+    // 全局变量的重复声明（extern int g; 或暂定定义）沿用第一次声明分配的存储，只在有初始值时写入
+    if (vardecl != vardecl->getCanonicalDecl()) {
+        if (vardecl->hasInit()) bindDecl(vardecl, getStmtVal(vardecl->getInit()));
+        return;
+    }
     QualType type = vardecl->getType();
     if(type->isCharType() || type->isIntegerType() || type->isPointerType())
     {
@@ -469,28 +822,44 @@ void Environment::vardecl(Decl *decl)
             // if(init->isIntegerConstantExpr(intResult, this->context)) val = intResult.getExtValue();
             val = getStmtVal(vardecl->getInit());
         }
-        mStack.back().bindDecl(vardecl, val);
+        // 取地址的标量：槽位中存放其内存的地址
+        if (isMemoryBacked(vardecl)) {
+            void *addr = allocate(vardecl, sizeof(int64_t));
+            slotOf(vardecl) = (int64_t)addr;
+        }
+        bindDecl(vardecl, val);
     }
-    else if(type->isArrayType())
+    else if(type->isArrayType() || type->isRecordType())
     {
-        auto array = dyn_cast<ConstantArrayType>(type.getTypePtr());
-        int size = array->getSize().getSExtValue();
-        QualType elemType = array->getElementType();
-        void *addr = nullptr;
-        if(elemType->isCharType()) {
-            addr = mHeap.Malloc(size * sizeof(char));
-            for(int i = 0; i < size; ++i) *((char *)addr + i) = 0;
-        } else if(elemType->isIntegerType()) {
-            addr = mHeap.Malloc(size * sizeof(int));
-            for(int i = 0; i < size; ++i) *((int *)addr + i) = 0;
-        } else if(elemType->isPointerType()) {
-            addr =  mHeap.Malloc(size * sizeof(void *));
-            for(int i = 0; i < size; ++i) *((int64_t *)addr + i) = 0;          
+        // 多维数组（行优先）和结构体按 ASTContext 的布局连续存放
+        int bytes = context.getTypeSizeInChars(type).getQuantity();
+        if (auto array = dyn_cast<ConstantArrayType>(type.getTypePtr())) {
+            int size = array->getSize().getSExtValue();
+            QualType elemType = array->getElementType();
+            if(elemType->isCharType()) {
+                bytes = size * sizeof(char);
+            } else if(elemType->isIntegerType()) {
+                bytes = size * sizeof(int);
+            } else if(elemType->isPointerType()) {
+                bytes = size * sizeof(void *);
+            }
         }
-        mStack.back().bindDecl(vardecl, (int64_t)addr);
+        void *addr = allocate(vardecl, bytes);
+        memset(addr, 0, bytes);
+        if (mPointers) mPointers->store((int64_t)addr, bytes, false);
+        bindDecl(vardecl, (int64_t)addr);
     }
 }
 
+/// 地址没有逃逸的数组和取地址的局部标量放在当前栈帧的内联存储中，否则（包括全局变量）在 Heap 上分配
+void *Environment::allocate(VarDecl *vardecl, int size)
+{
+    StackFrame &frame = mStack.back();
+    int offset = frame.getInfo()->getFrameOffset(vardecl);
+    if (offset >= 0) return frame.getMemory() + offset;
+    return mHeap.Malloc(size);
+}
+
 void Environment::fdecl(Decl *decl)
 {
     FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl);
@@ -510,69 +879,223 @@ void Environment::fdecl(Decl *decl)
 
 void Environment::declref(DeclRefExpr *declref)
 {
-    QualType type = declref->getType();
-    
-    // declref 时，获取当前 Decl 的值绑定到当前 Stmt，但是不对函数进行处理（Call函数单独处理）
-    if (type->isCharType() || type->isIntegerType() || type->isArrayType() || type->isPointerType())
-    {
-        Decl *decl = declref->getFoundDecl();
-
-        int64_t val = getDeclVal(decl);
-        bindStmt(declref, val);
-    }
-    else if(!type->isFunctionType())
-    {
-        self::errs() << "[Error] Unsupported DeclRef.\n";
-        declref->dump(self::errs());
+    // 调用的被调函数不会被访问，经过 Verifier 后这里只会是变量
+    const FunctionInfo::VarRef &ref = mStack.back().getInfo()->getVarRef(declref);
+    int64_t slot = slotOf(ref);
+    if (ref.memory) {
+        // 取地址的标量：槽位中是其地址，为 &x 记录下来
+        bindStmt(declref, load(slot, declref->getType()));
+        bindPtr(declref, slot);
+    } else {
+        bindStmt(declref, slot);
     }
 }
 
 void Environment::cast(CastExpr *castexpr)
 {
-    QualType type = castexpr->getType();
+    // 函数到指针的退化只出现在被调函数的位置，不会被访问
+    Expr *expr = castexpr->getSubExpr();
+    bindStmt(castexpr, getStmtVal(expr));
+}
 
-    // cast 时，不能包括 FunctionPointer，因为栈帧中可能并没有其信息，如果是指定的那几个extern函数
-    if (type->isCharType() || type->isIntegerType() ||
-        (type->isPointerType() && !type->isFunctionPointerType()))
-    {
-        Expr *expr = castexpr->getSubExpr();
+const AccessPath &Environment::getAccessPath(Expr *expr)
+{
+    return mStack.back().getInfo()->getAccessPath(expr);
+}
 
-        int64_t val = getStmtVal(expr);
-        bindStmt(castexpr, val);
-    }
-    else if(!type->isFunctionPointerType())
+/// 下标和成员访问：调用前已经求值了访问链的起点和各级下标
+void Environment::access(Expr *expr, const AccessPath &path)
+{
+    int64_t addr = getStmtVal(path.base) + path.offset;
+    for (auto &index : path.indices)
+        addr += getStmtVal(index.first) * index.second;
+
+    // 数组和结构体的值为其地址
+    bindStmt(expr, load(addr, expr->getType()));
+    bindPtr(expr, addr);
+}
+
+
+/// 两段长度相同的内存部分重叠（相同或互不相交时返回 false）
+static bool overlaps(const char *a, const char *b, int64_t bytes)
+{
+    return a != b && a < b + bytes && b < a + bytes;
+}
+
+/// 用 SIMD 内核执行整个循环，调用前已经求值了循环上界和 Fill 的值
+/// 迭代次数为 0、或者数组之间部分重叠时返回 false，由解释器逐个结点执行
+bool Environment::idiom(const LoopIdiom &idiom)
+{
+    int64_t start = getDeclVal(idiom.induction);
+    int64_t end = getStmtVal(idiom.bound) + (idiom.inclusive ? 1 : 0);
+    if (end <= start) return false;
+
+    int64_t n = end - start;
+    unsigned size = idiom.size;
+    char *target = nullptr, *lhs = nullptr, *rhs = nullptr;
+    // Fill、Copy、Add、Mul 写数组，其余为归约
+    if (idiom.kind <= LoopIdiom::Mul) target = (char *)getDeclVal(idiom.target) + start * size;
+    if (idiom.sources[0]) lhs = (char *)getDeclVal(idiom.sources[0]) + start * size;
+    if (idiom.sources[1]) rhs = (char *)getDeclVal(idiom.sources[1]) + start * size;
+    if (target && ((lhs && overlaps(target, lhs, n * size)) || (rhs && overlaps(target, rhs, n * size))))
+        return false;
+
+    // 内核只写 char 和 int 数组
+    if (target && mPointers) mPointers->store((int64_t)target, n * size, false);
+    switch (idiom.kind)
     {
-        self::errs() << "[Error] Unsupported CastExpr.\n";
-        castexpr->dump(self::errs());
+        case LoopIdiom::Fill:
+            kernels::fill(target, getStmtVal(idiom.value), n, size); break;
+        case LoopIdiom::Copy:
+            kernels::copy(target, lhs, n, size); break;
+        case LoopIdiom::Add:
+            kernels::add(target, lhs, rhs, n, size); break;
+        case LoopIdiom::Mul:
+            kernels::mul(target, lhs, rhs, n, size); break;
+        case LoopIdiom::Sum:
+            bindDecl(idiom.target, getDeclVal(idiom.target) + kernels::sum(lhs, n, size)); break;
+        case LoopIdiom::Min:
+            bindDecl(idiom.target, std::min(getDeclVal(idiom.target), kernels::min(lhs, n, size))); break;
+        case LoopIdiom::Max:
+            bindDecl(idiom.target, std::max(getDeclVal(idiom.target), kernels::max(lhs, n, size))); break;
     }
+
+    // 与逐个结点执行结束时的状态一致
+    bindDecl(idiom.induction, end);
+    mBudget.iteration(n);
+    return true;
 }
 
-void Environment::arraysub(ArraySubscriptExpr *arraysub)
+TraceState *Environment::getTraceState(Stmt *loop)
 {
-    Expr *base = arraysub->getBase();
-    Expr *index = arraysub->getIdx();
+    if (mTraceThreshold == 0) return nullptr;
+    std::unique_ptr<TraceState> &state = mTraces[std::make_pair(mStack.back().getInfo(), loop)];
+    if (!state) state.reset(new TraceState());
+    return state.get();
+}
 
-    QualType type = arraysub->getType();
+bool Environment::shouldRecord(TraceState &state)
+{
+    return !state.trace && !state.failed && ++state.iterations > mTraceThreshold;
+}
 
-    int64_t val = 0, addr = 0;
-    if(type->isCharType()) {
-        addr = getStmtVal(base) + getStmtVal(index) * sizeof(char);
-        val = *((char *)addr);
-    } else if(type->isIntegerType()) {
-        addr = getStmtVal(base) + getStmtVal(index) * sizeof(int);
-        val = *((int *)addr);
-    } else if(type->isPointerType()) {
-        addr = getStmtVal(base) + getStmtVal(index) * sizeof(int64_t);
-        val = *((int64_t *)addr);
+void Environment::compileTrace(TraceState &state, Expr *cond, Stmt *body, Expr *inc, const TraceRecorder &recorder)
+{
+    std::shared_ptr<Trace> trace(new Trace());
+    TraceCompiler compiler(context, *mStack.back().getInfo(), recorder, *trace);
+    // 不支持的循环体每次编译都会失败，不再录制
+    if (recorder.hasConflict() || !compiler.compile(cond, body, inc)) {
+        state.failed = true;
+        return;
     }
-    bindStmt(arraysub, val);
-    bindPtr(arraysub, addr);
+    state.trace = trace;
+    state.traced = 0;
+    state.exits = 0;
+    ++mTraceStats.compiled;
 }
 
+/// trace 只读写当前栈帧、全局变量和客户程序的内存，执行期间不会压栈，槽位的地址保持不变
+bool Environment::runTrace(TraceState &state, unsigned &exit)
+{
+    // 侧出口超过迭代的四分之一时丢弃 trace，重新录制若干次后放弃
+    static const uint64_t MinExits = 32;
+    static const unsigned MaxAttempts = 3;
+
+    const Trace &trace = *state.trace;
+    int64_t *locals = mStack.back().getSlots();
+    int64_t *globals = mGlobal.data();
+    llvm::SmallVector<int64_t, 64> temps(trace.numTemps);
+    int64_t *r = temps.data();
+    PointerMap *pointers = mPointers.get();
+    uint64_t iterations = 0;
+
+    while (true)
+    {
+        for (const TraceOp &op : trace.ops)
+        {
+            switch (op.kind)
+            {
+                case TraceOp::Const: r[op.dst] = op.imm; break;
+                case TraceOp::Local: r[op.dst] = locals[op.a]; break;
+                case TraceOp::Global: r[op.dst] = globals[op.a]; break;
+                case TraceOp::SetLocal: locals[op.a] = r[op.b]; break;
+                case TraceOp::SetGlobal: globals[op.a] = r[op.b]; break;
+                case TraceOp::LoadChar: r[op.dst] = *((char *)r[op.a]); break;
+                case TraceOp::LoadInt: r[op.dst] = *((int *)r[op.a]); break;
+                case TraceOp::LoadPtr: r[op.dst] = *((int64_t *)r[op.a]); break;
+                case TraceOp::StoreChar:
+                    *((char *)r[op.a]) = (char)r[op.b];
+                    if (pointers) pointers->store(r[op.a], sizeof(char), false);
+                    break;
+                case TraceOp::StoreInt:
+                    *((int *)r[op.a]) = (int)r[op.b];
+                    if (pointers) pointers->store(r[op.a], sizeof(int), false);
+                    break;
+                case TraceOp::StorePtr:
+                    *((int64_t *)r[op.a]) = r[op.b];
+                    if (pointers) pointers->store(r[op.a], sizeof(int64_t), true);
+                    break;
+                case TraceOp::AddImm: r[op.dst] = r[op.a] + op.imm; break;
+                case TraceOp::MulImm: r[op.dst] = r[op.a] * op.imm; break;
+                case TraceOp::Add: r[op.dst] = r[op.a] + r[op.b]; break;
+                case TraceOp::Sub: r[op.dst] = r[op.a] - r[op.b]; break;
+                case TraceOp::Mul: r[op.dst] = r[op.a] * r[op.b]; break;
+                case TraceOp::Div:
+                    assert(r[op.b] != 0);
+                    r[op.dst] = r[op.a] / r[op.b]; break;
+                case TraceOp::Rem:
+                    assert(r[op.b] != 0);
+                    r[op.dst] = r[op.a] % r[op.b]; break;
+                case TraceOp::Shl: r[op.dst] = r[op.a] << r[op.b]; break;
+                case TraceOp::Shr: r[op.dst] = r[op.a] >> r[op.b]; break;
+                case TraceOp::And: r[op.dst] = r[op.a] & r[op.b]; break;
+                case TraceOp::Xor: r[op.dst] = r[op.a] ^ r[op.b]; break;
+                case TraceOp::Or: r[op.dst] = r[op.a] | r[op.b]; break;
+                case TraceOp::LAnd: r[op.dst] = r[op.a] && r[op.b]; break;
+                case TraceOp::LOr: r[op.dst] = r[op.a] || r[op.b]; break;
+                case TraceOp::LT: r[op.dst] = r[op.a] < r[op.b]; break;
+                case TraceOp::GT: r[op.dst] = r[op.a] > r[op.b]; break;
+                case TraceOp::LE: r[op.dst] = r[op.a] <= r[op.b]; break;
+                case TraceOp::GE: r[op.dst] = r[op.a] >= r[op.b]; break;
+                case TraceOp::EQ: r[op.dst] = r[op.a] == r[op.b]; break;
+                case TraceOp::NE: r[op.dst] = r[op.a] != r[op.b]; break;
+                case TraceOp::Neg: r[op.dst] = -r[op.a]; break;
+                case TraceOp::Not: r[op.dst] = ~r[op.a]; break;
+                case TraceOp::LNot: r[op.dst] = !r[op.a]; break;
+                case TraceOp::Iteration:
+                    ++iterations;
+                    mNodes += trace.nodes;
+                    mBudget.iteration();
+                    break;
+                case TraceOp::Guard:
+                    if ((r[op.a] != 0) == (op.imm != 0)) break;
+                    state.traced += iterations;
+                    mTraceStats.iterations += iterations;
+                    if (op.b == Trace::LoopExit) return true;
+
+                    exit = op.b;
+                    ++mTraceStats.sideExits;
+                    if (++state.exits >= MinExits && state.exits * 4 > state.traced) {
+                        // 调用方仍持有 trace，用于解释执行侧出口之后的语句
+                        state.trace.reset();
+                        state.iterations = 0;
+                        state.failed = ++state.attempts >= MaxAttempts;
+                        ++mTraceStats.abandoned;
+                    }
+                    return false;
+            }
+        }
+    }
+}
 
 bool Environment::isBuildIn(CallExpr *callexpr)
 {
-    FunctionDecl *callee = callexpr->getDirectCallee();
+    const FunctionInfo::CallTarget *target = mStack.back().getInfo()->getCallTarget(callexpr);
+    return target && target->builtin;
+}
+
+bool Environment::isBuildIn(const FunctionDecl *callee) const
+{
     if (callee == mInput  || callee == mOutput ||
         callee == mMalloc || callee == mFree ) 
         return true;
@@ -586,8 +1109,10 @@ void Environment::callbuildin(CallExpr *callexpr)
     FunctionDecl *callee = callexpr->getDirectCallee();
     if (callee == mInput)
     {
-        self::errs() << "Please Input an Integer Value : ";
-        scanf("%ld", &val);
+        log() << "Please Input an Integer Value : ";
+        // 输入结束时与 scanf 失败的行为一致，得到 0
+        if (!mIO->input(val)) val = 0;
+        ++mInputs;
 
         bindStmt(callexpr, val);
     }
@@ -595,49 +1120,60 @@ void Environment::callbuildin(CallExpr *callexpr)
     {
         Expr *decl = callexpr->getArg(0);
         val = getStmtVal(decl);
-        llvm::outs() << val;
+        mIO->print(val);
+        ++mOutputs;
     }
     else if (callee == mMalloc)
     {
         Expr *decl = callexpr->getArg(0);
         val = getStmtVal(decl);
+        mIO->allocate(val);
         void *ptr = mHeap.Malloc(val);
+        if (mPointers) mPointers->store((int64_t)ptr, val, false);
         bindStmt(callexpr, (int64_t)ptr);
     }
-    else if (callee == mFree)
+    else
     {
+        assert(callee == mFree);
         Expr *decl = callexpr->getArg(0);
         val = getStmtVal(decl);
         mHeap.Free((void *)val);
     }
-    else
-    {
-        self::errs() << "[Error] Unsupported BuildIn Function.\n";
-        callexpr->dump(self::errs());
-    }
 }
 
-void Environment::call(CallExpr *callexpr)
+FunctionDecl *Environment::call(CallExpr *callexpr)
 {
-    FunctionDecl *callee = callexpr->getDirectCallee();
-    if(callee->isDefined()) {
-        callee = callee->getDefinition();
-    }
-    int argsNum = callexpr->getNumArgs();
+    const FunctionInfo::CallTarget *target = mStack.back().getInfo()->getCallTarget(callexpr);
+    assert(target && !target->builtin);
+    FunctionInfo *info = prepare(target->callee);
+    FunctionDecl *callee = info->getDecl();
+
+    unsigned argsNum = callexpr->getNumArgs();
     assert(argsNum == callee->getNumParams());
-    StackFrame calleeFrame = StackFrame();
-    for(int i = 0; i < argsNum; ++i)
+    StackFrame calleeFrame(info);
+    // 参数的槽位即为其下标
+    for(unsigned i = 0; i < argsNum; ++i)
     {
-        calleeFrame.bindDecl(
-            callee->getParamDecl(i),
-            getStmtVal(callexpr->getArg(i))
-        );
+        int64_t val = getStmtVal(callexpr->getArg(i));
+        ParmVarDecl *param = callee->getParamDecl(i);
+        if (info->isMemoryBacked(param)) {
+            // 取地址的参数放在被调函数栈帧的内联存储中
+            char *addr = calleeFrame.getMemory() + info->getFrameOffset(param);
+            write((int64_t)addr, param->getType(), val);
+            val = (int64_t)addr;
+        }
+        calleeFrame.getSlot(i) = val;
     }
-    mStack.push_back(calleeFrame);
+    mStack.push_back(std::move(calleeFrame));
+    mBudget.call();
+    if (mProfiler) mProfiler->push(callexpr);
+    return callee;
 }
 
+/// 弹出栈帧的同时释放其内联存储，指向被调函数中取地址的标量和局部数组的指针随之失效
 void Environment::exit(CallExpr *callexpr)
 {
+    if (mProfiler) mProfiler->pop();
     FunctionDecl *callee = callexpr->getDirectCallee();
     QualType type = callee->getReturnType();
     if (!type->isVoidType()) {
@@ -650,6 +1186,31 @@ void Environment::exit(CallExpr *callexpr)
     }
 }
 
+/// 不压栈：被调函数的参数在预处理时分配了当前函数中的槽位，实参全部求值之后才绑定，
+/// 因此实参中对同一函数的内联调用不会被覆盖
+FunctionDecl *Environment::enterInline(CallExpr *callexpr)
+{
+    StackFrame &frame = mStack.back();
+    FunctionInfo *info = frame.getInfo();
+    const FunctionInfo::CallTarget *target = info->getCallTarget(callexpr);
+    if (!target->inlined) return nullptr;
+
+    FunctionDecl *callee = target->callee;
+    for (unsigned i = 0; i < callexpr->getNumArgs(); ++i)
+        frame.getSlot(info->getSlot(callee->getParamDecl(i))) = getStmtVal(callexpr->getArg(i));
+    // 与压栈的调用一致：没有执行 return 时返回值为 0
+    if (!callee->getReturnType()->isVoidType()) bindStmt(callexpr, 0);
+    ++mInlinedCalls;
+    mBudget.call();
+    if (mProfiler) mProfiler->push(callexpr);
+    return callee;
+}
+
+void Environment::exitInline()
+{
+    if (mProfiler) mProfiler->pop();
+}
+
 void Environment::returnstmt(ReturnStmt *returnstmt)
 {
     Expr *retVal = returnstmt->getRetValue();
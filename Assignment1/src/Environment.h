@@ -1,8 +1,12 @@
 //==--- tools/clang-check/ClangInterpreter.cpp - Clang Interpreter tool --------------===//
 //===----------------------------------------------------------------------===//
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <functional>
+#include <memory>
 #include <stdexcept>
 
 #include "clang/AST/ASTConsumer.h"
@@ -12,6 +16,10 @@
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
 
+#include "Prepare.h"
+#include "Profiler.h"
+#include "Trace.h"
+
 using namespace clang;
 
 class StackFrame
@@ -19,14 +27,27 @@ class StackFrame
   private:
     /// StackFrame maps Variable Declaration to Value
     /// Which are either integer or addresses (also represented using an Integer value)
-    std::map<Decl *, int64_t> mVars;
+    /// 变量按 FunctionInfo 中预先编号的槽位存放
+    FunctionInfo *mInfo;
+    std::vector<int64_t> mSlots;
     std::map<Stmt *, int64_t> mExprs;
     std::map<Stmt *, int64_t> mPtrs;
+    /// 地址没有逃逸的局部数组的内联存储，随栈帧一起释放
+    std::unique_ptr<char[]> mMemory;
     /// The return value
     int64_t returnValue;
 
   public:
-    StackFrame() : mVars(), mExprs(), mPtrs(), returnValue(0){}
+    StackFrame(FunctionInfo *info)
+        : mInfo(info), mSlots(info->getNumSlots(), 0), mExprs(), mPtrs(),
+          mMemory(info->getFrameSize() ? new char[info->getFrameSize()] : nullptr), returnValue(0){}
+
+    FunctionInfo *getInfo() { return mInfo; }
+    int64_t &getSlot(unsigned slot) { return mSlots[slot]; }
+    int64_t *getSlots() { return mSlots.data(); }
+    char *getMemory() { return mMemory.get(); }
+    /// 并行循环的工作线程使用的副本：复制变量的值，表达式的值和内联存储各自独立
+    StackFrame fork() const;
 
     void bindDecl(Decl *, int64_t);
     bool findDecl(Decl *);
@@ -41,15 +62,17 @@ class StackFrame
     int64_t getReturnValue();
 };
 
+/// 全局变量按 Environment::init 时分配的全局槽位连续存放，任何栈帧都直接按下标读写
 class GlobalVars
 {
   private:
-    std::map<Decl *, int64_t> mVars;
+    std::vector<int64_t> mVars;
   public:
     GlobalVars() : mVars(){}
 
-    void bindDecl(Decl *, int64_t);
-    int64_t getDeclVal(Decl *);
+    void resize(unsigned size) { mVars.assign(size, 0); }
+    int64_t &getSlot(unsigned slot) { return mVars[slot]; }
+    int64_t *data() { return mVars.data(); }
 };
 
 /// Heap maps address to a value
@@ -61,18 +84,100 @@ class Heap
     Heap() : mSpace(){}
     ~Heap() {
         // 析构 Heap 时 Free 掉局部变量中申请的空间（当然也有testcase源码中忘 Free 的情况）
-        if(mSpace.empty()) return;
-        for(auto& pair : mSpace) {
-            void *ptr = pair.first;
-            free(ptr);
-        }
-        mSpace.clear();
+        clear();
     }
 
     void *Malloc(int);
     void Free(void *);
+    /// 释放所有空间，从检查点恢复堆之前调用
+    void clear();
+    const std::map<void *, int64_t> &blocks() const { return mSpace; }
+};
+
+/// 客户程序通过 GET / PRINT 进行的输入输出，默认读写标准输入输出
+class Budget;
+
+class GuestIO
+{
+  public:
+    virtual ~GuestIO() {}
+    /// 读取一个整数，返回 false 表示没有更多输入
+    virtual bool input(int64_t &);
+    virtual llvm::raw_ostream &output();
+    /// PRINT 的一个值，默认写入 output()
+    virtual void print(int64_t);
+    /// MALLOC 的大小，只供记录 I/O 时使用
+    virtual void allocate(int64_t) {}
+    /// 解释执行开始和结束时调用，其间可以从 budget 读取步数和时间
+    virtual void begin(const Budget &) {}
+    virtual void end(bool exhausted) {}
 };
 
+/// 执行预算：在循环回边和函数调用处计数，超出步数或墙钟时间后抛出 BudgetException 中止解释
+/// 同一个检查点也可以按时间片回调嵌入方的调度器，实现单线程内多个解释器的协作式抢占
+class Budget
+{
+  private:
+    // 每隔多少步读取一次时钟
+    static const uint64_t ClockInterval = 4096;
+
+    uint64_t mCalls;
+    uint64_t mIterations;
+    uint64_t mMaxSteps; // 0 表示不限制
+    /// 同一次执行的所有工作线程共享：已经计入的总步数。各自在检查点把新增的步数计入后再与 mMaxSteps 比较，
+    /// 并发的工作线程合计最多超出各自的一个检查间隔
+    std::shared_ptr<std::atomic<uint64_t> > mTotal;
+    uint64_t mPublished; // 本地步数中已经计入 mTotal 的部分
+    uint64_t mNextCheck;
+    uint64_t mNextClock;
+    uint64_t mSlice;
+    uint64_t mNextYield;
+    std::function<void()> mYield;
+    bool mHasDeadline;
+    std::chrono::steady_clock::time_point mStart;
+    std::chrono::steady_clock::time_point mDeadline;
+
+    void check();
+    void schedule();
+
+  public:
+    Budget() : mCalls(0), mIterations(0), mMaxSteps(0), mTotal(std::make_shared<std::atomic<uint64_t> >(0)),
+               mPublished(0), mNextCheck(ClockInterval), mNextClock(ClockInterval),
+               mSlice(0), mNextYield(0), mYield(), mHasDeadline(false),
+               mStart(std::chrono::steady_clock::now()), mDeadline() {}
+
+    void setMaxSteps(uint64_t);
+    void setTimeout(unsigned ms);
+    /// 每执行 slice 步回调一次 yield，slice 为 0 表示关闭
+    void setYield(uint64_t slice, std::function<void()> yield);
+    /// 工作线程的预算：与 parent 共享步数上限和截止时间
+    void inherit(const Budget &parent);
+    /// 汇合：工作线程的计数并入当前预算。不检查预算，由之后的计数检查
+    void join(const Budget &worker);
+
+    /// 热路径：只有一次自增和一次比较
+    void call(uint64_t count = 1) { mCalls += count; if (steps() >= mNextCheck) check(); }
+    void iteration(uint64_t count = 1) { mIterations += count; if (steps() >= mNextCheck) check(); }
+
+    /// 从检查点恢复时沿用保存时的计数，--max-steps 仍然按整个执行计算
+    void restore(uint64_t calls, uint64_t iterations)
+    {
+        mCalls = calls;
+        mIterations = iterations;
+        mTotal->store(0);
+        mPublished = 0;
+        mNextCheck = 0;
+    }
+
+    uint64_t steps() const { return mCalls + mIterations; }
+    uint64_t calls() const { return mCalls; }
+    uint64_t iterations() const { return mIterations; }
+    double elapsedMs() const;
+};
+
+struct Checkpoint;
+class PointerMap;
+
 class Environment
 {
     std::vector<StackFrame> mStack;
@@ -89,23 +194,125 @@ class Environment
 
     FunctionDecl *mEntry;
 
+    typedef llvm::DenseMap<FunctionDecl *, std::unique_ptr<FunctionInfo>> FunctionMap;
+    /// 按需生成的函数预处理结果，以函数定义为键
+    FunctionMap mFunctions;
+    std::shared_ptr<FunctionInfo> mGlobalInfo; // 初始化后只读，与并行循环的工作线程共享
+
+    /// 分叉求值纯函数调用：纯函数在执行开始前全部预处理，之后只读，与分叉出的工作线程共享
+    bool mForkJoin;
+    std::shared_ptr<const PurityAnalyzer> mPurity;
+    std::shared_ptr<const FunctionMap> mPureFunctions;
+    unsigned mForkDepth; // 从主线程到当前环境经过的分叉次数
+
+    /// 热循环的 trace，以函数和循环语句为键：内联展开的循环在不同的函数中槽位不同；阈值为 0 表示不录制
+    unsigned mTraceThreshold;
+    llvm::DenseMap<std::pair<const FunctionInfo *, const Stmt *>, std::unique_ptr<TraceState>> mTraces;
+    TraceStats mTraceStats;
+
+    /// 预处理时内联展开的函数体大小和层数的上限，大小为 0 表示不内联
+    unsigned mInlineSize;
+    unsigned mInlineDepth;
+    uint64_t mInlinedCalls; // 执行过的内联调用
+
+    uint64_t mInputs;  // GET 读取的个数，即输入的位置
+    uint64_t mOutputs; // PRINT 的个数
+
+    Profiler *mProfiler; // 仅在 --profile 时非空
+    uint64_t mNodes; // 执行过的 AST 结点数
+    Budget mBudget;
+    std::shared_ptr<PointerMap> mPointers; // 仅在保存检查点时非空，与工作线程共享
+    GuestIO mStdIO;
+    GuestIO *mIO;
+    llvm::raw_ostream *mLog; // 调试信息，--stderr 时为标准错误流
+
+    /// 变量在当前栈帧或全局变量中的存储位置
+    int64_t &slotOf(Decl *);
+    int64_t &slotOf(const FunctionInfo::VarRef &);
+    bool isMemoryBacked(VarDecl *);
+    void prepareForkJoin();
+    /// 按类型写入客户内存，保存检查点时同时登记写入的是不是指针
+    void write(int64_t addr, QualType type, int64_t val);
+
   public:
     /// Get the declarations to the built-in functions
-    Environment(const ASTContext &Context) : mStack(), mHeap(), mGlobal(), context(Context),mFree(nullptr), mMalloc(nullptr), mInput(nullptr), mOutput(nullptr), mEntry(nullptr) {
-        mStack.push_back(StackFrame());
-    }
+    Environment(const ASTContext &Context) : mStack(), mHeap(), mGlobal(), context(Context),mFree(nullptr), mMalloc(nullptr), mInput(nullptr), mOutput(nullptr), mEntry(nullptr), mFunctions(), mGlobalInfo(), mForkJoin(false), mPurity(), mPureFunctions(), mForkDepth(0), mTraceThreshold(0), mTraces(), mTraceStats(), mInlineSize(0), mInlineDepth(0), mInlinedCalls(0), mInputs(0), mOutputs(0), mProfiler(nullptr), mNodes(0), mBudget(), mPointers(), mStdIO(), mIO(&mStdIO), mLog(&llvm::nulls()) {}
 
     /// Initialize the Environment
+    /// 识别内建函数和入口
     void init(TranslationUnitDecl *);
+    /// 通过 Verifier 后调用：为全局变量编号并压入用于计算全局变量初始值的栈帧，
+    /// addressTaken 为可达代码中取了地址的全局变量
+    void initGlobals(TranslationUnitDecl *, const llvm::DenseSet<const VarDecl *> &addressTaken);
+    /// 全局变量初始化完成后调用：保存全局变量并压入入口函数的栈帧
+    FunctionDecl *start();
+    /// 第一次调用函数时生成其 FunctionInfo，之后直接返回缓存
+    FunctionInfo *prepare(FunctionDecl *);
+    /// 如果结点是预处理时折叠的常量，直接绑定其值并返回 true
+    bool fold(Stmt *);
+    /// 作为并行循环或分叉调用的工作线程：复制 parent 的当前栈帧和全局变量，与 parent 共享执行预算
+    void fork(const Environment &parent);
+    /// 在 start 之前调用：start 时分析纯函数，预处理时记录可以分叉求值的二元运算
+    void setForkJoin(bool enabled) { mForkJoin = enabled; }
+    const PurityAnalyzer *getPurity() const { return mPurity.get(); }
+    unsigned getForkDepth() const { return mForkDepth; }
+    /// 分叉的两半都比分叉点深一层：当前线程求值的一半在求值期间加深一层
+    void enterFork() { ++mForkDepth; }
+    void leaveFork() { --mForkDepth; }
+    /// 循环解释执行 threshold 次迭代后录制一次迭代并编译为 Trace，0 表示关闭
+    void setTraceThreshold(unsigned threshold) { mTraceThreshold = threshold; }
+    const TraceStats &traceStats() const { return mTraceStats; }
+    /// 关闭 trace 时返回空指针
+    TraceState *getTraceState(Stmt *loop);
+    /// 解释执行一次迭代前调用，返回 true 表示应当录制这次迭代
+    bool shouldRecord(TraceState &);
+    void compileTrace(TraceState &, Expr *cond, Stmt *body, Expr *inc, const TraceRecorder &);
+    /// 在当前栈帧上执行 trace：循环条件为假时返回 true，从侧出口离开时返回 false 并设置 exit
+    bool runTrace(TraceState &, unsigned &exit);
+    /// 在 start 之前调用
+    void setInline(unsigned size, unsigned depth) { mInlineSize = size; mInlineDepth = depth; }
+    unsigned getInlineSize() const { return mInlineSize; }
+    unsigned getInlineDepth() const { return mInlineDepth; }
+    /// 已经预处理的函数中内联展开的调用点数
+    uint64_t inlinedSites() const;
+    uint64_t inlinedCalls() const { return mInlinedCalls; }
+    /// 在 initGlobals 之前调用：开启后登记客户内存中的指针，capture 据此保存内存中指针的位置
+    void setPointerTracking(bool enabled);
+    /// 只在入口函数的栈帧中调用：保存槽位、内联存储、全局变量、堆和输入输出的位置
+    void capture(Checkpoint &);
+    /// 在 start 之后调用：恢复 capture 保存的状态，并跳过已经读取的输入。
+    /// 只有指针、数组、结构体类型和取地址的变量以及内存中登记为指针的值重定位到新分配的内存
+    void restore(const Checkpoint &);
+    size_t depth() const { return mStack.size(); }
+    const ParallelLoop *getParallelLoop(ForStmt *);
+    const ForkJoin *getForkJoin(BinaryOperator *);
+    const LoopIdiom *getLoopIdiom(ForStmt *);
+    const SwitchTable &getSwitchTable(SwitchStmt *);
 
-    FunctionDecl *getEntry();
+    FunctionDecl *getEntry() const;
+    /// 全局变量的所有重复声明共用一个槽位
+    unsigned getGlobalSlot(const VarDecl *) const;
+    bool isGlobalMemoryBacked(const VarDecl *) const;
+    void setProfiler(Profiler *profiler) { mProfiler = profiler; }
+    /// 每个结点执行前调用：计数，并向 Profiler 发布当前 Stmt
+    void trace(Stmt *stmt) { ++mNodes; if (mProfiler) mProfiler->enter(stmt); }
+    uint64_t nodes() const { return mNodes; }
+    /// 并行循环的工作线程执行的结点计入父环境
+    void addNodes(uint64_t count) { mNodes += count; }
+    Budget &budget() { return mBudget; }
+    void setIO(GuestIO *io) { mIO = io ? io : &mStdIO; }
+    /// 调试信息只写入本次解释执行的流，同一进程内的多次执行互不影响
+    void setLog(llvm::raw_ostream *log) { mLog = log ? log : &llvm::nulls(); }
+    llvm::raw_ostream &log() { return *mLog; }
     int64_t getStmtVal(Expr *);
     int64_t getDeclVal(Decl *);
     int64_t getPtrVal(Expr *);
+    void bindDecl(Decl *, int64_t);
     void bindDecl(Expr *, int64_t);
     void bindStmt(Expr *, int64_t);
     void bindPtr(Expr *, int64_t);
     bool isBuildIn(CallExpr *);
+    bool isBuildIn(const FunctionDecl *) const;
 
     int64_t cond(Expr *);
     void intliteral(Expr *);
@@ -117,14 +324,20 @@ class Environment
     void condop(ConditionalOperator *, Expr *);
     void ueott(UnaryExprOrTypeTraitExpr *);
     void vardecl(Decl *);
+    void *allocate(VarDecl *, int);
     void fdecl(Decl *);
     void declref(DeclRefExpr *);
     void cast(CastExpr *);
-    void arraysub(ArraySubscriptExpr *);
+    const AccessPath &getAccessPath(Expr *);
+    void access(Expr *, const AccessPath &);
+    bool idiom(const LoopIdiom &);
 
     void callbuildin(CallExpr *);
-    void call(CallExpr *);
+    FunctionDecl *call(CallExpr *);
     void exit(CallExpr *);
+    /// 内联的调用点：在当前栈帧中绑定参数并返回被调函数，其余的调用点返回空指针
+    FunctionDecl *enterInline(CallExpr *);
+    void exitInline();
     void returnstmt(ReturnStmt *);
 };
 
@@ -160,7 +373,14 @@ namespace self {
             std::string errorMessage;
     };
 
-    // 根据命令行参数 --stderr 判断是否开启标准错误流
-    extern bool useErrs;
-    llvm::raw_ostream &errs();
+    // 执行预算耗尽时抛出，一直传播到解释器入口
+    class BudgetException : public std::exception {
+        public:
+            BudgetException(const std::string &reason) : errorMessage(reason) {}
+            const char* what() const noexcept override {
+                return errorMessage.c_str();
+            }
+        private:
+            std::string errorMessage;
+    };
 }
@@ -0,0 +1,155 @@
+#include "Idiom.h"
+#include "Prepare.h"
+
+#include "clang/AST/ASTContext.h"
+
+bool IdiomRecognizer::recognize(ForStmt *forstmt, LoopIdiom &idiom)
+{
+    ParallelLoop header;
+    if (!mAnalyzer.matchHeader(forstmt, header)) return false;
+    idiom.induction = header.induction;
+    idiom.bound = header.bound;
+    idiom.inclusive = header.inclusive;
+    idiom.target = nullptr;
+    idiom.sources[0] = idiom.sources[1] = nullptr;
+    idiom.value = nullptr;
+
+    Stmt *body = single(forstmt->getBody());
+    bool matched = false;
+    if (BinaryOperator *bop = dyn_cast_or_null<BinaryOperator>(body))
+        matched = matchAssign(bop, idiom);
+    else if (IfStmt *ifstmt = dyn_cast_or_null<IfStmt>(body))
+        matched = matchMinMax(ifstmt, idiom);
+
+    // 归约变量不能出现在循环上界中
+    return matched && !refersTo(idiom.bound, idiom.target);
+}
+
+bool IdiomRecognizer::matchAssign(BinaryOperator *bop, LoopIdiom &idiom)
+{
+    Expr *rhs = bop->getRHS()->IgnoreParenImpCasts();
+    unsigned size = 0, other = 0;
+
+    if (bop->getOpcode() == BO_AddAssign) {
+        // s += a[i]
+        idiom.target = matchScalar(bop->getLHS());
+        idiom.sources[0] = matchElement(rhs, idiom.size);
+        idiom.kind = LoopIdiom::Sum;
+        return idiom.target && idiom.sources[0] && idiom.sources[0] != idiom.target;
+    }
+    if (bop->getOpcode() != BO_Assign) return false;
+
+    if (VarDecl *scalar = matchScalar(bop->getLHS())) {
+        // s = s + a[i] 或 s = a[i] + s
+        BinaryOperator *add = dyn_cast<BinaryOperator>(rhs);
+        if (add == nullptr || add->getOpcode() != BO_Add) return false;
+        Expr *lhs = add->getLHS(), *element = add->getRHS();
+        if (matchScalar(lhs) != scalar) std::swap(lhs, element);
+        if (matchScalar(lhs) != scalar) return false;
+        idiom.target = scalar;
+        idiom.sources[0] = matchElement(element, idiom.size);
+        idiom.kind = LoopIdiom::Sum;
+        return idiom.sources[0] && idiom.sources[0] != scalar;
+    }
+
+    idiom.target = matchElement(bop->getLHS(), idiom.size);
+    if (idiom.target == nullptr) return false;
+
+    if ((idiom.sources[0] = matchElement(rhs, size))) {
+        idiom.kind = LoopIdiom::Copy;
+        return size == idiom.size;
+    }
+
+    BinaryOperator *arith = dyn_cast<BinaryOperator>(rhs);
+    if (arith && (arith->getOpcode() == BO_Add || arith->getOpcode() == BO_Mul)) {
+        idiom.sources[0] = matchElement(arith->getLHS(), size);
+        idiom.sources[1] = matchElement(arith->getRHS(), other);
+        idiom.kind = arith->getOpcode() == BO_Add ? LoopIdiom::Add : LoopIdiom::Mul;
+        return idiom.sources[0] && idiom.sources[1] && size == idiom.size && other == idiom.size;
+    }
+
+    if (mAnalyzer.isInvariant(bop->getRHS())) {
+        idiom.value = bop->getRHS();
+        idiom.kind = LoopIdiom::Fill;
+        return true;
+    }
+    return false;
+}
+
+/// if (a[i] < m) m = a[i]; 比较的方向决定是最小值还是最大值
+bool IdiomRecognizer::matchMinMax(IfStmt *ifstmt, LoopIdiom &idiom)
+{
+    if (ifstmt->getElse() || ifstmt->getInit() || ifstmt->getConditionVariable()) return false;
+    BinaryOperator *cmp = dyn_cast<BinaryOperator>(ifstmt->getCond()->IgnoreParenImpCasts());
+    BinaryOperator *assign = dyn_cast_or_null<BinaryOperator>(single(ifstmt->getThen()));
+    if (cmp == nullptr || assign == nullptr || assign->getOpcode() != BO_Assign) return false;
+
+    bool less;
+    switch (cmp->getOpcode())
+    {
+        case BO_LT: case BO_LE: less = true; break;
+        case BO_GT: case BO_GE: less = false; break;
+        default: return false;
+    }
+
+    unsigned size = 0;
+    Expr *element = cmp->getLHS(), *scalar = cmp->getRHS();
+    VarDecl *array = matchElement(element, idiom.size);
+    if (array == nullptr) {
+        // m > a[i] 与 a[i] < m 相同
+        std::swap(element, scalar);
+        array = matchElement(element, idiom.size);
+        less = !less;
+    }
+    idiom.target = matchScalar(scalar);
+    if (array == nullptr || idiom.target == nullptr || array == idiom.target) return false;
+    if (matchScalar(assign->getLHS()) != idiom.target) return false;
+    if (matchElement(assign->getRHS()->IgnoreParenImpCasts(), size) != array || size != idiom.size) return false;
+
+    idiom.sources[0] = array;
+    idiom.kind = less ? LoopIdiom::Min : LoopIdiom::Max;
+    return true;
+}
+
+VarDecl *IdiomRecognizer::matchElement(Expr *expr, unsigned &size)
+{
+    ArraySubscriptExpr *arraysub = dyn_cast<ArraySubscriptExpr>(expr->IgnoreParenImpCasts());
+    if (arraysub == nullptr || !mAnalyzer.isInduction(arraysub->getIdx())) return nullptr;
+
+    QualType type = arraysub->getType();
+    size = context.getTypeSizeInChars(type).getQuantity();
+    if (!type->isCharType() && !(type->isIntegerType() && size == 4)) return nullptr;
+
+    DeclRefExpr *base = dyn_cast<DeclRefExpr>(arraysub->getBase()->IgnoreParenImpCasts());
+    return base ? dyn_cast<VarDecl>(base->getDecl()) : nullptr;
+}
+
+VarDecl *IdiomRecognizer::matchScalar(Expr *expr)
+{
+    DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr->IgnoreParenImpCasts());
+    if (declref == nullptr || mAnalyzer.isInduction(declref)) return nullptr;
+    VarDecl *vardecl = dyn_cast<VarDecl>(declref->getDecl());
+    if (vardecl == nullptr || !vardecl->getType()->isIntegerType()) return nullptr;
+    return vardecl;
+}
+
+bool IdiomRecognizer::refersTo(Stmt *stmt, const VarDecl *var)
+{
+    if (stmt == nullptr || var == nullptr) return false;
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(stmt))
+        return declref->getDecl() == var;
+    for (auto *SubStmt : stmt->children())
+        if (refersTo(SubStmt, var)) return true;
+    return false;
+}
+
+/// 只含一条语句的复合语句取出其中的语句
+Stmt *IdiomRecognizer::single(Stmt *stmt)
+{
+    while (CompoundStmt *compound = dyn_cast_or_null<CompoundStmt>(stmt))
+    {
+        if (compound->size() != 1) return nullptr;
+        stmt = compound->body_front();
+    }
+    return stmt;
+}
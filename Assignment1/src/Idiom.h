@@ -0,0 +1,45 @@
+//==--- Idiom.h - Recognition of bulk array loop idioms --------------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include "Parallel.h"
+
+/// 可以整体交给 Kernels 执行的循环，循环头与 ParallelLoop 相同，循环体为下列之一：
+///   Fill: a[i] = c;            Copy: a[i] = b[i];
+///   Add:  a[i] = b[i] + c[i];  Mul:  a[i] = b[i] * c[i];
+///   Sum:  s += a[i];           Min / Max: if (a[i] < m) m = a[i];
+/// 数组元素只能是 int 或 char，同一个循环中的元素大小相同
+struct LoopIdiom
+{
+    enum Kind { Fill, Copy, Add, Mul, Sum, Min, Max };
+
+    Kind kind;
+    VarDecl *induction;
+    Expr *bound;
+    bool inclusive;
+    VarDecl *target;      // 写入的数组，或者归约的变量
+    VarDecl *sources[2];  // 读取的数组
+    Expr *value;          // Fill 写入的循环不变量，其余为空
+    unsigned size;        // 元素大小
+};
+
+class IdiomRecognizer
+{
+  public:
+    IdiomRecognizer(const ASTContext &context, const FunctionInfo &info)
+        : context(context), mAnalyzer(context, info){}
+
+    bool recognize(ForStmt *, LoopIdiom &);
+
+  private:
+    bool matchAssign(BinaryOperator *, LoopIdiom &);
+    bool matchMinMax(IfStmt *, LoopIdiom &);
+    /// a[i]，返回数组变量并设置元素大小
+    VarDecl *matchElement(Expr *, unsigned &size);
+    /// 除归纳变量外的整数变量
+    VarDecl *matchScalar(Expr *);
+    static bool refersTo(Stmt *, const VarDecl *);
+    static Stmt *single(Stmt *);
+
+    const ASTContext &context;
+    LoopAnalyzer mAnalyzer;
+};
@@ -0,0 +1,42 @@
+//==--- Interpreter.h - Entry of the Clang AST interpreter -----------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <functional>
+#include <string>
+
+#include "Checkpoint.h"
+#include "Environment.h"
+
+class Specializer;
+
+/// 由命令行参数传递给解释器的配置
+struct InterpreterOptions
+{
+    std::string profileFile; // --profile 输出文件，为空表示不采样
+    unsigned profileHz;
+    uint64_t maxSteps; // --max-steps，0 表示不限制
+    unsigned timeoutMs; // --timeout，0 表示不限制
+    bool *exhausted; // 若非空，执行预算耗尽时置为 true
+    GuestIO *io; // 为空时使用标准输入输出
+    llvm::raw_ostream *log; // --stderr 时的调试信息，为空表示丢弃
+    uint64_t timeSlice; // 每执行 timeSlice 步回调一次 yield
+    std::function<void()> yield;
+    unsigned parallelLoops; // --parallel-loops 的线程数，小于 2 表示不并行
+    unsigned parallelCalls; // --parallel-calls 的线程数，小于 2 表示不分叉
+    std::string statsFile; // --stats 输出文件，为空表示不输出
+    unsigned traceThreshold; // --trace-threshold，0 表示不编译热循环
+    unsigned inlineSize; // --inline-size，0 表示不内联
+    unsigned inlineDepth; // --inline-depth
+    std::string checkpointFile; // --checkpoint 输出文件，为空表示不保存
+    uint64_t checkpointSteps; // --checkpoint-steps，两次保存之间的步数
+    const Checkpoint *resume; // --resume 读取的检查点，为空表示从头执行
+    Specializer *specializer; // --residual-cache 时非空，在入口函数体的每条顶层语句之前检查能否作为剩余程序的起点
+
+    InterpreterOptions() : profileFile(), profileHz(1000), maxSteps(0), timeoutMs(0), exhausted(nullptr),
+                           io(nullptr), log(nullptr), timeSlice(0), yield(), parallelLoops(0), parallelCalls(0), statsFile(),
+                           traceThreshold(0), inlineSize(0), inlineDepth(2), checkpointFile(), checkpointSteps(0),
+                           resume(nullptr), specializer(nullptr) {}
+};
+
+/// 在当前线程上解析并解释执行一段源码，解析或静态检查失败时返回 false
+bool interpret(const std::string &sourceCode, const InterpreterOptions &options);
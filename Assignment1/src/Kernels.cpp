@@ -0,0 +1,408 @@
+#include "Kernels.h"
+
+#include <climits>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#endif
+
+namespace {
+
+typedef void (*BinaryKernel)(void *, const void *, const void *, int64_t, unsigned);
+typedef int64_t (*ReduceKernel)(const void *, int64_t, unsigned);
+typedef void (*FillKernel)(void *, int64_t, int64_t);
+
+// 与解释器写回数组时的截断一致：int 按 32 位回绕，char 按 8 位回绕
+
+void addScalar(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size)
+{
+    if (size == 4) {
+        int *d = (int *)dst;
+        const int *a = (const int *)lhs, *b = (const int *)rhs;
+        for (int64_t i = 0; i < n; ++i) d[i] = (int)((uint32_t)a[i] + (uint32_t)b[i]);
+    } else {
+        char *d = (char *)dst;
+        const char *a = (const char *)lhs, *b = (const char *)rhs;
+        for (int64_t i = 0; i < n; ++i) d[i] = (char)(a[i] + b[i]);
+    }
+}
+
+void mulScalar(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size)
+{
+    if (size == 4) {
+        int *d = (int *)dst;
+        const int *a = (const int *)lhs, *b = (const int *)rhs;
+        for (int64_t i = 0; i < n; ++i) d[i] = (int)((uint32_t)a[i] * (uint32_t)b[i]);
+    } else {
+        char *d = (char *)dst;
+        const char *a = (const char *)lhs, *b = (const char *)rhs;
+        for (int64_t i = 0; i < n; ++i) d[i] = (char)(a[i] * b[i]);
+    }
+}
+
+int64_t sumScalar(const void *src, int64_t n, unsigned size)
+{
+    int64_t total = 0;
+    if (size == 4)
+        for (int64_t i = 0; i < n; ++i) total += ((const int *)src)[i];
+    else
+        for (int64_t i = 0; i < n; ++i) total += ((const char *)src)[i];
+    return total;
+}
+
+int64_t minScalar(const void *src, int64_t n, unsigned size)
+{
+    int64_t result = INT64_MAX;
+    for (int64_t i = 0; i < n; ++i)
+    {
+        int64_t val = size == 4 ? ((const int *)src)[i] : ((const char *)src)[i];
+        if (val < result) result = val;
+    }
+    return result;
+}
+
+int64_t maxScalar(const void *src, int64_t n, unsigned size)
+{
+    int64_t result = INT64_MIN;
+    for (int64_t i = 0; i < n; ++i)
+    {
+        int64_t val = size == 4 ? ((const int *)src)[i] : ((const char *)src)[i];
+        if (val > result) result = val;
+    }
+    return result;
+}
+
+void fillScalar(void *dst, int64_t value, int64_t n)
+{
+    int *d = (int *)dst;
+    for (int64_t i = 0; i < n; ++i) d[i] = (int)value;
+}
+
+#ifdef KERNELS_X86
+
+// 向量部分按字节处理整块，剩余不足一个向量的元素交给标量实现
+
+__attribute__((target("avx2")))
+void addAVX2(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size)
+{
+    char *d = (char *)dst;
+    const char *a = (const char *)lhs, *b = (const char *)rhs;
+    int64_t bytes = n * size, i = 0;
+    for (; i + 32 <= bytes; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(d + i), size == 4 ? _mm256_add_epi32(x, y) : _mm256_add_epi8(x, y));
+    }
+    addScalar(d + i, a + i, b + i, (bytes - i) / size, size);
+}
+
+__attribute__((target("avx2")))
+void mulAVX2(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size)
+{
+    // 没有 8 位乘法指令，char 直接使用标量实现
+    if (size != 4) return mulScalar(dst, lhs, rhs, n, size);
+    int *d = (int *)dst;
+    const int *a = (const int *)lhs, *b = (const int *)rhs;
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(d + i), _mm256_mullo_epi32(x, y));
+    }
+    mulScalar(d + i, a + i, b + i, n - i, size);
+}
+
+__attribute__((target("avx2")))
+int64_t sumAVX2(const void *src, int64_t n, unsigned size)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int64_t i = 0, total = 0;
+    if (size == 4) {
+        const int *p = (const int *)src;
+        for (; i + 8 <= n; i += 8)
+        {
+            acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(p + i))));
+            acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(p + i + 4))));
+        }
+    } else {
+        // 有符号字节异或 0x80 变为无符号，用 sad 求和后再减去偏置
+        const char *p = (const char *)src;
+        const __m256i bias = _mm256_set1_epi8((char)0x80);
+        for (; i + 32 <= n; i += 32)
+        {
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i)), bias);
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(x, _mm256_setzero_si256()));
+        }
+        total -= 128 * i;
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    total += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return total + sumScalar((const char *)src + i * size, n - i, size);
+}
+
+__attribute__((target("avx2")))
+int64_t minAVX2(const void *src, int64_t n, unsigned size)
+{
+    int64_t i = 0, result = INT64_MAX;
+    if (size == 4) {
+        const int *p = (const int *)src;
+        __m256i acc = _mm256_set1_epi32(INT_MAX);
+        for (; i + 8 <= n; i += 8)
+            acc = _mm256_min_epi32(acc, _mm256_loadu_si256((const __m256i *)(p + i)));
+        int lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        if (i > 0) result = minScalar(lanes, 8, 4);
+    } else {
+        const char *p = (const char *)src;
+        __m256i acc = _mm256_set1_epi8(CHAR_MAX);
+        for (; i + 32 <= n; i += 32)
+            acc = _mm256_min_epi8(acc, _mm256_loadu_si256((const __m256i *)(p + i)));
+        char lanes[32];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        if (i > 0) result = minScalar(lanes, 32, 1);
+    }
+    int64_t tail = minScalar((const char *)src + i * size, n - i, size);
+    return tail < result ? tail : result;
+}
+
+__attribute__((target("avx2")))
+int64_t maxAVX2(const void *src, int64_t n, unsigned size)
+{
+    int64_t i = 0, result = INT64_MIN;
+    if (size == 4) {
+        const int *p = (const int *)src;
+        __m256i acc = _mm256_set1_epi32(INT_MIN);
+        for (; i + 8 <= n; i += 8)
+            acc = _mm256_max_epi32(acc, _mm256_loadu_si256((const __m256i *)(p + i)));
+        int lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        if (i > 0) result = maxScalar(lanes, 8, 4);
+    } else {
+        const char *p = (const char *)src;
+        __m256i acc = _mm256_set1_epi8(CHAR_MIN);
+        for (; i + 32 <= n; i += 32)
+            acc = _mm256_max_epi8(acc, _mm256_loadu_si256((const __m256i *)(p + i)));
+        char lanes[32];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        if (i > 0) result = maxScalar(lanes, 32, 1);
+    }
+    int64_t tail = maxScalar((const char *)src + i * size, n - i, size);
+    return tail > result ? tail : result;
+}
+
+__attribute__((target("avx2")))
+void fillAVX2(void *dst, int64_t value, int64_t n)
+{
+    int *d = (int *)dst;
+    __m256i x = _mm256_set1_epi32((int)value);
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *)(d + i), x);
+    fillScalar(d + i, value, n - i);
+}
+
+__attribute__((target("sse4.1")))
+void addSSE(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size)
+{
+    char *d = (char *)dst;
+    const char *a = (const char *)lhs, *b = (const char *)rhs;
+    int64_t bytes = n * size, i = 0;
+    for (; i + 16 <= bytes; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(d + i), size == 4 ? _mm_add_epi32(x, y) : _mm_add_epi8(x, y));
+    }
+    addScalar(d + i, a + i, b + i, (bytes - i) / size, size);
+}
+
+__attribute__((target("sse4.1")))
+void mulSSE(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size)
+{
+    if (size != 4) return mulScalar(dst, lhs, rhs, n, size);
+    int *d = (int *)dst;
+    const int *a = (const int *)lhs, *b = (const int *)rhs;
+    int64_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_mullo_epi32(x, y));
+    }
+    mulScalar(d + i, a + i, b + i, n - i, size);
+}
+
+__attribute__((target("sse4.1")))
+int64_t sumSSE(const void *src, int64_t n, unsigned size)
+{
+    __m128i acc = _mm_setzero_si128();
+    int64_t i = 0, total = 0;
+    if (size == 4) {
+        const int *p = (const int *)src;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+            acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(x));
+            acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(_mm_srli_si128(x, 8)));
+        }
+    } else {
+        const char *p = (const char *)src;
+        const __m128i bias = _mm_set1_epi8((char)0x80);
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i)), bias);
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(x, _mm_setzero_si128()));
+        }
+        total -= 128 * i;
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    total += lanes[0] + lanes[1];
+    return total + sumScalar((const char *)src + i * size, n - i, size);
+}
+
+__attribute__((target("sse4.1")))
+int64_t minSSE(const void *src, int64_t n, unsigned size)
+{
+    int64_t i = 0, result = INT64_MAX;
+    if (size == 4) {
+        const int *p = (const int *)src;
+        __m128i acc = _mm_set1_epi32(INT_MAX);
+        for (; i + 4 <= n; i += 4)
+            acc = _mm_min_epi32(acc, _mm_loadu_si128((const __m128i *)(p + i)));
+        int lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        if (i > 0) result = minScalar(lanes, 4, 4);
+    } else {
+        const char *p = (const char *)src;
+        __m128i acc = _mm_set1_epi8(CHAR_MAX);
+        for (; i + 16 <= n; i += 16)
+            acc = _mm_min_epi8(acc, _mm_loadu_si128((const __m128i *)(p + i)));
+        char lanes[16];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        if (i > 0) result = minScalar(lanes, 16, 1);
+    }
+    int64_t tail = minScalar((const char *)src + i * size, n - i, size);
+    return tail < result ? tail : result;
+}
+
+__attribute__((target("sse4.1")))
+int64_t maxSSE(const void *src, int64_t n, unsigned size)
+{
+    int64_t i = 0, result = INT64_MIN;
+    if (size == 4) {
+        const int *p = (const int *)src;
+        __m128i acc = _mm_set1_epi32(INT_MIN);
+        for (; i + 4 <= n; i += 4)
+            acc = _mm_max_epi32(acc, _mm_loadu_si128((const __m128i *)(p + i)));
+        int lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        if (i > 0) result = maxScalar(lanes, 4, 4);
+    } else {
+        const char *p = (const char *)src;
+        __m128i acc = _mm_set1_epi8(CHAR_MIN);
+        for (; i + 16 <= n; i += 16)
+            acc = _mm_max_epi8(acc, _mm_loadu_si128((const __m128i *)(p + i)));
+        char lanes[16];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        if (i > 0) result = maxScalar(lanes, 16, 1);
+    }
+    int64_t tail = maxScalar((const char *)src + i * size, n - i, size);
+    return tail > result ? tail : result;
+}
+
+__attribute__((target("sse4.1")))
+void fillSSE(void *dst, int64_t value, int64_t n)
+{
+    int *d = (int *)dst;
+    __m128i x = _mm_set1_epi32((int)value);
+    int64_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(d + i), x);
+    fillScalar(d + i, value, n - i);
+}
+
+#endif
+
+struct Table
+{
+    const char *isa;
+    BinaryKernel add;
+    BinaryKernel mul;
+    ReduceKernel sum;
+    ReduceKernel min;
+    ReduceKernel max;
+    FillKernel fill;
+};
+
+Table select()
+{
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return Table{"avx2", addAVX2, mulAVX2, sumAVX2, minAVX2, maxAVX2, fillAVX2};
+    if (__builtin_cpu_supports("sse4.1"))
+        return Table{"sse4.1", addSSE, mulSSE, sumSSE, minSSE, maxSSE, fillSSE};
+#endif
+    return Table{"scalar", addScalar, mulScalar, sumScalar, minScalar, maxScalar, fillScalar};
+}
+
+const Table &table()
+{
+    // 局部静态变量的初始化是线程安全的，并行循环中也可以调用
+    static const Table selected = select();
+    return selected;
+}
+
+} // namespace
+
+namespace kernels {
+
+void fill(void *dst, int64_t value, int64_t n, unsigned size)
+{
+    if (size == 1) memset(dst, (char)value, n);
+    else table().fill(dst, value, n);
+}
+
+void copy(void *dst, const void *src, int64_t n, unsigned size)
+{
+    // libc 的实现已经按 CPU 特性向量化；调用方保证两段内存相同或不重叠
+    if (dst != src) memmove(dst, src, n * size);
+}
+
+void add(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size)
+{
+    table().add(dst, lhs, rhs, n, size);
+}
+
+void mul(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size)
+{
+    table().mul(dst, lhs, rhs, n, size);
+}
+
+int64_t sum(const void *src, int64_t n, unsigned size)
+{
+    return table().sum(src, n, size);
+}
+
+int64_t min(const void *src, int64_t n, unsigned size)
+{
+    return table().min(src, n, size);
+}
+
+int64_t max(const void *src, int64_t n, unsigned size)
+{
+    return table().max(src, n, size);
+}
+
+const char *isa()
+{
+    return table().isa;
+}
+
+} // namespace kernels
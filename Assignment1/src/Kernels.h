@@ -0,0 +1,20 @@
+//==--- Kernels.h - SIMD kernels for recognized loop idioms ----------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <cstdint>
+
+/// 数组元素为 int（size 为 4）或 char（size 为 1）的批量运算
+/// 第一次调用时按 CPU 特性（AVX2 / SSE4.1 / 标量）选择实现，之后直接调用
+/// 归约的结果与解释器一致，按 int64_t 累加，不会在 32 位上回绕
+namespace kernels {
+    void fill(void *dst, int64_t value, int64_t n, unsigned size);
+    void copy(void *dst, const void *src, int64_t n, unsigned size);
+    void add(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size);
+    void mul(void *dst, const void *lhs, const void *rhs, int64_t n, unsigned size);
+    int64_t sum(const void *src, int64_t n, unsigned size);
+    int64_t min(const void *src, int64_t n, unsigned size);
+    int64_t max(const void *src, int64_t n, unsigned size);
+
+    /// 选中的指令集，用于报告
+    const char *isa();
+}
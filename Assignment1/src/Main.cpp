@@ -0,0 +1,260 @@
+//==--- Main.cpp - Command line driver of the Clang AST interpreter ---------===//
+//===----------------------------------------------------------------------===//
+// 解释器本身编译为 interpreter 库，这里只负责命令行参数和会话驱动
+
+#include <deque>
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "Interpreter.h"
+#include "Replay.h"
+#include "Residual.h"
+#include "Scheduler.h"
+
+llvm::cl::opt<std::string> InputFilename(llvm::cl::Positional, llvm::cl::desc("<source>.c"), llvm::cl::Optional);
+llvm::cl::opt<bool> FileOption("file", llvm::cl::desc("Enable read from file"));
+llvm::cl::alias FileOptionShort("f", llvm::cl::aliasopt(FileOption));
+llvm::cl::opt<bool> StdErrOption("stderr", llvm::cl::desc("Enable stderr output"));
+llvm::cl::alias StdErrOptionShort("e", llvm::cl::aliasopt(StdErrOption));
+llvm::cl::opt<std::string> ProfileOption("profile", llvm::cl::desc("Write a folded-stack sampling profile to <file>"), llvm::cl::value_desc("file"));
+llvm::cl::opt<unsigned long long> MaxStepsOption("max-steps", llvm::cl::desc("Stop after <n> loop iterations and calls (0 = unlimited)"), llvm::cl::value_desc("n"), llvm::cl::init(0));
+llvm::cl::opt<unsigned> TimeoutOption("timeout", llvm::cl::desc("Stop after <ms> milliseconds of interpretation (0 = unlimited)"), llvm::cl::value_desc("ms"), llvm::cl::init(0));
+llvm::cl::opt<unsigned> ProfileHzOption("profile-hz", llvm::cl::desc("Sampling frequency of --profile in Hz"), llvm::cl::init(1000));
+llvm::cl::list<std::string> SessionOption("session", llvm::cl::desc("Run <source>.c with inputs from <inputs> as a scheduled session (repeatable)"), llvm::cl::value_desc("source.c[:inputs]"));
+llvm::cl::opt<unsigned long long> SliceOption("session-slice", llvm::cl::desc("Steps a session may run before yielding to the scheduler"), llvm::cl::init(10000));
+llvm::cl::opt<unsigned> ParallelLoopsOption("parallel-loops", llvm::cl::desc("Run provably independent for loops on <n> threads"), llvm::cl::value_desc("n"), llvm::cl::init(0));
+llvm::cl::opt<unsigned> ParallelCallsOption("parallel-calls", llvm::cl::desc("Evaluate independent calls to pure functions on <n> threads"), llvm::cl::value_desc("n"), llvm::cl::init(0));
+llvm::cl::opt<unsigned> TraceThresholdOption("trace-threshold", llvm::cl::desc("Compile a loop into a trace after <n> interpreted iterations (0 = off)"), llvm::cl::value_desc("n"), llvm::cl::init(0));
+llvm::cl::opt<unsigned> InlineSizeOption("inline-size", llvm::cl::desc("Inline guest functions of at most <n> AST nodes into their callers (0 = off)"), llvm::cl::value_desc("n"), llvm::cl::init(0));
+llvm::cl::opt<unsigned> InlineDepthOption("inline-depth", llvm::cl::desc("Maximum nesting of inlined calls"), llvm::cl::value_desc("n"), llvm::cl::init(2));
+llvm::cl::opt<std::string> ResidualOption("residual-cache", llvm::cl::desc("Specialize the program to the known inputs on stdin and cache the residual program in <dir>"), llvm::cl::value_desc("dir"));
+llvm::cl::opt<long long> ResidualKnownOption("residual-known", llvm::cl::desc("With --residual-cache, only the first <n> values on stdin are known; later GET calls stay in the residual program (default: all)"), llvm::cl::value_desc("n"), llvm::cl::init(-1));
+llvm::cl::opt<std::string> RecordOption("record", llvm::cl::desc("Log every GET, MALLOC and PRINT with step counts and timestamps to <file>"), llvm::cl::value_desc("file"));
+llvm::cl::opt<std::string> ReplayOption("replay", llvm::cl::desc("Take the inputs from a --record log instead of stdin and check MALLOC and PRINT against it (exit 3 on divergence)"), llvm::cl::value_desc("file"));
+llvm::cl::opt<std::string> CheckpointOption("checkpoint", llvm::cl::desc("Periodically save the guest state at a loop of main to <file>"), llvm::cl::value_desc("file"));
+llvm::cl::opt<unsigned long long> CheckpointStepsOption("checkpoint-steps", llvm::cl::desc("Loop iterations and calls between two checkpoints"), llvm::cl::value_desc("n"), llvm::cl::init(100000000));
+llvm::cl::opt<std::string> ResumeOption("resume", llvm::cl::desc("Continue from a checkpoint of the same program, skipping the inputs it had already read"), llvm::cl::value_desc("file"));
+llvm::cl::opt<std::string> StatsOption("stats", llvm::cl::desc("Write interpretation statistics as JSON to <file>"), llvm::cl::value_desc("file"));
+llvm::cl::opt<unsigned> SessionStackOption("session-stack", llvm::cl::desc("Stack size of each session in MiB"), llvm::cl::init(8));
+std::string readFileContent(std::string);
+int runSessions(const InterpreterOptions &);
+int runSpecialized(const std::string &, const InterpreterOptions &);
+int runLogged(const std::string &, InterpreterOptions);
+
+int main(int argc, char *argv[])
+{
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Clang AST Interpreter for tiny C.\n");
+
+    InterpreterOptions options;
+    options.profileFile = ProfileOption;
+    options.profileHz = ProfileHzOption;
+    options.maxSteps = MaxStepsOption;
+    options.timeoutMs = TimeoutOption;
+    options.parallelLoops = ParallelLoopsOption;
+    options.parallelCalls = ParallelCallsOption;
+    options.traceThreshold = TraceThresholdOption;
+    options.inlineSize = InlineSizeOption;
+    options.inlineDepth = InlineDepthOption;
+    options.checkpointFile = CheckpointOption;
+    options.checkpointSteps = CheckpointStepsOption;
+
+    // 调试信息随选项传入解释器，而不是修改全局状态
+    if (StdErrOption) options.log = &llvm::errs();
+
+    if (!SessionOption.empty())
+        return runSessions(options);
+
+    if (InputFilename.empty()) {
+        llvm::errs() << "[Error] Missing required C source file parameter.\n";
+        llvm::cl::PrintHelpMessage(false, true);
+        return 1;
+    }
+
+    // 获取必需参数的值
+    std::string inputFile = InputFilename;
+    // 获取可选参数的值
+    bool useFile = FileOption;
+
+    std::string sourceCode;
+    // 判断直接传入源代码字符串还是从源代码文件读取
+    if (!useFile) sourceCode = inputFile;
+    else {
+        sourceCode = readFileContent(inputFile);
+        if(sourceCode.empty()) return 1;
+    }
+
+    // 恢复的执行只输出检查点之后的部分，接在原来的输出的前 outputs 个值之后
+    Checkpoint checkpoint;
+    if (!ResumeOption.empty()) {
+        auto buffer = llvm::MemoryBuffer::getFile(ResumeOption);
+        if (!buffer || !checkpoint.load((*buffer)->getBuffer())) {
+            llvm::errs() << "[Error] Fail to read checkpoint: " << ResumeOption << ".\n";
+            return 1;
+        }
+        if (checkpoint.source != Checkpoint::fingerprint(sourceCode)) {
+            llvm::errs() << "[Error] The checkpoint " << ResumeOption << " was saved from a different program.\n";
+            return 1;
+        }
+        options.resume = &checkpoint;
+        if (options.log)
+            *options.log << "[Checkpoint] Resuming after " << checkpoint.inputs << " inputs and " << checkpoint.outputs
+                         << " outputs.\n";
+    }
+
+    bool exhausted = false;
+    options.exhausted = &exhausted;
+    options.statsFile = StatsOption;
+    if (!RecordOption.empty() || !ReplayOption.empty()) {
+        int status = runLogged(sourceCode, options);
+        if (status != 0) return status;
+        return exhausted ? 2 : 0;
+    }
+    if (!ResidualOption.empty()) {
+        if (runSpecialized(sourceCode, options) != 0) return 1;
+        return exhausted ? 2 : 0;
+    }
+    // 解析或静态检查失败时，错误已经由 Clang 的诊断输出
+    if (!interpret(sourceCode, options)) return 1;
+    return exhausted ? 2 : 0;
+}
+
+/// 本地的会话驱动：每个 --session 从文件读取源码和输入，
+/// 会话等待输入时每次只推送一个值，模拟输入异步到达
+int runSessions(const InterpreterOptions &options)
+{
+    Scheduler scheduler(options, SliceOption, (size_t)SessionStackOption << 20);
+    std::vector<std::string> names;
+    std::vector<std::deque<int64_t>> inputs;
+
+    for (const std::string &spec : SessionOption)
+    {
+        llvm::StringRef source, inputFile;
+        std::tie(source, inputFile) = llvm::StringRef(spec).split(':');
+
+        std::string sourceCode = readFileContent(source.str());
+        if (sourceCode.empty()) return 1;
+
+        std::deque<int64_t> values;
+        if (!inputFile.empty()) {
+            std::string content = readFileContent(inputFile.str());
+            llvm::StringRef rest(content), token;
+            while (true)
+            {
+                std::tie(token, rest) = llvm::getToken(rest, " \t\r\n");
+                if (token.empty()) break;
+                int64_t val;
+                if (!token.getAsInteger(10, val)) values.push_back(val);
+            }
+        }
+        scheduler.spawn(sourceCode);
+        names.push_back(source.str());
+        inputs.push_back(values);
+    }
+
+    scheduler.run([&inputs](Session &session) {
+        std::deque<int64_t> &pending = inputs[session.getId()];
+        if (pending.empty()) {
+            session.close();
+            return;
+        }
+        session.push(pending.front());
+        pending.pop_front();
+    });
+
+    int status = 0;
+    for (auto &session : scheduler.sessions())
+    {
+        llvm::outs() << "== session " << session->getId() << ": " << names[session->getId()] << " ==\n"
+                     << session->getOutput() << "\n";
+        if (session->isExhausted()) status = 2;
+    }
+    if (options.log)
+        *options.log << "[Scheduler] " << scheduler.sessions().size() << " sessions, "
+                     << scheduler.switches() << " context switches.\n";
+    return status;
+}
+
+/// 与 GuestIO 的 scanf 一致：读到第一个不是整数的记号为止
+int runSpecialized(const std::string &sourceCode, const InterpreterOptions &options)
+{
+    auto buffer = llvm::MemoryBuffer::getSTDIN();
+    if (!buffer) {
+        llvm::errs() << "[Error] Fail to read stdin.\n";
+        return 1;
+    }
+    std::vector<int64_t> inputs;
+    llvm::StringRef rest = (*buffer)->getBuffer(), token;
+    while (true)
+    {
+        std::tie(token, rest) = llvm::getToken(rest, " \t\r\n");
+        int64_t val;
+        if (token.empty() || token.getAsInteger(10, val)) break;
+        inputs.push_back(val);
+    }
+
+    bool hit = false;
+    size_t known = ResidualKnownOption < 0 ? AllInputs : (size_t)ResidualKnownOption;
+    if (!interpretSpecialized(sourceCode, inputs, known, ResidualOption, options, hit)) return 1;
+    if (options.log)
+        *options.log << "[Residual] " << (hit ? "hit" : "miss") << " in " << ResidualOption << " for "
+                     << inputs.size() << " inputs.\n";
+    return 0;
+}
+
+/// --record 在标准输入输出之上记录；--replay 不读取标准输入，输入全部来自日志
+/// 预算耗尽的执行也会记录，回放时预算需要与录制时相同
+int runLogged(const std::string &sourceCode, InterpreterOptions options)
+{
+    if (!RecordOption.empty() && (!ReplayOption.empty() || !ResidualOption.empty())) {
+        llvm::errs() << "[Error] --record cannot be combined with --replay or --residual-cache.\n";
+        return 1;
+    }
+    GuestIO stdIO;
+    if (!RecordOption.empty()) {
+        IORecorder recorder(&stdIO);
+        options.io = &recorder;
+        if (!interpret(sourceCode, options)) return 1;
+        if (!recorder.save(RecordOption)) {
+            llvm::errs() << "[Error] Fail to write I/O log: " << RecordOption << ".\n";
+            return 1;
+        }
+        if (options.log)
+            *options.log << "[Record] " << recorder.events() << " events written to " << RecordOption << ".\n";
+        return 0;
+    }
+
+    if (!ResidualOption.empty()) {
+        llvm::errs() << "[Error] --replay cannot be combined with --residual-cache.\n";
+        return 1;
+    }
+    auto log = llvm::MemoryBuffer::getFile(ReplayOption);
+    IOReplayer replayer(&stdIO);
+    if (!log || !replayer.load((*log)->getBuffer())) {
+        llvm::errs() << "[Error] Fail to read I/O log: " << ReplayOption << ".\n";
+        return 1;
+    }
+    options.io = &replayer;
+    if (!interpret(sourceCode, options)) return 1;
+    llvm::outs().flush();
+    replayer.report(llvm::errs());
+    return replayer.diverged() ? 3 : 0;
+}
+
+std::string readFileContent(std::string filePath) 
+{
+    llvm::StringRef InputFilename(filePath);
+    std::string FileContent;
+    // 打开输入文件
+    auto FileOrErr = llvm::MemoryBuffer::getFile(InputFilename);
+    if (FileOrErr) {
+        auto File = std::move(FileOrErr.get());
+
+        // 将文件内容保存到 std::string
+        FileContent = File->getBuffer().str();
+    } else {
+        llvm::errs() << "[Error] Fail to read file: " << InputFilename << ".\n";
+    }
+    return FileContent;
+}
\ No newline at end of file
@@ -0,0 +1,345 @@
+#include "Parallel.h"
+#include "Environment.h"
+
+#include "clang/AST/ASTContext.h"
+
+bool ParallelLoop::independent(const std::vector<int64_t> &bases, int64_t start, int64_t end) const
+{
+    for (unsigned i = 0; i < accesses.size(); ++i)
+    {
+        if (!accesses[i].write) continue;
+        int64_t lo = bases[i] + start * accesses[i].size;
+        int64_t hi = bases[i] + end * accesses[i].size;
+        for (unsigned j = 0; j < accesses.size(); ++j)
+        {
+            if (i == j) continue;
+            // 同一基址、同样大小的元素：每次迭代只访问属于自己的元素
+            if (bases[j] == bases[i] && accesses[j].size == accesses[i].size) continue;
+            int64_t otherLo = bases[j] + start * accesses[j].size;
+            int64_t otherHi = bases[j] + end * accesses[j].size;
+            if (lo < otherHi && otherLo < hi) return false;
+        }
+    }
+    return true;
+}
+
+bool LoopAnalyzer::analyze(ForStmt *forstmt, ParallelLoop &loop)
+{
+    if (!matchHeader(forstmt, loop)) return false;
+
+    mLocals.clear();
+    collectLocals(forstmt->getBody());
+    return checkBody(forstmt->getBody(), loop);
+}
+
+bool LoopAnalyzer::matchHeader(ForStmt *forstmt, ParallelLoop &loop)
+{
+    if (forstmt->getCond() == nullptr || forstmt->getInc() == nullptr) return false;
+
+    mInduction = matchInit(forstmt->getInit());
+    if (mInduction == nullptr) return false;
+    loop.induction = mInduction;
+
+    return matchCond(forstmt->getCond(), loop) && matchInc(forstmt->getInc());
+}
+
+/// i = e 或 int i = e，i 为当前函数的整数局部变量
+VarDecl *LoopAnalyzer::matchInit(Stmt *init)
+{
+    VarDecl *var = nullptr;
+    if (DeclStmt *declstmt = dyn_cast_or_null<DeclStmt>(init)) {
+        if (declstmt->isSingleDecl()) var = dyn_cast<VarDecl>(declstmt->getSingleDecl());
+    } else if (BinaryOperator *bop = dyn_cast_or_null<BinaryOperator>(init)) {
+        if (bop->getOpcode() != BO_Assign) return nullptr;
+        if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(bop->getLHS()->IgnoreParens()))
+            var = dyn_cast<VarDecl>(declref->getDecl());
+    }
+    // 取了地址的归纳变量可能经由指针被修改
+    if (var == nullptr || !var->getType()->isIntegerType() || !mInfo.hasSlot(var) || mInfo.isEscaping(var)) return nullptr;
+    return var;
+}
+
+/// i < bound 或 i <= bound，bound 在循环中不变
+bool LoopAnalyzer::matchCond(Expr *cond, ParallelLoop &loop)
+{
+    BinaryOperator *bop = dyn_cast<BinaryOperator>(cond->IgnoreParens());
+    if (bop == nullptr || (bop->getOpcode() != BO_LT && bop->getOpcode() != BO_LE)) return false;
+    if (!isInduction(bop->getLHS()) || !isInvariant(bop->getRHS())) return false;
+    loop.bound = bop->getRHS();
+    loop.inclusive = bop->getOpcode() == BO_LE;
+    return true;
+}
+
+/// i++、++i 或 i += 1
+bool LoopAnalyzer::matchInc(Expr *inc)
+{
+    inc = inc->IgnoreParens();
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(inc))
+        return uop->isIncrementOp() && isInduction(uop->getSubExpr());
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(inc)) {
+        llvm::APSInt step;
+        return bop->getOpcode() == BO_AddAssign && isInduction(bop->getLHS()) &&
+               bop->getRHS()->isIntegerConstantExpr(step, context) && step == 1;
+    }
+    return false;
+}
+
+bool LoopAnalyzer::isInduction(Expr *expr) const
+{
+    DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr->IgnoreParenImpCasts());
+    return declref && declref->getDecl() == mInduction;
+}
+
+/// 循环体不写循环外的标量，因此只由常量和非归纳变量组成的无副作用表达式是循环不变的
+bool LoopAnalyzer::isInvariant(Expr *expr)
+{
+    llvm::APSInt result;
+    if (expr->isIntegerConstantExpr(result, context)) return true;
+
+    expr = expr->IgnoreParenImpCasts();
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr))
+        return isa<VarDecl>(declref->getDecl()) && declref->getDecl() != mInduction;
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr))
+        return !bop->isAssignmentOp() && isInvariant(bop->getLHS()) && isInvariant(bop->getRHS());
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+        return !uop->isIncrementDecrementOp() && uop->getOpcode() != UO_Deref && isInvariant(uop->getSubExpr());
+    if (CastExpr *castexpr = dyn_cast<CastExpr>(expr))
+        return isInvariant(castexpr->getSubExpr());
+    return false;
+}
+
+void LoopAnalyzer::collectLocals(Stmt *stmt)
+{
+    if (stmt == nullptr) return;
+    if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt)) {
+        for (auto *SubDecl : declstmt->decls())
+            if (VarDecl *vardecl = dyn_cast_or_null<VarDecl>(SubDecl)) mLocals.insert(vardecl);
+    }
+    for (auto *SubStmt : stmt->children())
+        collectLocals(SubStmt);
+}
+
+bool LoopAnalyzer::checkBody(Stmt *stmt, ParallelLoop &loop)
+{
+    if (stmt == nullptr) return true;
+
+    if (isa<CallExpr>(stmt) || isa<ReturnStmt>(stmt) || isa<BreakStmt>(stmt)) return false;
+    // 成员访问的地址不是 a[i] 的形式，无法证明与其他迭代的写入不重叠
+    if (isa<MemberExpr>(stmt)) return false;
+
+    if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt)) {
+        // 循环体内的数组放在工作线程私有的栈帧中，地址不能逃逸到循环之外
+        for (auto *SubDecl : declstmt->decls())
+        {
+            VarDecl *vardecl = dyn_cast_or_null<VarDecl>(SubDecl);
+            if (vardecl == nullptr) continue;
+            if (mInfo.isEscaping(vardecl)) return false;
+            if (vardecl->hasInit() && !checkBody(vardecl->getInit(), loop)) return false;
+        }
+        return true;
+    }
+
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(stmt)) {
+        if (bop->isAssignmentOp())
+            return checkTarget(bop->getLHS(), loop) && checkBody(bop->getRHS(), loop);
+    }
+    else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(stmt)) {
+        if (uop->isIncrementDecrementOp()) return checkTarget(uop->getSubExpr(), loop);
+        // 解引用可能访问任意内存
+        if (uop->getOpcode() == UO_Deref) return false;
+    }
+    else if (ArraySubscriptExpr *arraysub = dyn_cast<ArraySubscriptExpr>(stmt)) {
+        return checkAccess(arraysub, false, loop);
+    }
+
+    for (auto *SubStmt : stmt->children())
+        if (!checkBody(SubStmt, loop)) return false;
+    return true;
+}
+
+/// 被写入的只能是循环体内的局部变量或者 a[i]
+bool LoopAnalyzer::checkTarget(Expr *expr, ParallelLoop &loop)
+{
+    expr = expr->IgnoreParens();
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+        VarDecl *vardecl = dyn_cast<VarDecl>(declref->getDecl());
+        return vardecl && mLocals.count(vardecl);
+    }
+    if (ArraySubscriptExpr *arraysub = dyn_cast<ArraySubscriptExpr>(expr))
+        return checkAccess(arraysub, true, loop);
+    return false;
+}
+
+bool LoopAnalyzer::checkAccess(ArraySubscriptExpr *arraysub, bool write, ParallelLoop &loop)
+{
+    DeclRefExpr *base = dyn_cast<DeclRefExpr>(arraysub->getBase()->IgnoreParenImpCasts());
+    VarDecl *vardecl = base ? dyn_cast<VarDecl>(base->getDecl()) : nullptr;
+    if (vardecl == nullptr) return false;
+
+    if (mLocals.count(vardecl)) {
+        // 循环体内的数组每次迭代私有，下标不受限制
+        if (vardecl->getType()->isArrayType()) return checkBody(arraysub->getIdx(), loop);
+        // 循环体内的指针每次迭代可能指向不同位置，进入循环前也无法取得其基址
+        return false;
+    }
+
+    if (!isInduction(arraysub->getIdx())) return false;
+    ParallelLoop::Access access;
+    access.base = vardecl;
+    access.size = context.getTypeSizeInChars(arraysub->getType()).getQuantity();
+    access.write = write;
+    loop.accesses.push_back(access);
+    return true;
+}
+
+void PurityAnalyzer::analyze(FunctionDecl *entry)
+{
+    std::vector<FunctionDecl *> worklist;
+    llvm::DenseSet<const FunctionDecl *> visited;
+    worklist.push_back(entry);
+    visited.insert(entry);
+    while (!worklist.empty())
+    {
+        FunctionDecl *fdecl = worklist.back();
+        worklist.pop_back();
+        mFunctions.push_back(fdecl);
+        collect(fdecl->getBody(), worklist, visited);
+    }
+
+    for (FunctionDecl *fdecl : mFunctions)
+    {
+        mPure.insert(fdecl);
+        if (hasWork(fdecl->getBody())) mHeavy.insert(fdecl);
+    }
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (FunctionDecl *fdecl : mFunctions)
+        {
+            if (mPure.count(fdecl) && !checkBody(fdecl->getBody())) {
+                mPure.erase(fdecl);
+                changed = true;
+            }
+        }
+    }
+}
+
+std::vector<FunctionDecl *> PurityAnalyzer::getPureFunctions() const
+{
+    std::vector<FunctionDecl *> functions;
+    for (FunctionDecl *fdecl : mFunctions)
+        if (mPure.count(fdecl)) functions.push_back(fdecl);
+    return functions;
+}
+
+bool PurityAnalyzer::isPure(const FunctionDecl *fdecl) const
+{
+    if (fdecl->isDefined()) fdecl = fdecl->getDefinition();
+    return mPure.count(fdecl) != 0;
+}
+
+bool PurityAnalyzer::matchForkJoin(BinaryOperator *bop, ForkJoin &fork) const
+{
+    // && 和 || 的右操作数不一定求值
+    if (bop->isAssignmentOp() || bop->isLogicalOp() || bop->getOpcode() == BO_Comma) return false;
+
+    CallExpr *left = dyn_cast<CallExpr>(bop->getLHS());
+    CallExpr *right = dyn_cast<CallExpr>(bop->getRHS());
+    if (left == nullptr || right == nullptr || !isPureExpr(left) || !isPureExpr(right)) return false;
+
+    const FunctionDecl *leftCallee = left->getDirectCallee()->getDefinition();
+    const FunctionDecl *rightCallee = right->getDirectCallee()->getDefinition();
+    if (!mHeavy.count(leftCallee) && !mHeavy.count(rightCallee)) return false;
+
+    fork.local = left;
+    fork.spawned = right;
+    return true;
+}
+
+void PurityAnalyzer::collect(Stmt *stmt, std::vector<FunctionDecl *> &worklist,
+                             llvm::DenseSet<const FunctionDecl *> &visited)
+{
+    if (stmt == nullptr) return;
+    if (CallExpr *call = dyn_cast<CallExpr>(stmt)) {
+        FunctionDecl *callee = call->getDirectCallee();
+        if (callee && !mEnv.isBuildIn(callee) && callee->isDefined()) {
+            FunctionDecl *definition = callee->getDefinition();
+            if (visited.insert(definition).second) worklist.push_back(definition);
+        }
+    }
+    for (auto *SubStmt : stmt->children())
+        collect(SubStmt, worklist, visited);
+}
+
+/// 只写局部变量，只调用纯函数
+bool PurityAnalyzer::checkBody(Stmt *stmt) const
+{
+    if (stmt == nullptr) return true;
+
+    if (CallExpr *call = dyn_cast<CallExpr>(stmt)) {
+        FunctionDecl *callee = call->getDirectCallee();
+        if (callee == nullptr || mEnv.isBuildIn(callee) || !isPure(callee)) return false;
+    }
+    else if (BinaryOperator *bop = dyn_cast<BinaryOperator>(stmt)) {
+        if (bop->isAssignmentOp() && !isLocal(bop->getLHS())) return false;
+    }
+    else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(stmt)) {
+        if (uop->isIncrementDecrementOp() && !isLocal(uop->getSubExpr())) return false;
+    }
+
+    for (auto *SubStmt : stmt->children())
+        if (!checkBody(SubStmt)) return false;
+    return true;
+}
+
+/// 实参在工作线程中求值，写入的是调用者栈帧的副本，因此不能有任何赋值
+bool PurityAnalyzer::isPureExpr(Stmt *stmt) const
+{
+    if (stmt == nullptr) return true;
+
+    if (CallExpr *call = dyn_cast<CallExpr>(stmt)) {
+        FunctionDecl *callee = call->getDirectCallee();
+        if (callee == nullptr || mEnv.isBuildIn(callee) || !isPure(callee)) return false;
+    }
+    else if (BinaryOperator *bop = dyn_cast<BinaryOperator>(stmt)) {
+        if (bop->isAssignmentOp()) return false;
+    }
+    else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(stmt)) {
+        if (uop->isIncrementDecrementOp()) return false;
+    }
+
+    for (auto *SubStmt : stmt->children())
+        if (!isPureExpr(SubStmt)) return false;
+    return true;
+}
+
+/// 局部变量，或者局部数组、结构体中的元素；经由指针的访问可能写到调用者的内存
+bool PurityAnalyzer::isLocal(Expr *expr) const
+{
+    expr = expr->IgnoreParens();
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+        VarDecl *vardecl = dyn_cast<VarDecl>(declref->getDecl());
+        return vardecl && !vardecl->hasGlobalStorage();
+    }
+    if (ArraySubscriptExpr *arraysub = dyn_cast<ArraySubscriptExpr>(expr)) {
+        Expr *base = arraysub->getBase()->IgnoreParenImpCasts();
+        return base->getType()->isArrayType() && isLocal(base);
+    }
+    if (MemberExpr *member = dyn_cast<MemberExpr>(expr))
+        return !member->isArrow() && isLocal(member->getBase());
+    return false;
+}
+
+bool PurityAnalyzer::hasWork(Stmt *stmt) const
+{
+    if (stmt == nullptr) return false;
+    if (isa<ForStmt>(stmt) || isa<WhileStmt>(stmt) || isa<DoStmt>(stmt)) return true;
+    if (CallExpr *call = dyn_cast<CallExpr>(stmt)) {
+        FunctionDecl *callee = call->getDirectCallee();
+        if (callee && !mEnv.isBuildIn(callee)) return true;
+    }
+    for (auto *SubStmt : stmt->children())
+        if (hasWork(SubStmt)) return true;
+    return false;
+}
@@ -0,0 +1,104 @@
+//==--- Parallel.h - Independence analysis of array loops and pure calls ---===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseSet.h"
+
+using namespace clang;
+
+class Environment;
+class FunctionInfo;
+
+/// 迭代之间相互独立、可以切分到多个线程执行的 for 循环：
+/// for (i = start; i < bound; ++i) body，body 只通过 a[i] 访问循环外的内存
+struct ParallelLoop
+{
+    /// 循环体中以归纳变量为下标的数组访问
+    struct Access
+    {
+        VarDecl *base;
+        unsigned size; // 元素大小
+        bool write;
+    };
+
+    VarDecl *induction;
+    Expr *bound;
+    bool inclusive; // i <= bound
+    std::vector<Access> accesses;
+
+    /// 执行前检查：bases 为各访问基址的运行时值。
+    /// 写入的区间与其他基址的区间只能完全相同（同一元素）或互不重叠
+    bool independent(const std::vector<int64_t> &bases, int64_t start, int64_t end) const;
+};
+
+/// 证明 ForStmt 的迭代相互独立：
+/// 规范的归纳变量、循环不变的上界，循环体中没有调用（包括内建的输入输出）、
+/// 没有 return / break、不写循环外的标量，数组访问的下标只能是归纳变量本身
+class LoopAnalyzer
+{
+  public:
+    LoopAnalyzer(const ASTContext &context, const FunctionInfo &info)
+        : context(context), mInfo(info), mInduction(nullptr), mLocals(){}
+
+    bool analyze(ForStmt *, ParallelLoop &);
+
+    /// 只匹配循环头 for (i = e; i < bound; ++i)，填充 induction、bound 和 inclusive
+    bool matchHeader(ForStmt *, ParallelLoop &);
+    /// 以下两个判断在 matchHeader 成功后使用
+    bool isInduction(Expr *) const;
+    bool isInvariant(Expr *);
+
+  private:
+    VarDecl *matchInit(Stmt *);
+    bool matchCond(Expr *, ParallelLoop &);
+    bool matchInc(Expr *);
+    void collectLocals(Stmt *);
+    bool checkBody(Stmt *, ParallelLoop &);
+    bool checkTarget(Expr *, ParallelLoop &);
+    bool checkAccess(ArraySubscriptExpr *, bool write, ParallelLoop &);
+
+    const ASTContext &context;
+    const FunctionInfo &mInfo;
+    VarDecl *mInduction;
+    llvm::DenseSet<const VarDecl *> mLocals; // 循环体内声明的变量，每次迭代私有
+};
+
+/// 两个操作数都是纯函数调用的二元运算：spawned 交给线程池，local 在当前线程求值，汇合后再计算运算结果
+struct ForkJoin
+{
+    CallExpr *spawned;
+    CallExpr *local;
+};
+
+/// 纯函数分析：函数及其调用的函数不写全局变量、不经由指针写内存、不调用内建函数（输入输出和堆），
+/// 只写自己栈帧中的局部变量。两个纯函数调用之间没有依赖，可以并发求值
+class PurityAnalyzer
+{
+  public:
+    explicit PurityAnalyzer(const Environment &env) : mEnv(env), mFunctions(), mPure(), mHeavy(){}
+
+    /// 先假设从 entry 可达的函数都是纯函数，反复剔除不满足条件的函数直到不再变化，
+    /// 因此递归的纯函数仍然是纯函数
+    void analyze(FunctionDecl *entry);
+    std::vector<FunctionDecl *> getPureFunctions() const;
+    bool isPure(const FunctionDecl *) const;
+    /// 运算的两个操作数都是纯函数调用，实参没有副作用；
+    /// 粒度估计：至少一个被调函数含有循环或调用，否则分叉的开销大于收益
+    bool matchForkJoin(BinaryOperator *, ForkJoin &) const;
+
+  private:
+    void collect(Stmt *, std::vector<FunctionDecl *> &worklist, llvm::DenseSet<const FunctionDecl *> &visited);
+    bool checkBody(Stmt *) const;
+    bool isPureExpr(Stmt *) const;
+    bool isLocal(Expr *) const;
+    bool hasWork(Stmt *) const;
+
+    const Environment &mEnv;
+    std::vector<FunctionDecl *> mFunctions; // 从入口可达的函数定义
+    llvm::DenseSet<const FunctionDecl *> mPure;
+    llvm::DenseSet<const FunctionDecl *> mHeavy;
+};
@@ -0,0 +1,371 @@
+#include "Prepare.h"
+#include "Environment.h"
+
+#include "clang/AST/RecordLayout.h"
+
+void Preparer::prepareFunction()
+{
+    FunctionDecl *fdecl = mInfo.mDecl;
+    mChain.push_back(fdecl);
+    // 参数占据最前面的槽位，调用时按下标绑定实参
+    for (unsigned i = 0; i < fdecl->getNumParams(); ++i)
+        addSlot(fdecl->getParamDecl(i));
+    walk(fdecl->getBody());
+
+    std::vector<Stmt *> parents;
+    findEscapes(fdecl->getBody(), parents);
+    findMemoryBacked();
+    layoutFrame();
+    findLoops(fdecl->getBody());
+}
+
+void Preparer::prepareGlobals(TranslationUnitDecl *unit, const llvm::DenseSet<const VarDecl *> &addressTaken)
+{
+    for (auto *SubDecl : unit->decls())
+    {
+        if (VarDecl *vardecl = dyn_cast<VarDecl>(SubDecl)) {
+            // 同一全局变量的重复声明共用规范声明的槽位
+            addSlot(vardecl->getCanonicalDecl());
+            if (vardecl->hasInit()) walk(vardecl->getInit());
+        }
+    }
+
+    // 只有可达代码中取了地址的全局变量需要放在内存中，由 Verifier 在检查时收集，这里不再扫描函数体
+    for (const VarDecl *vardecl : addressTaken)
+        mInfo.mEscaping.insert(vardecl->getCanonicalDecl());
+    findMemoryBacked();
+}
+
+void Preparer::addSlot(VarDecl *vardecl)
+{
+    if (mInfo.mSlots.count(vardecl)) return;
+    mInfo.mSlots[vardecl] = mInfo.mVars.size();
+    mInfo.mVars.push_back(vardecl);
+}
+
+void Preparer::walk(Stmt *stmt)
+{
+    if (stmt == nullptr) return;
+
+    if (Expr *expr = dyn_cast<Expr>(stmt)) {
+        // 折叠整数常量表达式（字面量、sizeof 以及它们之间的运算），执行时不再访问其子结点
+        QualType type = expr->getType();
+        llvm::APSInt result;
+        if ((type->isIntegerType() || type->isCharType()) && expr->isIntegerConstantExpr(result, context)) {
+            mInfo.mConstants[expr] = result.getExtValue();
+            return;
+        }
+    }
+
+    if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt)) {
+        for (auto *SubDecl : declstmt->decls())
+        {
+            if (VarDecl *vardecl = dyn_cast_or_null<VarDecl>(SubDecl)) {
+                addSlot(vardecl);
+                if (vardecl->hasInit()) walk(vardecl->getInit());
+            }
+        }
+        return;
+    }
+
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(stmt)) {
+        // 区分局部变量和全局变量，执行时只需一次下标访问
+        if (VarDecl *vardecl = dyn_cast<VarDecl>(declref->getDecl())) {
+            FunctionInfo::VarRef &ref = mInfo.mRefs[declref];
+            ref.global = vardecl->hasGlobalStorage();
+            ref.slot = ref.global ? mEnv.getGlobalSlot(vardecl) : mInfo.getSlot(vardecl);
+            ref.memory = false; // 逃逸分析之后由 findMemoryBacked 确定
+        }
+        return;
+    }
+
+    if (isa<ArraySubscriptExpr>(stmt) || isa<MemberExpr>(stmt)) {
+        // 执行时只访问访问链的起点和各级下标
+        AccessPath &path = mInfo.mPaths[cast<Expr>(stmt)];
+        buildPath(cast<Expr>(stmt), path);
+        walk(path.base);
+        for (auto &index : path.indices)
+            walk(index.first);
+        return;
+    }
+
+    if (SwitchStmt *switchstmt = dyn_cast<SwitchStmt>(stmt))
+        buildSwitch(switchstmt, mInfo.mSwitches[switchstmt]);
+
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(stmt)) {
+        // 只有开启 --parallel-calls 时才有纯函数分析的结果
+        ForkJoin fork;
+        const PurityAnalyzer *purity = mEnv.getPurity();
+        if (purity && purity->matchForkJoin(bop, fork)) mInfo.mForkJoins[bop] = fork;
+    }
+
+    if (CallExpr *call = dyn_cast<CallExpr>(stmt)) {
+        // 解析调用点：区分内建函数，并定位到函数定义
+        if (FunctionDecl *callee = call->getDirectCallee()) {
+            FunctionInfo::CallTarget target;
+            target.builtin = mEnv.isBuildIn(callee);
+            target.callee = callee->isDefined() ? callee->getDefinition() : callee;
+            target.inlined = !target.builtin && shouldInline(target.callee);
+            mInfo.mCallees[call] = target;
+            if (target.inlined) inlineBody(target.callee);
+        }
+    }
+
+    for (auto *SubStmt : stmt->children())
+        walk(SubStmt);
+}
+
+/// 从最外层的下标或成员访问向内合并整条访问链，
+/// 直到遇到指针值（指针变量、p->x 的 p）或者数组、结构体变量本身
+void Preparer::buildPath(Expr *expr, AccessPath &path)
+{
+    path.offset = 0;
+    while (true)
+    {
+        if (ArraySubscriptExpr *arraysub = dyn_cast<ArraySubscriptExpr>(expr)) {
+            int64_t stride = elementSize(arraysub->getType());
+            Expr *index = arraysub->getIdx();
+            llvm::APSInt result;
+            if ((index->getType()->isIntegerType() || index->getType()->isCharType()) &&
+                index->isIntegerConstantExpr(result, context))
+                path.offset += result.getExtValue() * stride;
+            else
+                path.indices.push_back(std::make_pair(index, stride));
+
+            // a[i][j]：基址是内层数组退化得到的指针，继续向内合并
+            Expr *base = arraysub->getBase()->IgnoreParens();
+            ImplicitCastExpr *decay = dyn_cast<ImplicitCastExpr>(base);
+            if (decay && decay->getCastKind() == CK_ArrayToPointerDecay) {
+                Expr *inner = decay->getSubExpr()->IgnoreParens();
+                if (isa<ArraySubscriptExpr>(inner) || isa<MemberExpr>(inner)) {
+                    expr = inner;
+                    continue;
+                }
+            }
+            path.base = arraysub->getBase();
+            return;
+        }
+
+        MemberExpr *member = cast<MemberExpr>(expr);
+        FieldDecl *field = cast<FieldDecl>(member->getMemberDecl());
+        const ASTRecordLayout &layout = context.getASTRecordLayout(field->getParent());
+        path.offset += context.toCharUnitsFromBits(layout.getFieldOffset(field->getFieldIndex())).getQuantity();
+
+        Expr *base = member->getBase()->IgnoreParens();
+        if (!member->isArrow() && (isa<ArraySubscriptExpr>(base) || isa<MemberExpr>(base))) {
+            expr = base;
+            continue;
+        }
+        // p->x 的基址是指针的值；s.x 的基址是结构体变量，其值为结构体的地址
+        path.base = member->getBase();
+        return;
+    }
+}
+
+/// case 值足够稠密时编译为跳转表，否则为有序数组
+void Preparer::buildSwitch(SwitchStmt *switchstmt, SwitchTable &table)
+{
+    Stmt *body = switchstmt->getBody();
+    if (CompoundStmt *compound = dyn_cast<CompoundStmt>(body))
+        table.stmts.assign(compound->body_begin(), compound->body_end());
+    else
+        table.stmts.push_back(body);
+
+    table.low = 0;
+    table.fallback = table.stmts.size();
+    for (unsigned i = 0; i < table.stmts.size(); ++i)
+    {
+        // case 1: case 2: stmt 是嵌套的 CaseStmt，都指向同一个下标
+        for (Stmt *stmt = table.stmts[i]; SwitchCase *label = dyn_cast<SwitchCase>(stmt); stmt = label->getSubStmt())
+        {
+            if (CaseStmt *casestmt = dyn_cast<CaseStmt>(label))
+                table.cases.push_back(std::make_pair(casestmt->getLHS()->EvaluateKnownConstInt(context).getExtValue(), i));
+            else
+                table.fallback = i;
+        }
+    }
+    std::sort(table.cases.begin(), table.cases.end());
+    if (table.cases.empty()) return;
+
+    // 至少四分之一的表项命中 case 时使用跳转表
+    table.low = table.cases.front().first;
+    uint64_t range = (uint64_t)table.cases.back().first - (uint64_t)table.low + 1;
+    if (range > 4 * table.cases.size() || range > MaxJumpTable) return;
+    table.table.assign(range, table.fallback);
+    for (auto &entry : table.cases)
+        table.table[entry.first - table.low] = entry.second;
+    table.cases.clear();
+}
+
+/// 与 Environment 中指针运算和数组分配一致：整数按 int 存放，数组和结构体按 ASTContext 的布局
+int64_t Preparer::elementSize(QualType type) const
+{
+    if (type->isCharType()) return sizeof(char);
+    if (type->isIntegerType()) return sizeof(int);
+    if (type->isPointerType()) return sizeof(void *);
+    return context.getTypeSizeInChars(type).getQuantity();
+}
+
+void Preparer::findEscapes(Stmt *stmt, std::vector<Stmt *> &parents)
+{
+    if (stmt == nullptr) return;
+
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(stmt)) {
+        // 全局变量的槽位以规范声明为键
+        VarDecl *vardecl = dyn_cast<VarDecl>(declref->getDecl());
+        if (vardecl) vardecl = vardecl->getCanonicalDecl();
+        if (vardecl && mInfo.hasSlot(vardecl) && escapes(declref, parents))
+            mInfo.mEscaping.insert(vardecl);
+        return;
+    }
+
+    parents.push_back(stmt);
+    for (auto *SubStmt : stmt->children())
+        findEscapes(SubStmt, parents);
+    parents.pop_back();
+}
+
+/// 不会逃逸的用法只有：标量的读写、沿 a[i][j].x 这样的下标和成员访问链读写其中的元素，
+/// 以及不求值的 sizeof 参数
+bool Preparer::escapes(DeclRefExpr *declref, const std::vector<Stmt *> &parents)
+{
+    Stmt *child = declref;
+    unsigned i = parents.size();
+    while (i > 0)
+    {
+        Stmt *parent = parents[i - 1];
+        if (isa<ParenExpr>(parent)) {
+            child = parents[--i];
+            continue;
+        }
+        // s.x 仍然在同一个对象之内；p->x 只是读取指针的值
+        if (MemberExpr *member = dyn_cast<MemberExpr>(parent)) {
+            if (member->isArrow()) return false;
+            child = parents[--i];
+            continue;
+        }
+        if (UnaryOperator *uop = dyn_cast<UnaryOperator>(parent))
+            return uop->getOpcode() == UO_AddrOf;
+        ImplicitCastExpr *decay = dyn_cast<ImplicitCastExpr>(parent);
+        if (decay == nullptr || decay->getCastKind() != CK_ArrayToPointerDecay) return false;
+
+        // 数组退化为指针后，只能直接作为下标运算的基址
+        child = parents[--i];
+        while (i > 0 && isa<ParenExpr>(parents[i - 1])) child = parents[--i];
+        if (i == 0) return true;
+        ArraySubscriptExpr *arraysub = dyn_cast<ArraySubscriptExpr>(parents[i - 1]);
+        if (arraysub == nullptr || arraysub->getBase() != child) return true;
+        child = parents[--i];
+    }
+    return false;
+}
+
+/// 取地址的标量需要放在内存中：槽位里存放其地址，读写都按类型经由这个地址
+/// 其余的标量仍然只占用槽位
+void Preparer::findMemoryBacked()
+{
+    for (VarDecl *vardecl : mInfo.mVars)
+    {
+        QualType type = vardecl->getType();
+        if (mInfo.isEscaping(vardecl) && !type->isArrayType() && !type->isRecordType())
+            mInfo.mMemoryBacked.insert(vardecl);
+    }
+    for (auto &entry : mInfo.mRefs)
+    {
+        const VarDecl *vardecl = cast<VarDecl>(entry.first->getDecl());
+        FunctionInfo::VarRef &ref = entry.second;
+        ref.memory = ref.global ? mEnv.isGlobalMemoryBacked(vardecl) : mInfo.isMemoryBacked(vardecl);
+    }
+}
+
+/// 为地址没有逃逸的局部数组和结构体，以及取地址的标量（包括参数）分配栈帧内联存储，按 8 字节对齐
+void Preparer::layoutFrame()
+{
+    for (VarDecl *vardecl : mInfo.mVars)
+    {
+        QualType type = vardecl->getType();
+        unsigned size = sizeof(int64_t);
+        if (!mInfo.isMemoryBacked(vardecl)) {
+            if (isa<ParmVarDecl>(vardecl) || mInfo.isEscaping(vardecl)) continue;
+            if (!isa<ConstantArrayType>(type.getTypePtr()) && !type->isRecordType()) continue;
+            size = context.getTypeSizeInChars(type).getQuantity();
+        }
+
+        mInfo.mFrameOffsets[vardecl] = mInfo.mFrameSize;
+        mInfo.mFrameSize += (size + 7) & ~7u;
+    }
+}
+
+void Preparer::findLoops(Stmt *stmt)
+{
+    if (stmt == nullptr) return;
+
+    if (ForStmt *forstmt = dyn_cast<ForStmt>(stmt)) {
+        ParallelLoop loop;
+        LoopAnalyzer analyzer(context, mInfo);
+        if (analyzer.analyze(forstmt, loop)) mInfo.mLoops[forstmt] = loop;
+
+        LoopIdiom idiom;
+        IdiomRecognizer recognizer(context, mInfo);
+        if (recognizer.recognize(forstmt, idiom)) mInfo.mIdioms[forstmt] = idiom;
+    }
+
+    for (auto *SubStmt : stmt->children())
+        findLoops(SubStmt);
+}
+
+/// 只在预处理函数时内联，展开的层数和函数体的大小由 --inline-depth 和 --inline-size 限制
+bool Preparer::shouldInline(FunctionDecl *callee)
+{
+    unsigned size = mEnv.getInlineSize();
+    if (size == 0 || mChain.empty() || mChain.size() > mEnv.getInlineDepth()) return false;
+    if (!callee->doesThisDeclarationHaveABody() || callee->isVariadic()) return false;
+    // 正在展开的函数（包括当前函数）不再展开，递归调用仍然压栈
+    if (std::find(mChain.begin(), mChain.end(), callee) != mChain.end()) return false;
+    return isInlinable(callee->getBody(), callee, false, size);
+}
+
+/// 可以内联的函数体：结点数不超过阈值，不直接调用自身，没有局部的数组和结构体，不取局部变量的地址，
+/// 并且 return 只出现在复合语句和 if 中，不需要异常就能结束函数体
+bool Preparer::isInlinable(Stmt *stmt, FunctionDecl *callee, bool nested, unsigned &size) const
+{
+    if (stmt == nullptr) return true;
+    if (size == 0) return false;
+    --size;
+
+    if (isa<ReturnStmt>(stmt) && nested) return false;
+    if (CallExpr *call = dyn_cast<CallExpr>(stmt)) {
+        FunctionDecl *target = call->getDirectCallee();
+        if (target && target->isDefined() && target->getDefinition() == callee) return false;
+    }
+    if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt)) {
+        for (auto *SubDecl : declstmt->decls())
+        {
+            VarDecl *vardecl = dyn_cast_or_null<VarDecl>(SubDecl);
+            if (vardecl && (vardecl->getType()->isArrayType() || vardecl->getType()->isRecordType())) return false;
+        }
+    }
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(stmt)) {
+        DeclRefExpr *declref = dyn_cast<DeclRefExpr>(uop->getSubExpr()->IgnoreParens());
+        VarDecl *vardecl = declref ? dyn_cast<VarDecl>(declref->getDecl()) : nullptr;
+        if (uop->getOpcode() == UO_AddrOf && vardecl && !vardecl->hasGlobalStorage()) return false;
+    }
+
+    nested = nested || !(isa<CompoundStmt>(stmt) || isa<IfStmt>(stmt));
+    for (auto *SubStmt : stmt->children())
+        if (!isInlinable(SubStmt, callee, nested, size)) return false;
+    return true;
+}
+
+/// 被调函数的参数和局部变量以各自的声明为键在当前函数中分配槽位，不会与调用方的变量冲突；
+/// 同一个函数的多个调用点共用这些槽位，因为被调函数不递归，它们的执行不会重叠
+void Preparer::inlineBody(FunctionDecl *callee)
+{
+    ++mInfo.mNumInlined;
+    if (!mInlinedBodies.insert(callee).second) return;
+    mChain.push_back(callee);
+    for (unsigned i = 0; i < callee->getNumParams(); ++i)
+        addSlot(callee->getParamDecl(i));
+    walk(callee->getBody());
+    mChain.pop_back();
+}
@@ -0,0 +1,224 @@
+//==--- Prepare.h - Lazy per-function preparation ---------------------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include "Idiom.h"
+#include "Parallel.h"
+
+using namespace clang;
+
+class Environment;
+
+/// 连续的下标和成员访问 a[i][j].x 在预处理时合并为一次地址计算：
+/// 起始地址 + Σ 下标 * 步长 + 常量偏移，执行时不再访问中间的结点
+struct AccessPath
+{
+    Expr *base; // 求值得到起始地址
+    llvm::SmallVector<std::pair<Expr *, int64_t>, 2> indices;
+    int64_t offset;
+};
+
+/// switch 的分派表：case 标号只能出现在 switch 体的顶层，
+/// 因此分派的结果是开始顺序执行的语句下标，之后的 case 自然贯穿
+struct SwitchTable
+{
+    std::vector<Stmt *> stmts; // switch 体顶层的语句
+    int64_t low;
+    std::vector<unsigned> table; // 稠密时为跳转表，下标为 值 - low
+    std::vector<std::pair<int64_t, unsigned>> cases; // 稀疏时按值排序，二分查找
+    unsigned fallback; // default 所在的下标，没有 default 时为 stmts.size()
+
+    unsigned lookup(int64_t val) const
+    {
+        if (!table.empty()) {
+            uint64_t index = (uint64_t)val - (uint64_t)low;
+            return index < table.size() ? table[index] : fallback;
+        }
+        auto iter = std::lower_bound(cases.begin(), cases.end(), std::make_pair(val, 0u),
+                                     [](const std::pair<int64_t, unsigned> &a, const std::pair<int64_t, unsigned> &b) {
+                                         return a.first < b.first;
+                                     });
+        return iter != cases.end() && iter->first == val ? iter->second : fallback;
+    }
+};
+
+/// 函数的预处理结果：局部变量槽位、调用点解析、常量折叠、逃逸分析，以及可以并行或批量执行的循环
+/// 只在函数第一次被调用时生成，并缓存在 Environment 中，
+/// 因此解释器的启动开销只与实际执行到的函数有关
+class FunctionInfo
+{
+  public:
+    /// 调用点解析的结果
+    struct CallTarget
+    {
+        FunctionDecl *callee; // 有定义时为定义所在的 FunctionDecl
+        bool builtin;
+        bool inlined; // 被调函数的变量在当前函数中分配了槽位，函数体在当前栈帧中执行
+    };
+
+    /// 变量引用解析出的存储位置：当前栈帧或全局变量中的槽位
+    struct VarRef
+    {
+        unsigned slot;
+        bool global;
+        bool memory; // 取地址的标量，槽位中存放其地址
+    };
+
+    /// decl 为空时表示全局作用域，槽位对应全局变量
+    explicit FunctionInfo(FunctionDecl *decl)
+        : mDecl(decl), mVars(), mSlots(), mCallees(), mConstants(), mEscaping(), mFrameOffsets(), mFrameSize(0), mLoops(), mIdioms(), mPaths(), mSwitches(), mRefs(), mMemoryBacked(), mForkJoins(), mNumInlined(0){}
+
+    FunctionDecl *getDecl() const { return mDecl; }
+
+    bool hasSlot(const Decl *decl) const { return mSlots.count(decl) != 0; }
+    unsigned getSlot(const Decl *decl) const
+    {
+        auto iter = mSlots.find(decl);
+        assert(iter != mSlots.end());
+        return iter->second;
+    }
+    /// 不存在时返回 -1
+    int findSlot(const Decl *decl) const
+    {
+        auto iter = mSlots.find(decl);
+        return iter == mSlots.end() ? -1 : (int)iter->second;
+    }
+    unsigned getNumSlots() const { return mVars.size(); }
+    /// 槽位编号到变量声明
+    VarDecl *getVar(unsigned slot) const { return mVars[slot]; }
+
+    const VarRef &getVarRef(const DeclRefExpr *declref) const
+    {
+        auto iter = mRefs.find(declref);
+        assert(iter != mRefs.end());
+        return iter->second;
+    }
+
+    const CallTarget *getCallTarget(const CallExpr *call) const
+    {
+        auto iter = mCallees.find(call);
+        return iter == mCallees.end() ? nullptr : &iter->second;
+    }
+
+    bool getConstant(const Expr *expr, int64_t &val) const
+    {
+        auto iter = mConstants.find(expr);
+        if (iter == mConstants.end()) return false;
+        val = iter->second;
+        return true;
+    }
+
+    /// 地址被取用、存储、传递或返回的局部变量
+    bool isEscaping(const VarDecl *var) const { return mEscaping.count(var) != 0; }
+    /// 地址被取用的标量，存放在内存中而不是槽位中
+    bool isMemoryBacked(const VarDecl *var) const { return mMemoryBacked.count(var) != 0; }
+    /// 地址没有逃逸的局部数组以及取地址的局部标量在栈帧内联存储中的偏移，返回 -1 表示需要在 Heap 上分配
+    int getFrameOffset(const VarDecl *var) const
+    {
+        auto iter = mFrameOffsets.find(var);
+        return iter == mFrameOffsets.end() ? -1 : (int)iter->second;
+    }
+    unsigned getFrameSize() const { return mFrameSize; }
+
+    /// 迭代相互独立的 for 循环，不可并行时返回空指针
+    const ParallelLoop *getParallelLoop(const ForStmt *forstmt) const
+    {
+        auto iter = mLoops.find(forstmt);
+        return iter == mLoops.end() ? nullptr : &iter->second;
+    }
+    /// 访问链最外层的下标或成员访问结点对应的地址计算
+    const AccessPath &getAccessPath(const Expr *expr) const
+    {
+        auto iter = mPaths.find(expr);
+        assert(iter != mPaths.end());
+        return iter->second;
+    }
+
+    const SwitchTable &getSwitchTable(const SwitchStmt *switchstmt) const
+    {
+        auto iter = mSwitches.find(switchstmt);
+        assert(iter != mSwitches.end());
+        return iter->second;
+    }
+
+    /// 可以交给 SIMD 内核执行的循环，否则返回空指针
+    const LoopIdiom *getLoopIdiom(const ForStmt *forstmt) const
+    {
+        auto iter = mIdioms.find(forstmt);
+        return iter == mIdioms.end() ? nullptr : &iter->second;
+    }
+
+    /// 内联展开的调用点数
+    unsigned getNumInlined() const { return mNumInlined; }
+
+    /// 两个操作数可以分叉求值的二元运算，否则返回空指针
+    const ForkJoin *getForkJoin(const BinaryOperator *bop) const
+    {
+        auto iter = mForkJoins.find(bop);
+        return iter == mForkJoins.end() ? nullptr : &iter->second;
+    }
+
+  private:
+    friend class Preparer;
+
+    FunctionDecl *mDecl;
+    std::vector<VarDecl *> mVars;
+    llvm::DenseMap<const Decl *, unsigned> mSlots;
+    llvm::DenseMap<const CallExpr *, CallTarget> mCallees;
+    llvm::DenseMap<const Expr *, int64_t> mConstants;
+    llvm::DenseSet<const VarDecl *> mEscaping;
+    llvm::DenseMap<const VarDecl *, unsigned> mFrameOffsets;
+    unsigned mFrameSize;
+    llvm::DenseMap<const ForStmt *, ParallelLoop> mLoops;
+    llvm::DenseMap<const ForStmt *, LoopIdiom> mIdioms;
+    llvm::DenseMap<const Expr *, AccessPath> mPaths;
+    llvm::DenseMap<const SwitchStmt *, SwitchTable> mSwitches;
+    llvm::DenseMap<const DeclRefExpr *, VarRef> mRefs;
+    llvm::DenseSet<const VarDecl *> mMemoryBacked;
+    llvm::DenseMap<const BinaryOperator *, ForkJoin> mForkJoins;
+    unsigned mNumInlined;
+};
+
+/// 遍历一个函数体（或全局变量的初始化表达式），填充 FunctionInfo
+class Preparer
+{
+  public:
+    Preparer(const ASTContext &context, const Environment &env, FunctionInfo &info)
+        : context(context), mEnv(env), mInfo(info), mChain(), mInlinedBodies(){}
+
+    void prepareFunction();
+    /// addressTaken 为可达代码中取了地址的全局变量
+    void prepareGlobals(TranslationUnitDecl *, const llvm::DenseSet<const VarDecl *> &addressTaken);
+
+  private:
+    static const uint64_t MaxJumpTable = 4096;
+
+    void addSlot(VarDecl *);
+    void walk(Stmt *);
+    void buildPath(Expr *, AccessPath &);
+    int64_t elementSize(QualType) const;
+    void buildSwitch(SwitchStmt *, SwitchTable &);
+    void findEscapes(Stmt *, std::vector<Stmt *> &parents);
+    bool escapes(DeclRefExpr *, const std::vector<Stmt *> &parents);
+    void findMemoryBacked();
+    void layoutFrame();
+    void findLoops(Stmt *);
+    bool shouldInline(FunctionDecl *callee);
+    bool isInlinable(Stmt *, FunctionDecl *callee, bool nested, unsigned &size) const;
+    void inlineBody(FunctionDecl *callee);
+
+    const ASTContext &context;
+    const Environment &mEnv;
+    FunctionInfo &mInfo;
+    std::vector<FunctionDecl *> mChain; // 正在展开的函数，第一个为当前函数
+    llvm::DenseSet<FunctionDecl *> mInlinedBodies; // 每个被调函数的函数体只遍历一次
+};
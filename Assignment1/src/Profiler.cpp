@@ -0,0 +1,122 @@
+#include "Profiler.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/time.h>
+
+Profiler *Profiler::sActive = nullptr;
+
+bool Profiler::start(unsigned hz)
+{
+    if (hz == 0 || sActive != nullptr) return false;
+    sActive = this;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &Profiler::handler;
+    // SA_RESTART 保证 GET 中的 scanf 不会因为采样信号返回 EINTR
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &mOldAction) != 0) {
+        sActive = nullptr;
+        return false;
+    }
+
+    struct itimerval timer;
+    long usec = 1000000 / hz;
+    timer.it_interval.tv_sec = usec / 1000000;
+    timer.it_interval.tv_usec = usec > 0 ? usec % 1000000 : 1;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+        sigaction(SIGPROF, &mOldAction, nullptr);
+        sActive = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void Profiler::stop()
+{
+    if (sActive != this) return;
+
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &mOldAction, nullptr);
+    sActive = nullptr;
+    drain();
+}
+
+void Profiler::handler(int)
+{
+    int savedErrno = errno;
+    if (Profiler *profiler = sActive) profiler->sample();
+    errno = savedErrno;
+}
+
+/// 运行在信号处理函数中：不分配内存，环形缓冲区满时直接丢弃
+void Profiler::sample()
+{
+    unsigned head = mHead.load(std::memory_order_relaxed);
+    if (head - mTail.load(std::memory_order_acquire) >= RingSize) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Sample &sample = mRing[head % RingSize];
+    sample.stmt = mCurrent.load(std::memory_order_relaxed);
+    sample.depth = mDepth.load(std::memory_order_acquire);
+    for (unsigned i = 0; i < sample.depth && i < MaxDepth; ++i)
+        sample.calls[i] = mCalls[i];
+    mHead.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::drain()
+{
+    unsigned head = mHead.load(std::memory_order_acquire);
+    unsigned tail = mTail.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail)
+    {
+        const Sample &sample = mRing[tail % RingSize];
+        std::vector<const Stmt *> key;
+        unsigned depth = sample.depth < MaxDepth ? sample.depth : MaxDepth;
+        key.reserve(depth + 2);
+        for (unsigned i = 0; i < depth; ++i) key.push_back(sample.calls[i]);
+        if (sample.depth > MaxDepth) key.push_back(nullptr);
+        key.push_back(sample.stmt);
+        ++mCounts[key];
+        ++mSamples;
+    }
+    mTail.store(tail, std::memory_order_release);
+}
+
+void Profiler::report(llvm::raw_ostream &out, const ASTContext &context, const FunctionDecl *entry)
+{
+    drain();
+    const SourceManager &sm = context.getSourceManager();
+    auto line = [&sm](const Stmt *stmt) -> unsigned {
+        return stmt ? sm.getPresumedLineNumber(stmt->getBeginLoc()) : 0;
+    };
+
+    for (auto &item : mCounts)
+    {
+        const std::vector<const Stmt *> &key = item.first;
+        // 每一帧的行号是该帧中正在执行的位置：调用者为调用点，最内层为当前 Stmt
+        std::string frame = entry ? entry->getName().str() : "main";
+        for (unsigned i = 0; i < key.size(); ++i)
+        {
+            const Stmt *stmt = key[i];
+            if (stmt == nullptr && i + 1 < key.size()) {
+                out << frame << ";...;";
+                frame = "?";
+                continue;
+            }
+            out << frame << ":" << line(stmt);
+            if (i + 1 == key.size()) break;
+            out << ";";
+            const CallExpr *call = dyn_cast_or_null<CallExpr>(stmt);
+            const FunctionDecl *callee = call ? call->getDirectCallee() : nullptr;
+            frame = callee ? callee->getName().str() : "?";
+        }
+        out << " " << item.second << "\n";
+    }
+}
@@ -0,0 +1,81 @@
+//==--- Profiler.h - SIGPROF sampling profiler for the AST interpreter ------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <atomic>
+#include <map>
+#include <signal.h>
+#include <vector>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Expr.h"
+
+using namespace clang;
+
+/// 基于 setitimer(ITIMER_PROF) / SIGPROF 的采样 Profiler
+/// 解释器在每个结点上把当前 Stmt 写入无锁槽位，并在 call / exit 时维护客户程序调用栈，
+/// 信号处理函数只把这些槽位拷贝进环形缓冲区，聚合工作在信号处理函数之外完成
+class Profiler
+{
+  public:
+    static const unsigned MaxDepth = 64;
+    static const unsigned RingSize = 256;
+
+    Profiler() : mCurrent(nullptr), mDepth(0), mHead(0), mTail(0), mDropped(0), mSamples(0) {}
+    ~Profiler() { stop(); }
+
+    bool start(unsigned hz);
+    void stop();
+
+    /// 热路径：每个被访问的结点都会调用，只有一次 store 和一次比较
+    void enter(const Stmt *stmt)
+    {
+        mCurrent.store(stmt, std::memory_order_relaxed);
+        if (mHead.load(std::memory_order_relaxed) != mTail.load(std::memory_order_relaxed))
+            drain();
+    }
+    void push(const CallExpr *call)
+    {
+        unsigned depth = mDepth.load(std::memory_order_relaxed);
+        if (depth < MaxDepth) mCalls[depth] = call;
+        mDepth.store(depth + 1, std::memory_order_release);
+    }
+    void pop()
+    {
+        unsigned depth = mDepth.load(std::memory_order_relaxed);
+        if (depth > 0) mDepth.store(depth - 1, std::memory_order_release);
+    }
+
+    unsigned samples() const { return mSamples; }
+    unsigned dropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+    /// 以 folded stack 格式输出：`main:20;fibonacci:15;fibonacci:9 37`
+    void report(llvm::raw_ostream &, const ASTContext &, const FunctionDecl *entry);
+
+  private:
+    struct Sample
+    {
+        const Stmt *stmt;
+        unsigned depth;
+        const CallExpr *calls[MaxDepth];
+    };
+
+    static void handler(int);
+    void sample();
+    void drain();
+
+    std::atomic<const Stmt *> mCurrent;
+    const CallExpr *mCalls[MaxDepth];
+    std::atomic<unsigned> mDepth;
+
+    Sample mRing[RingSize];
+    std::atomic<unsigned> mHead; // 只由信号处理函数写
+    std::atomic<unsigned> mTail; // 只由解释器写
+    std::atomic<unsigned> mDropped;
+
+    // key 为 [调用点..., 叶子 Stmt]，nullptr 表示被截断的栈
+    std::map<std::vector<const Stmt *>, unsigned> mCounts;
+    unsigned mSamples;
+    struct sigaction mOldAction;
+
+    static Profiler *sActive;
+};
@@ -0,0 +1,200 @@
+#include "Replay.h"
+
+#include <algorithm>
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/raw_ostream.h"
+
+// 日志格式改变时修改版本，旧版本的日志拒绝回放
+static const char Magic[] = "TCIO";
+static const uint64_t Version = 1;
+
+static void describe(llvm::raw_ostream &out, IOEvent::Kind kind, int64_t value)
+{
+    switch (kind)
+    {
+    case IOEvent::Input: out << "GET " << value; break;
+    case IOEvent::InputEnd: out << "GET at end of input"; break;
+    case IOEvent::Malloc: out << "MALLOC " << value; break;
+    case IOEvent::Print: out << "PRINT " << value; break;
+    case IOEvent::End: out << (value ? "budget exhausted" : "end of execution"); break;
+    }
+}
+
+IORecorder::IORecorder(GuestIO *target)
+    : mTarget(target), mBudget(nullptr), mLog(Magic), mEvents(0), mSteps(0), mMicros(0)
+{
+    llvm::raw_string_ostream out(mLog);
+    llvm::encodeULEB128(Version, out);
+}
+
+void IORecorder::append(IOEvent::Kind kind, int64_t value)
+{
+    uint64_t steps = mSteps, micros = mMicros;
+    if (mBudget) {
+        steps = mBudget->steps();
+        // 浮点换算可能使时间倒退一微秒，差值不能为负
+        micros = std::max(mMicros, (uint64_t)(mBudget->elapsedMs() * 1000));
+    }
+    llvm::raw_string_ostream out(mLog);
+    out << (char)kind;
+    llvm::encodeULEB128(steps - mSteps, out);
+    llvm::encodeULEB128(micros - mMicros, out);
+    llvm::encodeSLEB128(value, out);
+    mSteps = steps;
+    mMicros = micros;
+    ++mEvents;
+}
+
+bool IORecorder::input(int64_t &val)
+{
+    bool ok = mTarget->input(val);
+    append(ok ? IOEvent::Input : IOEvent::InputEnd, ok ? val : 0);
+    return ok;
+}
+
+void IORecorder::print(int64_t val)
+{
+    append(IOEvent::Print, val);
+    mTarget->print(val);
+}
+
+void IORecorder::allocate(int64_t size)
+{
+    append(IOEvent::Malloc, size);
+    mTarget->allocate(size);
+}
+
+void IORecorder::begin(const Budget &budget)
+{
+    mBudget = &budget;
+    mTarget->begin(budget);
+}
+
+void IORecorder::end(bool exhausted)
+{
+    append(IOEvent::End, exhausted);
+    mBudget = nullptr;
+    mTarget->end(exhausted);
+}
+
+bool IORecorder::save(llvm::StringRef path) const
+{
+    std::error_code EC;
+    llvm::raw_fd_ostream out(path, EC);
+    if (EC) return false;
+    out << mLog;
+    return true;
+}
+
+IOReplayer::IOReplayer(GuestIO *target)
+    : mTarget(target), mBudget(nullptr), mEvents(), mInputs(), mNext(0), mDiverged(false),
+      mActual{IOEvent::End, 0, 0, 0} {}
+
+bool IOReplayer::load(llvm::StringRef log)
+{
+    if (!log.consume_front(Magic)) return false;
+    const uint8_t *ptr = log.bytes_begin(), *end = log.bytes_end();
+    const char *error = nullptr;
+    unsigned size;
+    // 任何一个编码越界都会设置 error，统一在读完一个事件后检查
+    auto uleb = [&]() -> uint64_t {
+        uint64_t val = error ? 0 : llvm::decodeULEB128(ptr, &size, end, &error);
+        if (!error) ptr += size;
+        return val;
+    };
+    if (uleb() != Version || error) return false;
+
+    uint64_t steps = 0, micros = 0;
+    while (ptr != end)
+    {
+        IOEvent event;
+        if (*ptr > IOEvent::End) return false;
+        event.kind = (IOEvent::Kind)*ptr++;
+        steps += uleb();
+        micros += uleb();
+        event.value = error ? 0 : llvm::decodeSLEB128(ptr, &size, end, &error);
+        if (error) return false;
+        ptr += size;
+        event.steps = steps;
+        event.micros = micros;
+        mEvents.push_back(event);
+        if (event.kind == IOEvent::Input) mInputs.push_back(event.value);
+    }
+    // 只有执行结束后才会保存日志
+    return !mEvents.empty() && mEvents.back().kind == IOEvent::End;
+}
+
+void IOReplayer::check(IOEvent::Kind kind, int64_t value)
+{
+    if (mDiverged) return;
+    mActual.kind = kind;
+    mActual.value = value;
+    if (mBudget) {
+        mActual.steps = mBudget->steps();
+        mActual.micros = (uint64_t)(mBudget->elapsedMs() * 1000);
+    }
+    if (mNext < mEvents.size() && mEvents[mNext].kind == kind && mEvents[mNext].value == value) ++mNext;
+    else mDiverged = true;
+}
+
+bool IOReplayer::input(int64_t &val)
+{
+    // 输入与比较相互独立：出现不一致之后仍然按录制的顺序提供输入
+    bool ok = !mInputs.empty();
+    if (ok) {
+        val = mInputs.front();
+        mInputs.pop_front();
+    }
+    check(ok ? IOEvent::Input : IOEvent::InputEnd, ok ? val : 0);
+    return ok;
+}
+
+void IOReplayer::print(int64_t val)
+{
+    check(IOEvent::Print, val);
+    mTarget->print(val);
+}
+
+void IOReplayer::allocate(int64_t size)
+{
+    check(IOEvent::Malloc, size);
+    mTarget->allocate(size);
+}
+
+void IOReplayer::begin(const Budget &budget)
+{
+    mBudget = &budget;
+    mTarget->begin(budget);
+}
+
+void IOReplayer::end(bool exhausted)
+{
+    check(IOEvent::End, exhausted);
+    mBudget = nullptr;
+    mTarget->end(exhausted);
+}
+
+void IOReplayer::report(llvm::raw_ostream &out) const
+{
+    if (!diverged()) {
+        const IOEvent &recorded = mEvents.back();
+        out << "[Replay] " << mEvents.size() << " events matched, " << mActual.steps << " steps (recorded "
+            << recorded.steps << "), " << llvm::format("%.1f", mActual.micros / 1e3) << " ms (recorded "
+            << llvm::format("%.1f", recorded.micros / 1e3) << " ms).\n";
+        return;
+    }
+    if (!mDiverged) {
+        out << "[Replay] Stopped after " << mNext << " of " << mEvents.size() << " events.\n";
+        return;
+    }
+    out << "[Replay] Diverged at event " << mNext << " at step " << mActual.steps;
+    if (mNext < mEvents.size()) out << " (recorded step " << mEvents[mNext].steps << ")";
+    out << ": ";
+    describe(out, mActual.kind, mActual.value);
+    out << ", recorded ";
+    if (mNext < mEvents.size()) describe(out, mEvents[mNext].kind, mEvents[mNext].value);
+    else out << "end of log";
+    out << ".\n";
+}
@@ -0,0 +1,89 @@
+//==--- Replay.h - Deterministic record and replay of guest I/O -------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Environment.h"
+
+/// I/O 日志中的一个事件，步数和时间（微秒）是事件发生时执行预算的读数
+struct IOEvent
+{
+    enum Kind : uint8_t
+    {
+        Input,    // GET 读到 value
+        InputEnd, // GET 时输入已经结束
+        Malloc,   // MALLOC(value)
+        Print,    // PRINT(value)
+        End,      // 执行结束，value 表示执行预算是否耗尽
+    };
+
+    Kind kind;
+    int64_t value;
+    uint64_t steps;
+    uint64_t micros;
+};
+
+/// --record：转发给 target 的同时把每个事件追加到紧凑的二进制日志
+/// 日志以 "TCIO" 和版本号开头，每个事件为一个字节的种类、与上一事件之差的步数和时间（ULEB128）以及值（SLEB128）
+class IORecorder : public GuestIO
+{
+  public:
+    explicit IORecorder(GuestIO *target);
+
+    bool input(int64_t &) override;
+    llvm::raw_ostream &output() override { return mTarget->output(); }
+    void print(int64_t) override;
+    void allocate(int64_t) override;
+    void begin(const Budget &) override;
+    void end(bool exhausted) override;
+
+    const std::string &log() const { return mLog; }
+    uint64_t events() const { return mEvents; }
+    bool save(llvm::StringRef path) const;
+
+  private:
+    void append(IOEvent::Kind, int64_t value);
+
+    GuestIO *mTarget;
+    const Budget *mBudget; // 仅在执行期间非空
+    std::string mLog;
+    uint64_t mEvents;
+    uint64_t mSteps;
+    uint64_t mMicros;
+};
+
+/// --replay：GET 依次取得日志中的输入，不读取 target 的输入；MALLOC、PRINT 和结束与日志逐个比较，
+/// 记下第一个不一致的事件。PRINT 仍然写入 target，便于与原来的输出对比
+class IOReplayer : public GuestIO
+{
+  public:
+    explicit IOReplayer(GuestIO *target);
+
+    /// 解析日志，格式错误时返回 false
+    bool load(llvm::StringRef log);
+
+    bool input(int64_t &) override;
+    llvm::raw_ostream &output() override { return mTarget->output(); }
+    void print(int64_t) override;
+    void allocate(int64_t) override;
+    void begin(const Budget &) override;
+    void end(bool exhausted) override;
+
+    /// 出现不一致的事件，或者执行结束时日志中还有未出现的事件
+    bool diverged() const { return mDiverged || mNext != mEvents.size(); }
+    /// 一致时报告步数和时间与录制时的对比，否则报告第一个不一致的事件
+    void report(llvm::raw_ostream &) const;
+
+  private:
+    void check(IOEvent::Kind, int64_t value);
+
+    GuestIO *mTarget;
+    const Budget *mBudget;
+    std::vector<IOEvent> mEvents;
+    std::deque<int64_t> mInputs;
+    size_t mNext; // 下一个要比较的事件
+    bool mDiverged;
+    IOEvent mActual; // 第一个不一致的事件，或者执行结束的事件
+};
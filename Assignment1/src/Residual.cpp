@@ -0,0 +1,298 @@
+#include "Residual.h"
+
+#include "clang/AST/RecordLayout.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+// 折叠出的 PRINT 和赋值太多时剩余程序本身的解析比原程序更慢，不作为切点
+static const size_t MaxFolded = 1 << 16;
+
+static const char Header[] = "// residual program: ";
+
+/// 从 inputs 的第 next 个值开始读取，输出转发给 target
+class VectorIO : public GuestIO
+{
+  public:
+    VectorIO(const std::vector<int64_t> &inputs, size_t next, GuestIO *target)
+        : mInputs(inputs), mNext(next), mTarget(target) {}
+
+    bool input(int64_t &val) override
+    {
+        if (mNext >= mInputs.size()) return false;
+        val = mInputs[mNext++];
+        return true;
+    }
+    llvm::raw_ostream &output() override { return mTarget->output(); }
+    void print(int64_t val) override { mTarget->print(val); }
+
+  private:
+    const std::vector<int64_t> &mInputs;
+    size_t mNext;
+    GuestIO *mTarget;
+};
+
+/// -9223372036854775808 不是合法的字面量
+static void printLiteral(llvm::raw_ostream &out, int64_t val)
+{
+    if (val == INT64_MIN) out << "-9223372036854775807 - 1";
+    else out << val;
+}
+
+/// stmt 中引用的变量
+static void collectRefs(Stmt *stmt, llvm::DenseSet<const VarDecl *> &refs)
+{
+    if (DeclRefExpr *ref = dyn_cast<DeclRefExpr>(stmt)) {
+        if (VarDecl *vardecl = dyn_cast<VarDecl>(ref->getDecl())) refs.insert(vardecl->getCanonicalDecl());
+    }
+    for (auto *SubStmt : stmt->children())
+        if (SubStmt) collectRefs(SubStmt, refs);
+}
+
+/// 按 ASTContext 的布局读取数组和结构体，为每个非零的标量写一条赋值：解释器把数组和结构体初始化为 0。
+/// 非空指针指向的内存在剩余程序中不存在，返回 false
+static bool foldMemory(llvm::raw_ostream &out, const ASTContext &context, QualType type, const char *memory,
+                       const std::string &name, size_t &count)
+{
+    if (const ConstantArrayType *array = context.getAsConstantArrayType(type)) {
+        QualType elemType = array->getElementType();
+        int64_t stride = context.getTypeSizeInChars(elemType).getQuantity();
+        for (uint64_t i = 0; i < array->getSize().getZExtValue(); ++i)
+            if (!foldMemory(out, context, elemType, memory + i * stride, name + "[" + std::to_string(i) + "]", count))
+                return false;
+        return true;
+    }
+    if (const RecordType *record = type->getAs<RecordType>()) {
+        RecordDecl *decl = record->getDecl();
+        const ASTRecordLayout &layout = context.getASTRecordLayout(decl);
+        for (FieldDecl *field : decl->fields())
+        {
+            int64_t offset = context.toCharUnitsFromBits(layout.getFieldOffset(field->getFieldIndex())).getQuantity();
+            if (!foldMemory(out, context, field->getType(), memory + offset, name + "." + field->getName().str(), count))
+                return false;
+        }
+        return true;
+    }
+
+    int64_t val;
+    if (type->isCharType()) val = *((const char *)memory);
+    else if (type->isIntegerType()) val = *((const int *)memory);
+    else if (type->isPointerType()) val = *((const int64_t *)memory);
+    else return false;
+    if (val == 0) return true;
+    if (type->isPointerType() || ++count > MaxFolded) return false;
+    out << "    " << name << " = ";
+    printLiteral(out, val);
+    out << ";\n";
+    return true;
+}
+
+/// 把变量在切点处的值写成语句，declare 时先声明（入口函数的局部变量），否则赋值（全局变量）
+static bool foldVar(llvm::raw_ostream &out, const ASTContext &context, Environment &env, VarDecl *vardecl,
+                    bool declare, size_t &count)
+{
+    QualType type = vardecl->getType();
+    std::string name = vardecl->getName().str();
+    // 数组和结构体的槽位中是其内存的地址
+    int64_t val = env.getDeclVal(vardecl);
+    if (type->isArrayType() || type->isRecordType()) {
+        if (declare) {
+            out << "    ";
+            type.print(out, context.getPrintingPolicy(), name);
+            out << ";\n";
+        }
+        return foldMemory(out, context, type, (const char *)val, name, count);
+    }
+
+    if ((type->isPointerType() && val != 0) || ++count > MaxFolded) return false;
+    out << "    ";
+    if (declare) type.print(out, context.getPrintingPolicy(), name);
+    else out << name;
+    out << " = ";
+    printLiteral(out, val);
+    out << ";\n";
+    return true;
+}
+
+bool Specializer::input(int64_t &val)
+{
+    // 超出已知前缀的输入，之后的执行依赖它
+    if (mConsumed >= mKnown) mDynamic = true;
+    if (!mTarget->input(val)) {
+        // 输入全部已知时，读完之后 GET 得到的 0 也是已知的
+        if (mKnown != AllInputs) mDynamic = true;
+        return false;
+    }
+    ++mConsumed;
+    return true;
+}
+
+void Specializer::print(int64_t val)
+{
+    if (!mDynamic) mOutputs.push_back(val);
+    mTarget->print(val);
+}
+
+bool Specializer::foldState(const ASTContext &context, Environment &env, CompoundStmt *body, unsigned index,
+                            llvm::raw_ostream &out)
+{
+    // 只需要恢复剩余的语句会读到的变量；剩余的语句可能调用其他函数
+    llvm::DenseSet<const VarDecl *> refs;
+    for (unsigned i = index; i < body->size(); ++i)
+        collectRefs(body->body_begin()[i], refs);
+    if (index < body->size()) refs.insert(mFunctionRefs.begin(), mFunctionRefs.end());
+    size_t count = mOutputs.size();
+
+    // 全局变量的初始化在剩余程序中重新执行一遍，再赋值为切点处的值；常量不会改变
+    llvm::DenseSet<const VarDecl *> globals;
+    for (Decl *decl : context.getTranslationUnitDecl()->decls())
+    {
+        VarDecl *vardecl = dyn_cast<VarDecl>(decl);
+        if (vardecl == nullptr || !globals.insert(vardecl->getCanonicalDecl()).second) continue;
+        if (!refs.count(vardecl->getCanonicalDecl()) || context.getBaseElementType(vardecl->getType()).isConstQualified())
+            continue;
+        if (!foldVar(out, context, env, vardecl, false, count)) return false;
+    }
+
+    // 已经执行的顶层声明在剩余程序中重新声明，初值为切点处的值；只声明类型的语句原样保留
+    const SourceManager &sm = context.getSourceManager();
+    llvm::StringRef source = sm.getBufferData(sm.getMainFileID());
+    for (unsigned i = 0; i < index; ++i)
+    {
+        DeclStmt *declstmt = dyn_cast<DeclStmt>(body->body_begin()[i]);
+        if (declstmt == nullptr) continue;
+        bool vars = false, types = false;
+        for (Decl *decl : declstmt->decls())
+        {
+            VarDecl *vardecl = dyn_cast<VarDecl>(decl);
+            if (vardecl == nullptr) {
+                types = true;
+                continue;
+            }
+            vars = true;
+            if (refs.count(vardecl) && !foldVar(out, context, env, vardecl, true, count)) return false;
+        }
+        // struct S { ... } s; 中的类型无法与变量分开保留
+        if (vars && types) return false;
+        if (types) {
+            // DeclStmt 的结束位置是分号
+            unsigned begin = sm.getFileOffset(sm.getExpansionLoc(declstmt->getBeginLoc()));
+            unsigned end = sm.getFileOffset(sm.getExpansionLoc(declstmt->getEndLoc())) + 1;
+            out << "    " << source.slice(begin, end) << "\n";
+        }
+    }
+    return true;
+}
+
+void Specializer::boundary(const ASTContext &context, Environment &env, FunctionDecl *entry, unsigned index)
+{
+    if (mDynamic || index == 0 || mOutputs.size() > MaxFolded) return;
+    CompoundStmt *body = cast<CompoundStmt>(entry->getBody());
+    if (!mFunctionsCollected) {
+        for (Decl *decl : context.getTranslationUnitDecl()->decls())
+        {
+            FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl);
+            if (fdecl && fdecl->doesThisDeclarationHaveABody() && fdecl->getBody() != body)
+                collectRefs(fdecl->getBody(), mFunctionRefs);
+        }
+        mFunctionsCollected = true;
+    }
+
+    // 剩余程序：原程序中入口函数体之外的部分原样保留，函数体换成折叠的结果和剩余的顶层语句
+    const SourceManager &sm = context.getSourceManager();
+    llvm::StringRef source = sm.getBufferData(sm.getMainFileID());
+    Stmt *next = index < body->size() ? body->body_begin()[index] : nullptr;
+    unsigned open = sm.getFileOffset(sm.getExpansionLoc(body->getLBracLoc())) + 1;
+    unsigned rest = sm.getFileOffset(sm.getExpansionLoc(next ? next->getBeginLoc() : body->getRBracLoc()));
+
+    std::string program;
+    llvm::raw_string_ostream out(program);
+    out << Header << mConsumed << " inputs consumed, " << mOutputs.size() << " values printed\n"
+        << source.substr(0, open) << "\n";
+    for (int64_t val : mOutputs)
+    {
+        out << "    PRINT(";
+        printLiteral(out, val);
+        out << ");\n";
+    }
+    if (!foldState(context, env, body, index, out)) return;
+    out << (next ? "    " : "") << source.substr(rest);
+    mResidual = out.str();
+    mResidualInputs = mConsumed;
+}
+
+/// 剩余程序的第一行记录折叠掉的输入个数
+static bool residualInputs(llvm::StringRef program, size_t &consumed)
+{
+    return program.consume_front(Header) && !program.consumeInteger(10, consumed);
+}
+
+/// 剩余程序的格式改变时修改版本，使旧的缓存失效；只有已知的输入参与哈希
+static std::string residualKey(const std::string &sourceCode, const std::vector<int64_t> &inputs, size_t known)
+{
+    llvm::MD5 hash;
+    hash.update("residual-v2");
+    hash.update(sourceCode);
+    // 输入全部已知时读完之后的 GET 也是静态的，不能与只知道同样前缀的剩余程序共用
+    hash.update(known == AllInputs ? " all" : " prefix");
+    for (size_t i = 0; i < std::min(known, inputs.size()); ++i)
+        hash.update(" " + std::to_string(inputs[i]));
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    return result.digest().str().str();
+}
+
+/// 先写入临时文件再改名，同时运行的多个进程不会读到写了一半的缓存
+static void writeResidual(llvm::StringRef cacheDir, llvm::StringRef path, const std::string &program)
+{
+    llvm::SmallString<128> model(cacheDir), temp;
+    llvm::sys::path::append(model, "residual-%%%%%%.tmp");
+    int fd;
+    if (llvm::sys::fs::createUniqueFile(model, fd, temp)) return;
+    {
+        llvm::raw_fd_ostream out(fd, true);
+        out << program;
+    }
+    if (llvm::sys::fs::rename(temp, path)) llvm::sys::fs::remove(temp);
+}
+
+bool interpretSpecialized(const std::string &sourceCode, const std::vector<int64_t> &inputs, size_t known,
+                          const std::string &cacheDir, const InterpreterOptions &options, bool &hit)
+{
+    llvm::SmallString<128> path(cacheDir);
+    llvm::sys::path::append(path, residualKey(sourceCode, inputs, known) + ".c");
+    GuestIO stdIO;
+    GuestIO *target = options.io ? options.io : &stdIO;
+
+    auto cached = llvm::MemoryBuffer::getFile(path);
+    size_t consumed = 0;
+    hit = cached && residualInputs((*cached)->getBuffer(), consumed) && consumed <= inputs.size();
+    if (hit) {
+        // 剩余程序从折叠掉的输入之后开始读取
+        VectorIO io(inputs, consumed, target);
+        InterpreterOptions residual = options;
+        residual.io = &io;
+        return interpret((*cached)->getBuffer().str(), residual);
+    }
+
+    VectorIO io(inputs, 0, target);
+    Specializer specializer(&io, known);
+    bool exhausted = false;
+    InterpreterOptions specializing = options;
+    specializing.io = &specializer;
+    specializing.specializer = &specializer;
+    specializing.exhausted = &exhausted;
+    bool ok = interpret(sourceCode, specializing);
+    if (exhausted && options.exhausted) *options.exhausted = true;
+
+    // 只缓存正常结束的执行：预算耗尽时剩余程序的步数与原程序不同
+    if (ok && !exhausted && !specializer.residual().empty()) {
+        llvm::sys::fs::create_directories(cacheDir);
+        writeResidual(cacheDir, path, specializer.residual());
+    }
+    return ok;
+}
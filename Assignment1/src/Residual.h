@@ -0,0 +1,54 @@
+//==--- Residual.h - Input-specialized residual programs ---------------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Interpreter.h"
+
+/// 输入全部已知：读完输入之后的 GET 得到 0 也是静态的
+const size_t AllInputs = SIZE_MAX;
+
+/// 入口函数体的在线部分求值：输入的前 known 个值已知，之后的 GET 是动态的。
+/// 执行入口函数体的每条顶层语句之前检查一次：此前读取的输入都已知时，已经执行的语句折叠为常量 PRINT、
+/// 全局变量的赋值和局部变量的声明，其余语句原样保留。最后一个这样的切点即为剩余程序
+class Specializer : public GuestIO
+{
+  public:
+    /// 输入读自 target，输出转发给 target
+    Specializer(GuestIO *target, size_t known)
+        : mTarget(target), mKnown(known), mConsumed(0), mDynamic(false), mOutputs(),
+          mFunctionRefs(), mFunctionsCollected(false), mResidual(), mResidualInputs(0) {}
+
+    bool input(int64_t &val) override;
+    llvm::raw_ostream &output() override { return mTarget->output(); }
+    void print(int64_t val) override;
+    void allocate(int64_t size) override { mTarget->allocate(size); }
+
+    /// 执行入口函数体的第 index 条顶层语句之前调用，index 等于语句数时表示函数体执行完
+    void boundary(const ASTContext &, Environment &, FunctionDecl *entry, unsigned index);
+    /// 最后一个切点的剩余程序，没有执行过任何顶层语句时为空
+    const std::string &residual() const { return mResidual; }
+    /// 剩余程序从输入的这个位置开始读取
+    size_t residualInputs() const { return mResidualInputs; }
+
+  private:
+    bool foldState(const ASTContext &, Environment &, CompoundStmt *body, unsigned index, llvm::raw_ostream &);
+
+    GuestIO *mTarget;
+    size_t mKnown;
+    size_t mConsumed;
+    bool mDynamic; // 读取过未知的输入，之后的切点都不是静态的
+    std::vector<int64_t> mOutputs; // 读取未知的输入之前 PRINT 的值
+    llvm::DenseSet<const VarDecl *> mFunctionRefs; // 入口函数之外的函数引用的变量
+    bool mFunctionsCollected;
+    std::string mResidual;
+    size_t mResidualInputs;
+};
+
+/// 以 cacheDir 中按源码和已知输入的哈希缓存的剩余程序代替源码执行，hit 表示是否命中；
+/// 没有缓存时解释执行源码，同时部分求值，正常结束后写入缓存。inputs 为全部输入，其中前 known 个已知。
+/// 返回值与 interpret 相同
+bool interpretSpecialized(const std::string &sourceCode, const std::vector<int64_t> &inputs, size_t known,
+                          const std::string &cacheDir, const InterpreterOptions &options, bool &hit);
@@ -0,0 +1,145 @@
+#include "Scheduler.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "llvm/Support/PrettyStackTrace.h"
+
+Session::Session(Scheduler &scheduler, unsigned id, const std::string &sourceCode)
+    : mScheduler(scheduler), mId(id), mSource(sourceCode), mState(Ready), mStarted(false), mExhausted(false),
+      mInputs(), mClosed(false), mOutput(), mOut(mOutput), mContext(), mStack(nullptr),
+      mStackSize(scheduler.mStackSize), mPrettyStack(nullptr)
+{
+}
+
+Session::~Session()
+{
+    if (mStack) munmap(mStack, mStackSize);
+}
+
+void Session::push(int64_t val)
+{
+    mInputs.push_back(val);
+}
+
+void Session::close()
+{
+    mClosed = true;
+}
+
+bool Session::input(int64_t &val)
+{
+    while (mInputs.empty() && !mClosed) suspend(Waiting);
+    if (mInputs.empty()) return false;
+    val = mInputs.front();
+    mInputs.pop_front();
+    return true;
+}
+
+llvm::raw_ostream &Session::output()
+{
+    return mOut;
+}
+
+void Session::entry(unsigned lo, unsigned hi)
+{
+    // makecontext 只能传递 int 参数，指针拆成高低两半
+    Session *session = reinterpret_cast<Session *>(((uintptr_t)hi << 32) | (uintptr_t)lo);
+    session->run();
+    // 返回后经由 uc_link 回到调度器
+}
+
+void Session::run()
+{
+    InterpreterOptions options = mScheduler.mOptions;
+    options.io = this;
+    options.exhausted = &mExhausted;
+    options.timeSlice = mScheduler.mTimeSlice;
+    options.yield = [this]() { suspend(Ready); };
+    try {
+        interpret(mSource, options);
+    } catch (...) {
+        if (options.log) *options.log << "[Error] Session " << mId << " terminated by an exception.\n";
+    }
+    mState = Finished;
+}
+
+void Session::resume()
+{
+    if (!mStarted) {
+        mStarted = true;
+        // MAP_NORESERVE：数千个会话的栈只占用实际用到的物理页
+        mStack = mmap(nullptr, mStackSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (mStack == MAP_FAILED) {
+            mStack = nullptr;
+            if (mScheduler.mOptions.log) *mScheduler.mOptions.log << "[Error] Fail to allocate the stack of session " << mId << ".\n";
+            mState = Finished;
+            return;
+        }
+        // 最低的一页作为保护页，栈溢出时直接段错误而不是破坏相邻内存
+        mprotect(mStack, getpagesize(), PROT_NONE);
+
+        getcontext(&mContext);
+        mContext.uc_stack.ss_sp = mStack;
+        mContext.uc_stack.ss_size = mStackSize;
+        mContext.uc_link = &mScheduler.mContext;
+        uintptr_t self = reinterpret_cast<uintptr_t>(this);
+        makecontext(&mContext, (void (*)())&Session::entry, 2,
+                    (unsigned)(self & 0xffffffffu), (unsigned)(self >> 32));
+    }
+
+    // LLVM 用线程局部的链表记录 PrettyStackTrace，每个协程需要各自的链表头
+    const void *schedulerStack = llvm::SavePrettyStackState();
+    llvm::RestorePrettyStackState(mPrettyStack);
+    mState = Ready;
+    swapcontext(&mScheduler.mContext, &mContext);
+    mPrettyStack = llvm::SavePrettyStackState();
+    llvm::RestorePrettyStackState(schedulerStack);
+}
+
+/// 只会在 GET 和执行预算的检查点处挂起，这两处都不在 catch 块中，
+/// 因此切换协程时 C++ 运行时没有正在处理的异常
+void Session::suspend(State state)
+{
+    mState = state;
+    swapcontext(&mContext, &mScheduler.mContext);
+}
+
+
+Scheduler::Scheduler(const InterpreterOptions &options, uint64_t timeSlice, size_t stackSize)
+    : mOptions(options), mTimeSlice(timeSlice), mStackSize(stackSize), mSessions(), mContext(), mSwitches(0)
+{
+}
+
+Session &Scheduler::spawn(const std::string &sourceCode)
+{
+    mSessions.emplace_back(new Session(*this, mSessions.size(), sourceCode));
+    return *mSessions.back();
+}
+
+void Scheduler::run(std::function<void(Session &)> feeder)
+{
+    while (true)
+    {
+        bool live = false, progress = false;
+        for (auto &session : mSessions)
+        {
+            if (session->getState() == Session::Finished) continue;
+            live = true;
+            if (!session->isRunnable() && feeder) feeder(*session);
+            if (!session->isRunnable()) continue;
+
+            session->resume();
+            ++mSwitches;
+            progress = true;
+        }
+        if (!live) break;
+
+        // 所有存活的会话都在等待输入且没有新的输入到达：关闭它们的输入，避免永久挂起
+        if (!progress) {
+            for (auto &session : mSessions)
+                if (session->getState() == Session::Waiting) session->close();
+        }
+    }
+}
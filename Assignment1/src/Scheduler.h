@@ -0,0 +1,89 @@
+//==--- Scheduler.h - Single-threaded scheduler of guest sessions ----------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <deque>
+#include <memory>
+#include <string>
+#include <ucontext.h>
+#include <vector>
+
+#include "Interpreter.h"
+
+class Scheduler;
+
+/// 以有栈协程运行的客户程序会话
+/// 解释器仍然是递归的 AST 遍历，协程保存了整条本地调用栈，
+/// 因此可以在 GET 没有输入或时间片用完时挂起，而不阻塞所在的线程
+class Session : public GuestIO
+{
+  public:
+    enum State { Ready, Waiting, Finished };
+
+    Session(Scheduler &scheduler, unsigned id, const std::string &sourceCode);
+    ~Session();
+
+    /// 异步推送一个输入值
+    void push(int64_t);
+    /// 标记输入结束，之后的 GET 得到 0
+    void close();
+
+    bool input(int64_t &) override;
+    llvm::raw_ostream &output() override;
+
+    unsigned getId() const { return mId; }
+    State getState() const { return mState; }
+    bool isRunnable() const { return mState == Ready || !mInputs.empty() || mClosed; }
+    bool isExhausted() const { return mExhausted; }
+    const std::string &getOutput() { return mOut.str(); }
+
+  private:
+    friend class Scheduler;
+
+    static void entry(unsigned lo, unsigned hi);
+    void run();
+    void resume();
+    void suspend(State);
+
+    Scheduler &mScheduler;
+    unsigned mId;
+    std::string mSource;
+    State mState;
+    bool mStarted;
+    bool mExhausted;
+
+    std::deque<int64_t> mInputs;
+    bool mClosed;
+    std::string mOutput;
+    llvm::raw_string_ostream mOut;
+
+    ucontext_t mContext;
+    void *mStack;
+    size_t mStackSize;
+    const void *mPrettyStack; // 本协程的 PrettyStackTrace 链表头
+};
+
+/// 单线程轮转调度器：每个会话运行到挂起点（等待输入或时间片用完）后切换到下一个会话
+class Scheduler
+{
+  public:
+    /// timeSlice 为每次调度最多执行的步数（循环回边与调用），stackSize 为每个协程的栈大小
+    Scheduler(const InterpreterOptions &options, uint64_t timeSlice, size_t stackSize);
+
+    Session &spawn(const std::string &sourceCode);
+
+    /// 调度直到所有会话结束；会话等待输入时调用 feeder，让其有机会推送新的输入
+    void run(std::function<void(Session &)> feeder);
+
+    std::vector<std::unique_ptr<Session>> &sessions() { return mSessions; }
+    uint64_t switches() const { return mSwitches; }
+
+  private:
+    friend class Session;
+
+    InterpreterOptions mOptions;
+    uint64_t mTimeSlice;
+    size_t mStackSize;
+    std::vector<std::unique_ptr<Session>> mSessions;
+    ucontext_t mContext;
+    uint64_t mSwitches;
+};
@@ -0,0 +1,161 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <exception>
+
+// 当前线程所属的线程池和工作线程编号
+static thread_local const ThreadPool *CurrentPool = nullptr;
+static thread_local unsigned CurrentWorker = 0;
+
+ThreadPool::ThreadPool(unsigned threads) : mQueues(), mThreads(), mLock(), mWake(), mPending(0), mStop(false)
+{
+    if (threads == 0) threads = 1;
+    for (unsigned i = 0; i < threads; ++i)
+        mQueues.emplace_back(new Queue());
+    for (unsigned i = 0; i < threads; ++i)
+        mThreads.emplace_back(&ThreadPool::worker, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mStop = true;
+    }
+    mWake.notify_all();
+    for (auto &thread : mThreads) thread.join();
+}
+
+void ThreadPool::parallelFor(int64_t begin, int64_t end, int64_t grain,
+                             const std::function<void(int64_t, int64_t)> &body)
+{
+    if (begin >= end) return;
+    if (grain < 1) grain = 1;
+
+    // 调用线程在这里等待所有块完成
+    struct Latch
+    {
+        std::mutex lock;
+        std::condition_variable done;
+        unsigned remaining;
+        std::exception_ptr error;
+    } latch;
+    latch.remaining = (end - begin + grain - 1) / grain;
+    {
+        // 先计数再入队，出队时的递减不会早于这里的递增
+        std::lock_guard<std::mutex> guard(mLock);
+        mPending += latch.remaining;
+    }
+
+    unsigned next = 0;
+    for (int64_t lo = begin; lo < end; lo += grain)
+    {
+        int64_t hi = std::min(lo + grain, end);
+        Task task = [&latch, &body, lo, hi]() {
+            std::exception_ptr error;
+            try {
+                body(lo, hi);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> guard(latch.lock);
+            if (error && !latch.error) latch.error = error;
+            if (--latch.remaining == 0) latch.done.notify_one();
+        };
+        Queue &queue = *mQueues[next++ % mQueues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    mWake.notify_all();
+
+    std::unique_lock<std::mutex> wait(latch.lock);
+    latch.done.wait(wait, [&latch]() { return latch.remaining == 0; });
+    if (latch.error) std::rethrow_exception(latch.error);
+}
+
+void ThreadPool::invoke(const std::function<void()> &first, const std::function<void()> &second)
+{
+    std::atomic<bool> done(false);
+    std::exception_ptr secondError;
+    Task task = [&second, &done, &secondError]() {
+        try {
+            second();
+        } catch (...) {
+            secondError = std::current_exception();
+        }
+        done.store(true, std::memory_order_release);
+    };
+
+    unsigned id = current();
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        ++mPending;
+    }
+    {
+        // 放在队首：自己最先取回最新的任务，窃取者从队尾拿走更早分叉、通常更大的任务
+        Queue &queue = *mQueues[id];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_front(std::move(task));
+    }
+    mWake.notify_one();
+
+    std::exception_ptr firstError;
+    try {
+        first();
+    } catch (...) {
+        firstError = std::current_exception();
+    }
+
+    while (!done.load(std::memory_order_acquire))
+    {
+        Task other;
+        if (pop(id, other)) other();
+        else std::this_thread::yield();
+    }
+    if (firstError) std::rethrow_exception(firstError);
+    if (secondError) std::rethrow_exception(secondError);
+}
+
+unsigned ThreadPool::current() const
+{
+    return CurrentPool == this ? CurrentWorker : 0;
+}
+
+bool ThreadPool::pop(unsigned id, Task &task)
+{
+    // 先取自己队列的队首，再从其他队列的队尾窃取
+    for (unsigned i = 0; i < mQueues.size(); ++i)
+    {
+        Queue &queue = *mQueues[(id + i) % mQueues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) continue;
+        if (i == 0) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        } else {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        --mPending;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::worker(unsigned id)
+{
+    CurrentPool = this;
+    CurrentWorker = id;
+    while (true)
+    {
+        Task task;
+        if (pop(id, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> wait(mLock);
+        mWake.wait(wait, [this]() { return mStop || mPending > 0; });
+        if (mStop) return;
+    }
+}
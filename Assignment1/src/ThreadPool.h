@@ -0,0 +1,52 @@
+//==--- ThreadPool.h - Work-stealing thread pool ---------------------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// 工作窃取线程池：每个工作线程有自己的任务队列，从队首取任务，
+/// 自己的队列为空时从其他线程队列的队尾窃取
+class ThreadPool
+{
+  public:
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    unsigned size() const { return mThreads.size(); }
+
+    /// 把 [begin, end) 按 grain 切块并行执行 body(lo, hi)，所有块完成后返回；
+    /// 任务抛出的第一个异常会在调用线程重新抛出
+    void parallelFor(int64_t begin, int64_t end, int64_t grain,
+                     const std::function<void(int64_t, int64_t)> &body);
+
+    /// 分叉-汇合：second 放入当前线程的队列等待窃取，first 在当前线程执行；
+    /// 等待 second 期间当前线程继续执行队列中的任务（包括没有被窃取的 second 本身），
+    /// 因此任务内部可以嵌套调用 invoke 而不会因为所有线程都在等待而死锁
+    void invoke(const std::function<void()> &first, const std::function<void()> &second);
+
+  private:
+    typedef std::function<void()> Task;
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    void worker(unsigned id);
+    bool pop(unsigned id, Task &);
+    /// 当前线程是本线程池的工作线程时返回其编号，否则使用 0 号队列
+    unsigned current() const;
+
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    std::vector<std::thread> mThreads;
+    std::mutex mLock;
+    std::condition_variable mWake;
+    std::atomic<unsigned> mPending; // 已提交但还没有被取走的任务数
+    bool mStop;
+};
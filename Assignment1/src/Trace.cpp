@@ -0,0 +1,381 @@
+#include "Trace.h"
+
+#include "clang/AST/ASTContext.h"
+
+bool TraceCompiler::compile(Expr *cond, Stmt *body, Expr *inc)
+{
+    // 循环条件为假时整个循环结束，不需要回到解释器
+    mNoExits = true;
+    if (cond) {
+        unsigned val;
+        if (!compileExpr(cond, val)) return false;
+        mTrace.ops.push_back({TraceOp::Guard, 0, val, Trace::LoopExit, 1});
+    }
+    mTrace.ops.push_back({TraceOp::Iteration, 0, 0, 0, 0});
+
+    mNoExits = false;
+    if (!compileStmt(body, std::vector<Stmt *>())) return false;
+
+    // 步进的侧出口之后还需要再执行步进，因此同样不允许
+    mNoExits = true;
+    mDirty = false;
+    unsigned val;
+    if (inc && !compileExpr(inc, val)) return false;
+    return true;
+}
+
+bool TraceCompiler::compileStmt(Stmt *stmt, const std::vector<Stmt *> &rest)
+{
+    if (stmt == nullptr || isa<NullStmt>(stmt)) return true;
+    mStmt = stmt;
+    mRest = &rest;
+    mDirty = false;
+
+    if (Expr *expr = dyn_cast<Expr>(stmt)) {
+        unsigned val;
+        return compileExpr(expr, val);
+    }
+    ++mTrace.nodes;
+
+    if (CompoundStmt *compound = dyn_cast<CompoundStmt>(stmt)) {
+        for (auto iter = compound->body_begin(); iter != compound->body_end(); ++iter)
+        {
+            std::vector<Stmt *> after(iter + 1, compound->body_end());
+            after.insert(after.end(), rest.begin(), rest.end());
+            if (!compileStmt(*iter, after)) return false;
+        }
+        return true;
+    }
+
+    if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt)) {
+        for (auto *SubDecl : declstmt->decls())
+        {
+            VarDecl *vardecl = dyn_cast_or_null<VarDecl>(SubDecl);
+            if (vardecl == nullptr) continue;
+            // 数组、结构体和取地址的标量需要分配存储
+            QualType type = vardecl->getType();
+            if (vardecl->hasGlobalStorage() || mInfo.isMemoryBacked(vardecl) ||
+                !(type->isCharType() || type->isIntegerType() || type->isPointerType()))
+                return false;
+            unsigned val;
+            if (vardecl->hasInit()) {
+                if (!compileExpr(vardecl->getInit(), val)) return false;
+            } else {
+                val = constant(0);
+            }
+            emitEffect(TraceOp::SetLocal, mInfo.getSlot(vardecl), val);
+        }
+        return true;
+    }
+
+    if (IfStmt *ifstmt = dyn_cast<IfStmt>(stmt)) {
+        bool taken;
+        unsigned cond;
+        if (!mRecorder.lookup(ifstmt, taken) || !compileExpr(ifstmt->getCond(), cond) || !guard(cond, taken))
+            return false;
+        return compileStmt(taken ? ifstmt->getThen() : ifstmt->getElse(), rest);
+    }
+
+    // 嵌套循环、switch、break、continue 和 return
+    return false;
+}
+
+bool TraceCompiler::compileExpr(Expr *expr, unsigned &temp)
+{
+    ++mTrace.nodes;
+    int64_t val;
+    if (mInfo.getConstant(expr, val)) {
+        temp = constant(val);
+        return true;
+    }
+
+    if (ParenExpr *paren = dyn_cast<ParenExpr>(expr))
+        return compileExpr(paren->getSubExpr(), temp);
+    if (CastExpr *castexpr = dyn_cast<CastExpr>(expr))
+        return compileExpr(castexpr->getSubExpr(), temp);
+
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+        if (!isa<VarDecl>(declref->getDecl())) return false;
+        const FunctionInfo::VarRef &ref = mInfo.getVarRef(declref);
+        temp = emit(ref.global ? TraceOp::Global : TraceOp::Local, ref.slot);
+        if (ref.memory) temp = load(temp, declref->getType());
+        return true;
+    }
+
+    if (isa<ArraySubscriptExpr>(expr) || isa<MemberExpr>(expr)) {
+        unsigned addr;
+        if (!compileAccess(expr, addr)) return false;
+        temp = load(addr, expr->getType());
+        return true;
+    }
+
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+        return compileUnary(uop, temp);
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr))
+        return compileBinary(bop, temp);
+
+    if (ConditionalOperator *condop = dyn_cast<ConditionalOperator>(expr)) {
+        bool taken;
+        unsigned cond;
+        if (!mRecorder.lookup(condop, taken) || !compileExpr(condop->getCond(), cond) || !guard(cond, taken))
+            return false;
+        return compileExpr(taken ? condop->getTrueExpr() : condop->getFalseExpr(), temp);
+    }
+
+    // 调用
+    return false;
+}
+
+bool TraceCompiler::compileUnary(UnaryOperator *uop, unsigned &temp)
+{
+    Expr *expr = uop->getSubExpr();
+    UnaryOperator::Opcode op = uop->getOpcode();
+
+    if (uop->isIncrementDecrementOp()) {
+        Place place;
+        if (!compileLValue(expr, place)) return false;
+        unsigned oldVal = read(place);
+        int64_t unit = expr->getType()->isPointerType() ? unitOf(expr->getType()->getPointeeType()) : 1;
+        bool inc = op == UO_PreInc || op == UO_PostInc;
+        unsigned newVal = emit(TraceOp::AddImm, oldVal, 0, inc ? unit : -unit);
+        write(place, newVal);
+        temp = (op == UO_PreInc || op == UO_PreDec) ? newVal : oldVal;
+        return true;
+    }
+
+    if (op == UO_AddrOf) {
+        // 数组和结构体的值就是其地址
+        Expr *lvalue = expr->IgnoreParens();
+        QualType type = lvalue->getType();
+        if (type->isArrayType() || type->isRecordType()) return compileExpr(expr, temp);
+        return compileAddress(lvalue, temp);
+    }
+
+    unsigned val;
+    if (!compileExpr(expr, val)) return false;
+    switch (op)
+    {
+        case UO_Minus:
+            temp = emit(TraceOp::Neg, val); break;
+        case UO_Plus:
+            temp = val; break;
+        case UO_Not:
+            temp = emit(TraceOp::Not, val); break;
+        case UO_LNot:
+            temp = emit(TraceOp::LNot, val); break;
+        case UO_Deref:
+            temp = load(val, uop->getType()); break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+/// 普通二元运算和复合赋值对应的微操作
+static bool binaryKind(BinaryOperator::Opcode op, TraceOp::Kind &kind)
+{
+    switch (op)
+    {
+        case BO_Add: case BO_AddAssign: kind = TraceOp::Add; return true;
+        case BO_Sub: case BO_SubAssign: kind = TraceOp::Sub; return true;
+        case BO_Mul: case BO_MulAssign: kind = TraceOp::Mul; return true;
+        case BO_Div: case BO_DivAssign: kind = TraceOp::Div; return true;
+        case BO_Rem: case BO_RemAssign: kind = TraceOp::Rem; return true;
+        case BO_Shl: case BO_ShlAssign: kind = TraceOp::Shl; return true;
+        case BO_Shr: case BO_ShrAssign: kind = TraceOp::Shr; return true;
+        case BO_And: case BO_AndAssign: kind = TraceOp::And; return true;
+        case BO_Xor: case BO_XorAssign: kind = TraceOp::Xor; return true;
+        case BO_Or: case BO_OrAssign: kind = TraceOp::Or; return true;
+        case BO_LAnd: kind = TraceOp::LAnd; return true;
+        case BO_LOr: kind = TraceOp::LOr; return true;
+        case BO_LT: kind = TraceOp::LT; return true;
+        case BO_GT: kind = TraceOp::GT; return true;
+        case BO_LE: kind = TraceOp::LE; return true;
+        case BO_GE: kind = TraceOp::GE; return true;
+        case BO_EQ: kind = TraceOp::EQ; return true;
+        case BO_NE: kind = TraceOp::NE; return true;
+        default: return false;
+    }
+}
+
+bool TraceCompiler::compileBinary(BinaryOperator *bop, unsigned &temp)
+{
+    Expr *left = bop->getLHS();
+    Expr *right = bop->getRHS();
+    BinaryOperator::Opcode op = bop->getOpcode();
+    QualType leftType = left->getType();
+    QualType rightType = right->getType();
+    bool scaleRight = leftType->isPointerType() && (rightType->isCharType() || rightType->isIntegerType());
+    bool scaleLeft = (leftType->isCharType() || leftType->isIntegerType()) && rightType->isPointerType();
+
+    TraceOp::Kind kind = TraceOp::Add;
+    if (bop->isAssignmentOp()) {
+        if (op != BO_Assign && !binaryKind(op, kind)) return false;
+        // 与解释器一致：先求值左侧（包括读出旧值），再求值右侧
+        Place place;
+        unsigned oldVal = 0, rightVal;
+        if (!compileLValue(left, place)) return false;
+        if (op != BO_Assign) oldVal = read(place);
+        if (!compileExpr(right, rightVal)) return false;
+        if (scaleRight) rightVal = scale(rightVal, leftType->getPointeeType());
+        temp = op == BO_Assign ? rightVal : binary(kind, oldVal, rightVal);
+        write(place, temp);
+        return true;
+    }
+
+    // && 和 || 与解释器一样两侧都求值
+    unsigned leftVal, rightVal;
+    if (!binaryKind(op, kind) || !compileExpr(left, leftVal) || !compileExpr(right, rightVal)) return false;
+    if (scaleRight) rightVal = scale(rightVal, leftType->getPointeeType());
+    else if (scaleLeft) leftVal = scale(leftVal, rightType->getPointeeType());
+    temp = binary(kind, leftVal, rightVal);
+    return true;
+}
+
+/// 与 Environment::access 相同的地址计算：起始地址 + 常量偏移 + Σ 下标 * 步长
+bool TraceCompiler::compileAccess(Expr *expr, unsigned &addr)
+{
+    const AccessPath &path = mInfo.getAccessPath(expr);
+    if (!compileExpr(path.base, addr)) return false;
+    if (path.offset) addr = emit(TraceOp::AddImm, addr, 0, path.offset);
+    for (auto &index : path.indices)
+    {
+        unsigned val;
+        if (!compileExpr(index.first, val)) return false;
+        addr = binary(TraceOp::Add, addr, emit(TraceOp::MulImm, val, 0, index.second));
+    }
+    return true;
+}
+
+/// 左值的地址，对应解释器中 bindPtr 记录的值
+bool TraceCompiler::compileAddress(Expr *lvalue, unsigned &addr)
+{
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(lvalue)) {
+        if (!isa<VarDecl>(declref->getDecl())) return false;
+        const FunctionInfo::VarRef &ref = mInfo.getVarRef(declref);
+        if (!ref.memory) return false;
+        addr = emit(ref.global ? TraceOp::Global : TraceOp::Local, ref.slot);
+        return true;
+    }
+    if (isa<ArraySubscriptExpr>(lvalue) || isa<MemberExpr>(lvalue))
+        return compileAccess(lvalue, addr);
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(lvalue))
+        if (uop->getOpcode() == UO_Deref) return compileExpr(uop->getSubExpr(), addr);
+    return false;
+}
+
+/// 与 Environment::bindDecl(Expr *) 相同的写入位置
+bool TraceCompiler::compileLValue(Expr *expr, Place &place)
+{
+    Expr *lvalue = expr->IgnoreParens();
+    place.type = lvalue->getType();
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(lvalue)) {
+        if (!isa<VarDecl>(declref->getDecl())) return false;
+        const FunctionInfo::VarRef &ref = mInfo.getVarRef(declref);
+        if (!ref.memory) {
+            place.kind = ref.global ? Place::Global : Place::Local;
+            place.index = ref.slot;
+            return true;
+        }
+    }
+    place.kind = Place::Memory;
+    return compileAddress(lvalue, place.index);
+}
+
+bool TraceCompiler::guard(unsigned temp, bool expected)
+{
+    // 侧出口从当前语句开始重新解释执行，因此当前语句还不能有副作用
+    if (mDirty || mNoExits) return false;
+    std::vector<Stmt *> resume(1, mStmt);
+    resume.insert(resume.end(), mRest->begin(), mRest->end());
+    mTrace.exits.push_back(resume);
+    mTrace.ops.push_back({TraceOp::Guard, 0, temp, (unsigned)mTrace.exits.size() - 1, expected ? 1 : 0});
+    return true;
+}
+
+unsigned TraceCompiler::emit(TraceOp::Kind kind, unsigned a, unsigned b, int64_t imm)
+{
+    unsigned dst = mTrace.numTemps++;
+    mTrace.ops.push_back({kind, dst, a, b, imm});
+    return dst;
+}
+
+void TraceCompiler::emitEffect(TraceOp::Kind kind, unsigned a, unsigned b)
+{
+    mTrace.ops.push_back({kind, 0, a, b, 0});
+    mDirty = true;
+}
+
+unsigned TraceCompiler::constant(int64_t val)
+{
+    unsigned temp = emit(TraceOp::Const, 0, 0, val);
+    mConstants[temp] = val;
+    return temp;
+}
+
+/// 右侧为常量的加减乘使用带立即数的微操作
+unsigned TraceCompiler::binary(TraceOp::Kind kind, unsigned left, unsigned right)
+{
+    auto iter = mConstants.find(right);
+    if (iter != mConstants.end()) {
+        if (kind == TraceOp::Add) return emit(TraceOp::AddImm, left, 0, iter->second);
+        if (kind == TraceOp::Sub) return emit(TraceOp::AddImm, left, 0, -iter->second);
+        if (kind == TraceOp::Mul) return emit(TraceOp::MulImm, left, 0, iter->second);
+    }
+    return emit(kind, left, right);
+}
+
+/// 指针运算的单位，与 Environment::binop 和 Environment::unaryop 一致
+int64_t TraceCompiler::unitOf(QualType pointee) const
+{
+    if (pointee->isCharType()) return sizeof(char);
+    if (pointee->isIntegerType()) return sizeof(int);
+    if (pointee->isPointerType()) return sizeof(void *);
+    if (pointee->isRecordType() || pointee->isArrayType()) return context.getTypeSizeInChars(pointee).getQuantity();
+    return 1;
+}
+
+/// 指针运算中整数一侧乘以所指类型的大小
+unsigned TraceCompiler::scale(unsigned temp, QualType pointee)
+{
+    int64_t unit = unitOf(pointee);
+    auto iter = mConstants.find(temp);
+    if (iter != mConstants.end()) return constant(iter->second * unit);
+    return unit == 1 ? temp : emit(TraceOp::MulImm, temp, 0, unit);
+}
+
+/// 与 Environment 中的 load 一致：数组和结构体的值为其地址
+unsigned TraceCompiler::load(unsigned addr, QualType type)
+{
+    if (type->isCharType()) return emit(TraceOp::LoadChar, addr);
+    if (type->isIntegerType()) return emit(TraceOp::LoadInt, addr);
+    if (type->isPointerType()) return emit(TraceOp::LoadPtr, addr);
+    return addr;
+}
+
+unsigned TraceCompiler::read(const Place &place)
+{
+    switch (place.kind)
+    {
+        case Place::Local: return emit(TraceOp::Local, place.index);
+        case Place::Global: return emit(TraceOp::Global, place.index);
+        case Place::Memory: return load(place.index, place.type);
+    }
+    return 0;
+}
+
+void TraceCompiler::write(const Place &place, unsigned val)
+{
+    switch (place.kind)
+    {
+        case Place::Local:
+            emitEffect(TraceOp::SetLocal, place.index, val); break;
+        case Place::Global:
+            emitEffect(TraceOp::SetGlobal, place.index, val); break;
+        case Place::Memory:
+            if (place.type->isCharType()) emitEffect(TraceOp::StoreChar, place.index, val);
+            else if (place.type->isIntegerType()) emitEffect(TraceOp::StoreInt, place.index, val);
+            else if (place.type->isPointerType()) emitEffect(TraceOp::StorePtr, place.index, val);
+            break;
+    }
+}
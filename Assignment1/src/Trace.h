@@ -0,0 +1,152 @@
+//==--- Trace.h - Trace compilation of hot loops ------------------------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+
+#include "Prepare.h"
+
+/// trace 中的一条微操作：r[dst] = f(r[a], r[b], imm)，局部变量和全局变量按槽位直接读写
+struct TraceOp
+{
+    enum Kind
+    {
+        Const,                         // r[dst] = imm
+        Local, Global,                 // r[dst] = 槽位 a
+        SetLocal, SetGlobal,           // 槽位 a = r[b]
+        LoadChar, LoadInt, LoadPtr,    // r[dst] = *(T *)r[a]
+        StoreChar, StoreInt, StorePtr, // *(T *)r[a] = r[b]
+        AddImm, MulImm,                // r[dst] = r[a] op imm
+        Add, Sub, Mul, Div, Rem, Shl, Shr, And, Xor, Or, LAnd, LOr,
+        LT, GT, LE, GE, EQ, NE,
+        Neg, Not, LNot,
+        Guard,                         // r[a] 的真值与 imm 不同时从出口 b 离开
+        Iteration,                     // 循环回边，计入执行预算
+    };
+
+    Kind kind;
+    unsigned dst;
+    unsigned a;
+    unsigned b;
+    int64_t imm;
+};
+
+/// 热循环一次迭代的直线代码：循环条件及其守卫、录制时循环体实际走过的分支、for 的步进
+/// C 的类型在编译期确定，只需要守卫分支方向，不需要类型守卫
+struct Trace
+{
+    static const unsigned LoopExit = ~0u; // 循环条件为假，整个循环结束
+
+    std::vector<TraceOp> ops;
+    unsigned numTemps;
+    uint64_t nodes; // 一次迭代对应的 AST 结点数
+    /// 每个侧出口需要解释执行的语句：守卫失败的语句，以及各层复合语句中排在它后面的语句
+    std::vector<std::vector<Stmt *>> exits;
+
+    Trace() : ops(), numTemps(0), nodes(0), exits() {}
+};
+
+/// 录制：解释执行一次迭代时记下每个 if 和三目运算符的方向
+class TraceRecorder
+{
+  public:
+    TraceRecorder() : mBranches(), mConflict(false) {}
+
+    void record(const Stmt *stmt, bool taken)
+    {
+        auto result = mBranches.insert(std::make_pair(stmt, taken));
+        if (!result.second && result.first->second != taken) mConflict = true;
+    }
+    /// 录制时没有执行到返回 false
+    bool lookup(const Stmt *stmt, bool &taken) const
+    {
+        auto iter = mBranches.find(stmt);
+        if (iter == mBranches.end()) return false;
+        taken = iter->second;
+        return true;
+    }
+    /// 同一个分支在一次迭代中走了两个方向
+    bool hasConflict() const { return mConflict; }
+
+  private:
+    llvm::DenseMap<const Stmt *, bool> mBranches;
+    bool mConflict;
+};
+
+/// 单个循环的 trace 状态，由 Environment 按循环保存
+struct TraceState
+{
+    uint64_t iterations; // 解释执行的迭代次数，超过阈值后录制
+    uint64_t traced;     // 当前 trace 执行的迭代次数
+    uint64_t exits;      // 当前 trace 从侧出口离开的次数
+    unsigned attempts;   // 因侧出口过多而丢弃 trace 的次数
+    bool failed;         // 无法编译或控制流不稳定，不再录制
+    std::shared_ptr<const Trace> trace;
+
+    TraceState() : iterations(0), traced(0), exits(0), attempts(0), failed(false), trace() {}
+};
+
+/// --trace-threshold 的执行统计
+struct TraceStats
+{
+    uint64_t compiled;
+    uint64_t iterations;
+    uint64_t sideExits;
+    uint64_t abandoned;
+
+    TraceStats() : compiled(0), iterations(0), sideExits(0), abandoned(0) {}
+};
+
+/// 沿录制的方向把循环编译为 Trace，语义与 Environment 中逐个结点的求值一致
+/// 只支持不含调用、嵌套循环和跳转的循环体，其余情况返回 false，循环继续由解释器执行
+class TraceCompiler
+{
+  public:
+    TraceCompiler(const ASTContext &context, const FunctionInfo &info, const TraceRecorder &recorder, Trace &trace)
+        : context(context), mInfo(info), mRecorder(recorder), mTrace(trace), mConstants(), mStmt(nullptr),
+          mRest(nullptr), mDirty(false), mNoExits(false){}
+
+    bool compile(Expr *cond, Stmt *body, Expr *inc);
+
+  private:
+    /// 赋值的目标：槽位中的变量，或者 temp 中的内存地址
+    struct Place
+    {
+        enum Kind { Local, Global, Memory };
+        Kind kind;
+        unsigned index;
+        QualType type;
+    };
+
+    bool compileStmt(Stmt *, const std::vector<Stmt *> &rest);
+    bool compileExpr(Expr *, unsigned &temp);
+    bool compileUnary(UnaryOperator *, unsigned &temp);
+    bool compileBinary(BinaryOperator *, unsigned &temp);
+    bool compileAccess(Expr *, unsigned &addr);
+    bool compileAddress(Expr *, unsigned &addr);
+    bool compileLValue(Expr *, Place &);
+    /// 在当前语句处放置守卫，失败时从当前语句开始解释执行
+    bool guard(unsigned temp, bool expected);
+
+    unsigned emit(TraceOp::Kind, unsigned a = 0, unsigned b = 0, int64_t imm = 0);
+    void emitEffect(TraceOp::Kind, unsigned a, unsigned b);
+    unsigned constant(int64_t);
+    unsigned binary(TraceOp::Kind, unsigned left, unsigned right);
+    int64_t unitOf(QualType pointee) const;
+    unsigned scale(unsigned temp, QualType pointee);
+    unsigned load(unsigned addr, QualType);
+    unsigned read(const Place &);
+    void write(const Place &, unsigned val);
+
+    const ASTContext &context;
+    const FunctionInfo &mInfo;
+    const TraceRecorder &mRecorder;
+    Trace &mTrace;
+    llvm::DenseMap<unsigned, int64_t> mConstants; // 值为常量的 temp
+    Stmt *mStmt;                                  // 当前编译的语句
+    const std::vector<Stmt *> *mRest;             // 当前语句之后本次迭代余下的语句
+    bool mDirty;                                  // 当前语句已经产生副作用，之后不能再放置守卫
+    bool mNoExits;                                // 循环条件和步进中不能有侧出口
+};
@@ -0,0 +1,270 @@
+#include "Verifier.h"
+#include "Environment.h"
+
+Verifier::Verifier(const ASTContext &context, const Environment &env)
+    : context(context), mEnv(env), mDiags(context.getDiagnostics()), mErrors(0), mWorklist(), mVisited(), mAddressTaken()
+{
+    mUnsupportedID = mDiags.getCustomDiagID(DiagnosticsEngine::Error, "%0 is not supported by the interpreter");
+    mTypeID = mDiags.getCustomDiagID(DiagnosticsEngine::Error, "type %0 is not supported by the interpreter");
+    mUndefinedID = mDiags.getCustomDiagID(DiagnosticsEngine::Error, "function %0 is called but never defined");
+    mNoEntryID = mDiags.getCustomDiagID(DiagnosticsEngine::Error, "no 'main' function to interpret");
+}
+
+bool Verifier::verify(TranslationUnitDecl *unit)
+{
+    for (auto *SubDecl : unit->decls())
+    {
+        if (VarDecl *vardecl = dyn_cast<VarDecl>(SubDecl)) checkVar(vardecl);
+    }
+
+    FunctionDecl *entry = mEnv.getEntry();
+    if (entry == nullptr || !entry->isDefined()) {
+        mDiags.Report(unit->getLocation(), mNoEntryID);
+        return false;
+    }
+
+    // 只检查可达的函数：未被调用的函数里即使有不支持的结构也不影响执行
+    mWorklist.push_back(entry->getDefinition());
+    mVisited.insert(entry->getDefinition());
+    while (!mWorklist.empty())
+    {
+        FunctionDecl *fdecl = mWorklist.back();
+        mWorklist.pop_back();
+        checkFunction(fdecl);
+    }
+    return mErrors == 0;
+}
+
+void Verifier::checkFunction(FunctionDecl *fdecl)
+{
+    QualType retType = fdecl->getReturnType();
+    if (!retType->isVoidType() && !isValueType(retType))
+        unsupportedType(fdecl->getLocation(), retType);
+    if (fdecl->isVariadic())
+        unsupported(fdecl->getLocation(), "variadic function");
+    for (unsigned i = 0; i < fdecl->getNumParams(); ++i)
+        checkVar(fdecl->getParamDecl(i));
+    checkStmt(fdecl->getBody());
+}
+
+void Verifier::checkVar(VarDecl *vardecl)
+{
+    QualType type = vardecl->getType();
+    if (vardecl->isStaticLocal()) {
+        unsupported(vardecl->getLocation(), "static local variable");
+        return;
+    }
+
+    if (isa<ConstantArrayType>(type.getTypePtr()) || type->isRecordType()) {
+        if (!isObjectType(type)) unsupportedType(vardecl->getLocation(), type);
+        // 数组和结构体只支持零初始化
+        if (vardecl->hasInit()) unsupported(vardecl->getInit()->getBeginLoc(), "aggregate initializer");
+        return;
+    }
+
+    if (!isValueType(type)) unsupportedType(vardecl->getLocation(), type);
+    if (vardecl->hasInit()) checkExpr(vardecl->getInit());
+}
+
+void Verifier::checkStmt(Stmt *stmt)
+{
+    if (stmt == nullptr) return;
+
+    if (Expr *expr = dyn_cast<Expr>(stmt)) {
+        checkExpr(expr);
+        return;
+    }
+
+    if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt)) {
+        // 其余的声明（typedef 等）不参与执行
+        for (auto *SubDecl : declstmt->decls())
+            if (VarDecl *vardecl = dyn_cast_or_null<VarDecl>(SubDecl)) checkVar(vardecl);
+        return;
+    }
+
+    if (SwitchStmt *switchstmt = dyn_cast<SwitchStmt>(stmt))
+        checkSwitch(switchstmt);
+    else if (CaseStmt *casestmt = dyn_cast<CaseStmt>(stmt)) {
+        if (casestmt->caseStmtIsGNURange()) unsupported(casestmt->getBeginLoc(), "case range");
+    }
+
+    if (isa<CompoundStmt>(stmt) || isa<NullStmt>(stmt) || isa<IfStmt>(stmt) ||
+        isa<WhileStmt>(stmt) || isa<ForStmt>(stmt) || isa<ReturnStmt>(stmt) ||
+        isa<BreakStmt>(stmt) || isa<ContinueStmt>(stmt) || isa<SwitchStmt>(stmt) ||
+        isa<CaseStmt>(stmt) || isa<DefaultStmt>(stmt)) {
+        for (auto *SubStmt : stmt->children())
+            checkStmt(SubStmt);
+        return;
+    }
+
+    unsupported(stmt->getBeginLoc(), stmt->getStmtClassName());
+}
+
+void Verifier::checkExpr(Expr *expr)
+{
+    QualType type = expr->getType();
+
+    // 整数常量表达式在预处理时被折叠，执行时不会访问其子结点
+    llvm::APSInt result;
+    if ((type->isIntegerType() || type->isCharType()) && expr->isIntegerConstantExpr(result, context))
+        return;
+
+    if (isa<IntegerLiteral>(expr) || isa<CharacterLiteral>(expr)) return;
+
+    if (CallExpr *call = dyn_cast<CallExpr>(expr)) {
+        checkCall(call);
+        return;
+    }
+
+    // 结构体只能作为左值出现在成员访问的基址中，不支持整体的复制
+    bool aggregate = type->isArrayType() || (type->isRecordType() && expr->isLValue());
+    if (!type->isVoidType() && !aggregate && !isValueType(type)) {
+        unsupportedType(expr->getBeginLoc(), type);
+        return;
+    }
+
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr)) {
+        switch (bop->getOpcode())
+        {
+            case BO_PtrMemD: case BO_PtrMemI: case BO_Cmp: case BO_Comma:
+                unsupported(bop->getOperatorLoc(), "operator '" + BinaryOperator::getOpcodeStr(bop->getOpcode()).str() + "'");
+                return;
+            default:
+                break;
+        }
+        if (bop->isAssignmentOp()) checkLValue(bop->getLHS());
+    }
+    else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr)) {
+        switch (uop->getOpcode())
+        {
+            case UO_PostInc: case UO_PostDec: case UO_PreInc: case UO_PreDec:
+                checkLValue(uop->getSubExpr());
+                break;
+            case UO_AddrOf:
+                // 取了地址的全局标量放在内存中，与 Preparer::escapes 一致只看 &g 和 &(g)
+                if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(uop->getSubExpr()->IgnoreParens()))
+                    if (VarDecl *vardecl = dyn_cast<VarDecl>(declref->getDecl()))
+                        if (vardecl->hasGlobalStorage()) mAddressTaken.insert(vardecl->getCanonicalDecl());
+                break;
+            case UO_Minus: case UO_Plus: case UO_Not: case UO_LNot: case UO_Deref:
+                break;
+            default:
+                unsupported(uop->getBeginLoc(), "operator '" + UnaryOperator::getOpcodeStr(uop->getOpcode()).str() + "'");
+                return;
+        }
+    }
+    else if (UnaryExprOrTypeTraitExpr *ueott = dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+        // sizeof 的操作数不求值
+        if (ueott->getKind() != UETT_SizeOf) unsupported(ueott->getBeginLoc(), "type trait expression");
+        return;
+    }
+    else if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+        // 函数只能出现在直接调用的位置，由 checkCall 处理
+        if (!isa<VarDecl>(declref->getDecl())) unsupported(declref->getBeginLoc(), "reference to a non-variable declaration");
+        return;
+    }
+    else if (CastExpr *castexpr = dyn_cast<CastExpr>(expr)) {
+        if (type->isVoidType()) {
+            unsupported(castexpr->getBeginLoc(), "cast to void");
+            return;
+        }
+    }
+    else if (!isa<ParenExpr>(expr) && !isa<ConditionalOperator>(expr) && !isa<ArraySubscriptExpr>(expr) &&
+             !isa<MemberExpr>(expr)) {
+        unsupported(expr->getBeginLoc(), expr->getStmtClassName());
+        return;
+    }
+
+    for (auto *SubStmt : expr->children())
+        if (SubStmt) checkExpr(cast<Expr>(SubStmt));
+}
+
+/// 分派表只记录 switch 体顶层语句的下标，嵌套在其他语句里的标号无法跳转到达
+void Verifier::checkSwitch(SwitchStmt *switchstmt)
+{
+    std::vector<Stmt *> stmts;
+    Stmt *body = switchstmt->getBody();
+    if (CompoundStmt *compound = dyn_cast<CompoundStmt>(body))
+        stmts.assign(compound->body_begin(), compound->body_end());
+    else
+        stmts.push_back(body);
+
+    llvm::DenseSet<const SwitchCase *> reachable;
+    for (Stmt *stmt : stmts)
+        for (; SwitchCase *label = dyn_cast<SwitchCase>(stmt); stmt = label->getSubStmt())
+            reachable.insert(label);
+
+    for (SwitchCase *label = switchstmt->getSwitchCaseList(); label; label = label->getNextSwitchCase())
+        if (!reachable.count(label)) unsupported(label->getKeywordLoc(), "case label nested inside another statement");
+}
+
+void Verifier::checkCall(CallExpr *call)
+{
+    FunctionDecl *callee = call->getDirectCallee();
+    if (callee == nullptr) {
+        unsupported(call->getBeginLoc(), "indirect call");
+        return;
+    }
+
+    if (!mEnv.isBuildIn(callee)) {
+        if (!callee->isDefined()) {
+            undefined(call->getBeginLoc(), callee);
+            return;
+        }
+        FunctionDecl *definition = callee->getDefinition();
+        if (mVisited.insert(definition).second) mWorklist.push_back(definition);
+    }
+
+    // 不访问被调函数的表达式，只检查实参
+    for (unsigned i = 0; i < call->getNumArgs(); ++i)
+        checkExpr(call->getArg(i));
+}
+
+/// 赋值的左侧只能是变量、数组元素或解引用，与 Environment::bindDecl 一致
+void Verifier::checkLValue(Expr *expr)
+{
+    Expr *lvalue = expr->IgnoreParens();
+    if (isa<DeclRefExpr>(lvalue) || isa<ArraySubscriptExpr>(lvalue) || isa<MemberExpr>(lvalue)) return;
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(lvalue))
+        if (uop->getOpcode() == UO_Deref) return;
+    unsupported(expr->getBeginLoc(), "assignment to this kind of expression");
+}
+
+bool Verifier::isValueType(QualType type)
+{
+    return type->isCharType() || type->isIntegerType() ||
+           (type->isPointerType() && !type->isFunctionPointerType());
+}
+
+bool Verifier::isObjectType(QualType type)
+{
+    if (isValueType(type)) return true;
+    if (const ConstantArrayType *array = dyn_cast<ConstantArrayType>(type.getTypePtr()))
+        return isObjectType(array->getElementType());
+    if (const RecordType *record = type->getAs<RecordType>()) {
+        RecordDecl *decl = record->getDecl()->getDefinition();
+        if (decl == nullptr) return false;
+        for (FieldDecl *field : decl->fields())
+            if (field->isBitField() || !isObjectType(field->getType())) return false;
+        return true;
+    }
+    return false;
+}
+
+void Verifier::unsupported(SourceLocation loc, StringRef what)
+{
+    ++mErrors;
+    mDiags.Report(loc, mUnsupportedID) << what;
+}
+
+void Verifier::unsupportedType(SourceLocation loc, QualType type)
+{
+    ++mErrors;
+    mDiags.Report(loc, mTypeID) << type;
+}
+
+void Verifier::undefined(SourceLocation loc, const FunctionDecl *callee)
+{
+    ++mErrors;
+    mDiags.Report(loc, mUndefinedID) << callee->getName();
+}
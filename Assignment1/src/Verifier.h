@@ -0,0 +1,60 @@
+//==--- Verifier.h - Static verification before interpretation -------------===//
+//===----------------------------------------------------------------------===//
+#pragma once
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/Basic/Diagnostic.h"
+#include "llvm/ADT/DenseSet.h"
+
+using namespace clang;
+
+class Environment;
+
+/// 执行前的一次性静态检查
+/// 遍历从 main 以及全局变量初始化可达的函数，对解释器不支持的语法结构和类型
+/// 给出带源码位置的诊断。程序通过检查后，Environment 中的求值函数不再做
+/// 逐结点的合法性检查，也不再有 dump() 兜底
+class Verifier
+{
+  public:
+    Verifier(const ASTContext &context, const Environment &env);
+
+    /// 返回 false 时错误已经通过 DiagnosticsEngine 报告
+    bool verify(TranslationUnitDecl *unit);
+    /// 可达代码（包括全局变量的初始化表达式）中取了地址的全局变量，以规范声明为键
+    const llvm::DenseSet<const VarDecl *> &getAddressTaken() const { return mAddressTaken; }
+
+  private:
+    void checkFunction(FunctionDecl *);
+    void checkVar(VarDecl *);
+    void checkStmt(Stmt *);
+    void checkExpr(Expr *);
+    void checkSwitch(SwitchStmt *);
+    void checkCall(CallExpr *);
+    void checkLValue(Expr *);
+
+    /// 解释器中所有的值都是 char、整数或（非函数）指针
+    static bool isValueType(QualType);
+    /// 可以声明为变量的类型：值类型，以及由值类型组成的多维数组和结构体
+    static bool isObjectType(QualType);
+
+    void unsupported(SourceLocation, StringRef what);
+    void unsupportedType(SourceLocation, QualType);
+    /// 调用了没有定义的函数：不检查时执行到调用处没有函数体可以求值
+    void undefined(SourceLocation, const FunctionDecl *callee);
+
+    const ASTContext &context;
+    const Environment &mEnv;
+    DiagnosticsEngine &mDiags;
+    unsigned mUnsupportedID;
+    unsigned mTypeID;
+    unsigned mUndefinedID;
+    unsigned mNoEntryID;
+    unsigned mErrors;
+
+    std::vector<FunctionDecl *> mWorklist;
+    llvm::DenseSet<const FunctionDecl *> mVisited;
+    llvm::DenseSet<const VarDecl *> mAddressTaken;
+};
@@ -0,0 +1,66 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+struct Point {
+    int x;
+    char tag;
+    int y;
+};
+
+struct Shape {
+    struct Point corners[4];
+    int id;
+};
+
+int grid[3][4];
+struct Shape shapes[2];
+
+int sum(int *row, int n) {
+    int s = 0;
+    for (int i = 0; i < n; i++)
+        s = s + row[i];
+    return s;
+}
+
+int main() {
+    int local[2][3][2];
+    struct Point p;
+    struct Point *q;
+
+    // Multi-dimensional arrays
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 4; j++)
+            grid[i][j] = i * 10 + j;
+    PRINT(grid[2][3]);
+    PRINT(sum(grid[1], 4));
+
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 2; k++)
+                local[i][j][k] = i - j + k;
+    PRINT(local[1][2][1] + local[0][1][0]);
+
+    // Structs
+    p.x = 7;
+    p.tag = 'p';
+    p.y = p.x * 3;
+    PRINT(p.x + p.y);
+    PRINT(p.tag);
+
+    q = shapes[1].corners + 2;
+    q->x = 5;
+    q->y = q->x + 1;
+    shapes[1].id = 9;
+    PRINT(shapes[1].corners[2].y);
+    PRINT(shapes[1].id + shapes[0].corners[3].x);
+
+    q = (struct Point *)MALLOC(sizeof(struct Point) * 2);
+    (q + 1)->x = 42;
+    PRINT(q[1].x);
+    FREE(q);
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+int classify(int c) {
+    switch (c) {
+        case ' ': case '\t': case '\n':
+            return 0;
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return 1;
+        case '+': case '-': case '*': case '/':
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+int sparse(int x) {
+    int r = 0;
+    switch (x) {
+        case -100000: r = 1; break;
+        case 7: r = 2;
+        case 1000: r = r + 3; break;
+        default: r = -1;
+        case 123456789: r = r + 10;
+    }
+    return r;
+}
+
+int main() {
+    char text[8];
+    int state, acc, i;
+
+    text[0] = '1'; text[1] = '2'; text[2] = ' '; text[3] = '+';
+    text[4] = '3'; text[5] = 'x'; text[6] = '9'; text[7] = 0;
+
+    // 简单的状态机：累加数字，遇到运算符输出
+    state = 0;
+    acc = 0;
+    for (i = 0; text[i] != 0; i++) {
+        switch (classify(text[i])) {
+            case 1:
+                acc = acc * 10 + (text[i] - '0');
+                state = 1;
+                break;
+            case 0:
+                if (state == 1) PRINT(acc);
+                acc = 0;
+                state = 0;
+                continue;
+            case 2:
+                PRINT(-text[i]);
+                break;
+            default:
+                PRINT(999);
+        }
+        PRINT(state);
+    }
+    PRINT(acc);
+
+    PRINT(sparse(-100000));
+    PRINT(sparse(7));
+    PRINT(sparse(1000));
+    PRINT(sparse(123456789));
+    PRINT(sparse(5));
+
+    switch (acc) {
+    }
+    switch (acc)
+        case 39: PRINT(39);
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+int counter;
+int total = 100;
+extern int later;
+int table[4];
+
+void bump(int n) {
+    counter = counter + n;
+    total = total - n;
+    later = later + 1;
+    table[n % 4] = counter;
+}
+
+int read() {
+    return counter * 1000 + later;
+}
+
+int later = 7;
+int later;
+
+int main() {
+    int i;
+    int counter = -1; // 局部变量遮蔽全局变量
+
+    for (i = 1; i <= 5; i++)
+        bump(i);
+    PRINT(counter);
+    PRINT(read());
+    PRINT(total);
+    PRINT(table[0] + table[1] + table[2] + table[3]);
+    PRINT(later);
+    return 0;
+}
@@ -0,0 +1,62 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+int g;
+int *gp = &g;
+
+void swap(int *a, int *b) {
+    int t = *a;
+    *a = *b;
+    *b = t;
+}
+
+void inc(int *p) {
+    *p = *p + 1;
+}
+
+int twice(int x) {
+    int *p = &x; // 取地址的参数
+    *p = *p * 2;
+    return x;
+}
+
+int main() {
+    int x = 3, y = -4;
+    char c = 'a';
+    char *pc = &c;
+    int *pp;
+    int **ppp;
+    int arr[3];
+
+    swap(&x, &y);
+    PRINT(x);
+    PRINT(y);
+
+    *pc = 'z';
+    PRINT(c);
+
+    inc(&g);
+    inc(gp);
+    PRINT(g);
+
+    pp = &x;
+    ppp = &pp;
+    **ppp = 100;
+    PRINT(x);
+
+    arr[1] = 5;
+    pp = &arr[1];
+    *pp += 10;
+    PRINT(arr[1]);
+
+    PRINT(twice(21));
+    for (int i = 0; i < 3; i++) {
+        int k = i;
+        inc(&k);
+        PRINT(k);
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+struct Pair {
+    int lo;
+    int hi;
+};
+
+int calls;
+int table[4];
+
+// 纯函数：只写局部变量，递归调用自身
+int fib(int n) {
+    int a[2];
+    if (n < 2) return n;
+    a[0] = n - 1;
+    a[1] = n - 2;
+    return fib(a[0]) + fib(a[1]);
+}
+
+// 纯函数：读全局数组，写局部结构体
+int span(int n) {
+    struct Pair p;
+    int i;
+    p.lo = table[0];
+    p.hi = table[0];
+    for (i = 0; i < n; i = i + 1) {
+        if (table[i & 3] < p.lo) p.lo = table[i & 3];
+        if (table[i & 3] > p.hi) p.hi = table[i & 3];
+    }
+    return p.hi - p.lo;
+}
+
+// 写全局变量，不是纯函数，不能分叉求值
+int count(int n) {
+    calls = calls + 1;
+    return n * 2;
+}
+
+// 经由指针写调用者的内存，不是纯函数
+int fill(int *p, int n) {
+    int i;
+    for (i = 0; i < n; i = i + 1) p[i] = i * n;
+    return p[n - 1];
+}
+
+int main() {
+    int buf[4];
+    table[0] = 7;
+    table[1] = -3;
+    table[2] = 12;
+    table[3] = 5;
+
+    PRINT(fib(15) + fib(14));
+    PRINT(fib(10) - span(8));
+    PRINT(count(2) + count(3));
+    PRINT(fill(buf, 2) + fill(buf + 2, 2));
+    PRINT(buf[0] + buf[1] + buf[2] + buf[3]);
+    PRINT(calls);
+    return 0;
+}
@@ -0,0 +1,90 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+struct Cell {
+    int key;
+    char tag;
+    int *next;
+};
+
+int total;
+char text[64];
+
+int main() {
+    int a[100];
+    struct Cell cells[8];
+    int i, j, sum, odd, hits;
+    int x;
+    int *p;
+    int *q;
+    char *s;
+
+    // 稳定的控制流：整个循环体都在 trace 中
+    sum = 0;
+    for (i = 0; i < 100; i++) {
+        a[i] = (i * 7) % 13;
+        sum += a[i] << 1;
+    }
+    PRINT(sum);
+
+    // 很少走的分支：从侧出口回到解释器，break 和 continue 也在侧出口之后执行
+    odd = 0;
+    hits = 0;
+    for (i = 0; i < 100; ++i) {
+        if (a[i] == 12) {
+            hits = hits + 1;
+            continue;
+        }
+        if (i > 90 && a[i] > 10) break;
+        odd = odd + (a[i] & 1 ? a[i] : -1);
+    }
+    PRINT(odd);
+    PRINT(hits);
+    PRINT(i);
+
+    // 交替的分支：侧出口过多时放弃 trace，结果不受影响
+    sum = 0;
+    for (i = 0; i < 100; i++) {
+        if (i % 2) sum = sum + i;
+        else sum = sum - 1;
+    }
+    PRINT(sum);
+
+    // 指针、取地址的标量、全局变量和字符数组
+    x = 3;
+    p = &x;
+    q = a;
+    s = text;
+    i = 0;
+    while (i < 60) {
+        *p = *p * 3 % 1000;
+        total += *q++;
+        *s++ = 'a' + i % 26;
+        i = i + 2;
+    }
+    PRINT(x);
+    PRINT(total);
+    PRINT(text[0] + text[29]);
+
+    // 结构体成员和声明在循环体内的变量
+    for (i = 0; i < 8; i++) {
+        cells[i].key = i * i;
+        cells[i].tag = 'A' + i;
+        cells[i].next = &cells[(i + 1) % 8].key;
+    }
+    sum = 0;
+    j = 0;
+    for (i = 0; i < 80; i++) {
+        int k = j;
+        int w;
+        j = *cells[k].next % 8;
+        w = cells[k].tag;
+        sum = sum + w + k;
+    }
+    PRINT(sum);
+    PRINT(j);
+    return 0;
+}
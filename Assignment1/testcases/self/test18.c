@@ -0,0 +1,75 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+int counter;
+
+// 只有末尾的 return
+int square(int x) {
+    return x * x;
+}
+
+// 提前 return，局部变量在每次调用时重新初始化
+int clamp(int x, int lo, int hi) {
+    int y;
+    if (x < lo) return lo;
+    if (x > hi) {
+        y = hi;
+        return y;
+    }
+    return x;
+}
+
+// 没有 return 的 void 函数，通过指针参数写调用方的数组
+void bump(int *p, int n) {
+    *p = *p + n;
+    counter = counter + 1;
+}
+
+// 调用其他可以内联的函数
+int norm(int a, int b) {
+    return clamp(square(a) + square(b), 0, 100);
+}
+
+// 递归函数不内联
+int fact(int n) {
+    if (n <= 1) return 1;
+    return n * fact(n - 1);
+}
+
+// return 在循环中，不内联
+int find(int *a, int n, int v) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (a[i] == v) return i;
+    }
+    return -1;
+}
+
+int main() {
+    int a[10];
+    int i, sum;
+    int x;
+
+    for (i = 0; i < 10; i++) a[i] = square(i) - 20;
+    sum = 0;
+    for (i = 0; i < 10; i++) {
+        sum = sum + clamp(a[i], -5, 30);
+        bump(&a[i], i);
+    }
+    PRINT(sum);
+    PRINT(a[9]);
+    PRINT(counter);
+
+    // 同一个函数在一个表达式中多次内联，以及作为自身的实参
+    x = square(3) + square(4);
+    PRINT(x);
+    PRINT(square(square(2)));
+    PRINT(clamp(clamp(50, 0, 40), 10, 20));
+    PRINT(norm(3, 4) + norm(9, 9));
+    PRINT(fact(6));
+    PRINT(find(a, 10, a[7]));
+    return 0;
+}
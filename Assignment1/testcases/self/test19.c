@@ -0,0 +1,67 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+struct Node {
+    int val;
+    struct Node *next;
+};
+
+int table[16];
+int *cursor;
+
+int step(int x) {
+    int i;
+    for (i = 0; i < 3; i++)
+        x = (x * 5 + 1) % 97;
+    return x;
+}
+
+int main() {
+    int a[10];
+    int i, j, n, sum;
+    int *p;
+    struct Node *head;
+    struct Node *node;
+
+    // 检查点中的指针：指向栈帧中的数组、堆上的链表和全局数组
+    head = 0;
+    p = a;
+    cursor = table;
+    for (i = 0; i < 10; i++) {
+        a[i] = i * 3;
+        node = (struct Node *)MALLOC(sizeof(struct Node));
+        node->val = step(i);
+        node->next = head;
+        head = node;
+        *cursor = node->val;
+        cursor = cursor + 1;
+    }
+
+    // 读取输入的外层循环和嵌套的内层循环
+    sum = 0;
+    n = 0;
+    while (n < 5) {
+        int k;
+        k = GET();
+        for (j = 0; j < 10; j++) {
+            if (j % 2) sum = sum + p[j] * k;
+            else sum = sum - table[j];
+        }
+        PRINT(sum);
+        n = n + 1;
+    }
+
+    node = head;
+    while (node != 0) {
+        sum = sum + node->val;
+        head = node->next;
+        FREE(node);
+        node = head;
+    }
+    PRINT(sum);
+    PRINT(cursor == table + 10);
+    return 0;
+}
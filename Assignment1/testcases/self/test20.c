@@ -0,0 +1,55 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+int a[2048];
+int b[2048];
+int c[2048];
+
+int main() {
+    int i, n, sum;
+    int *p;
+
+    // 迭代次数不少于 MinParallelTrips，--parallel-loops 时才会真正切分到线程上
+    n = 1024;
+    for (i = 0; i < n; i++) {
+        a[i] = i % 7;
+        b[i] = i % 5;
+    }
+
+    // 迭代相互独立，循环体内的数组每次迭代私有：可以并行执行
+    for (i = 0; i < n; i++) {
+        int t[2];
+        t[0] = a[i] * 3;
+        t[1] = t[0] + b[i];
+        c[i] = t[1];
+    }
+
+    // p[i] 写入的是 a[i + 1]：基址在运行时重叠，必须顺序执行
+    p = a + 1;
+    for (i = 0; i < n; i++)
+        p[i] = a[i] + 1;
+
+    // 循环体内的指针不是私有的存储，r[i + 1] 依赖上一次迭代写入的 b[i]
+    for (i = 0; i < n; i++) {
+        int *r = b;
+        r[i + 1] = b[i] + 2;
+    }
+
+    // 每次迭代都写同一个元素，顺序执行时留下最后一次迭代的值
+    for (i = 0; i < n; i++) {
+        int *q = c + n;
+        q[0] = i;
+    }
+
+    sum = 0;
+    for (i = 0; i < n; i++)
+        sum = sum + a[i] + b[i] * 2 + c[i];
+    PRINT(sum);
+    PRINT(a[n]);
+    PRINT(b[n]);
+    PRINT(c[n]);
+    return 0;
+}
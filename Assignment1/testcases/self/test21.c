@@ -0,0 +1,75 @@
+// extern Function declarations
+extern int GET();
+extern void* MALLOC(int);
+extern void FREE(void*);
+extern void PRINT(int);
+
+// 37 = 4 * 8 + 5 个 int，87 = 2 * 32 + 16 + 7 个 char：SIMD 内核的主循环之后都还有尾部
+int a[37];
+int b[37];
+int c[37];
+char x[87];
+char y[87];
+char z[87];
+
+int main() {
+    int i, n, k, s, m;
+    int *p;
+    char *q;
+
+    n = 37;
+    k = 87;
+    for (i = 0; i < n; i++) b[i] = i * 7 - 100;
+    for (i = 0; i < k; i++) x[i] = i * 5 - 170;
+
+    // int 的 Fill、Copy、Add、Mul
+    for (i = 0; i < n; i++) a[i] = 3;
+    for (i = 0; i < n; i++) c[i] = b[i];
+    for (i = 0; i < n; i++) c[i] = a[i] + c[i];
+    for (i = 0; i < n; i++) a[i] = b[i] * c[i];
+
+    // int 的 Sum、Min、Max
+    s = 0;
+    for (i = 0; i < n; i++) s += a[i];
+    PRINT(s);
+    s = 0;
+    for (i = 0; i < n; i++) s = c[i] + s;
+    PRINT(s);
+    m = c[n - 1];
+    for (i = 0; i < n; i++) if (c[i] < m) m = c[i];
+    PRINT(m);
+    m = b[0];
+    for (i = 0; i < n; i++) if (m < b[i]) m = b[i];
+    PRINT(m);
+
+    // char 的运算按 8 位截断，包括负数
+    for (i = 0; i < k; i++) y[i] = -3;
+    for (i = 0; i < k; i++) z[i] = x[i];
+    for (i = 0; i < k; i++) z[i] = z[i] + y[i];
+    for (i = 0; i < k; i++) y[i] = x[i] * z[i];
+
+    // char 的 Sum、Min、Max 按有符号数比较和累加
+    s = 0;
+    for (i = 0; i < k; i++) s += y[i];
+    PRINT(s);
+    s = 0;
+    for (i = 0; i < k; i++) s += z[i];
+    PRINT(s);
+    m = 0;
+    for (i = 0; i < k; i++) if (z[i] <= m) m = z[i];
+    PRINT(m);
+    m = -128;
+    for (i = 0; i < k; i++) if (y[i] > m) m = y[i];
+    PRINT(m);
+
+    // 目标与操作数部分重叠：不能交给内核，逐次迭代执行
+    p = a + 1;
+    for (i = 0; i < n - 1; i++) p[i] = a[i];
+    PRINT(a[n - 1]);
+    q = x + 3;
+    for (i = 0; i < k - 3; i++) q[i] = x[i] + z[i];
+    s = 0;
+    for (i = 0; i < k; i++) s += x[i];
+    PRINT(s);
+    return 0;
+}
@@ -32,11 +32,24 @@
 
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Hashing.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 namespace self {
     bool useErrs = true, useErrsInsteadOuts = false;
+    /// 输出到 nulls() 也要格式化，打印整个函数之类的开销大的输出先检查
+    bool hasErrs() {
+        return useErrs && !useErrsInsteadOuts;
+    }
     llvm::raw_ostream &errs() {
-        return useErrs && !useErrsInsteadOuts ? llvm::errs() : llvm::nulls();
+        return hasErrs() ? llvm::errs() : llvm::nulls();
     }
     llvm::raw_ostream &outs() {
         return useErrsInsteadOuts ? llvm::errs() : llvm::outs();
@@ -65,16 +78,282 @@ struct EnableFunctionOptPass : public FunctionPass
 
 char EnableFunctionOptPass::ID = 0;
 
+/// 每个函数体内的调用点、返回值和 phi 结点，分析开始前扫描模块一次，之后的遍历只访问这些指令。
+/// 各函数的指令在平坦的数组中按模块顺序连续存放
+struct ModuleIndex
+{
+    struct Range
+    {
+        unsigned callBegin, callEnd;
+        unsigned retBegin, retEnd;
+        unsigned phiBegin, phiEnd;
+    };
+    std::vector<CallInst *> calls;
+    std::vector<Value *> retvals;
+    std::vector<PHINode *> phis;
+    DenseMap<Function *, Range> ranges;
+
+    void build(Module &M)
+    {
+        for (Function &func : M) {
+            if (func.isDeclaration()) continue;
+            Range range;
+            range.callBegin = calls.size(), range.retBegin = retvals.size(), range.phiBegin = phis.size();
+            for (BasicBlock &block : func) {
+                for (Instruction &inst : block) {
+                    if (PHINode *phinode = dyn_cast<PHINode>(&inst)) phis.push_back(phinode);
+                    else if (ReturnInst *returninst = dyn_cast<ReturnInst>(&inst)) {
+                        if (Value *retval = returninst->getReturnValue()) retvals.push_back(retval);
+                    }
+                    else if (isa<llvm::DbgInfoIntrinsic>(inst)) continue;
+                    else if (CallInst *callinst = dyn_cast<CallInst>(&inst)) calls.push_back(callinst);
+                }
+            }
+            range.callEnd = calls.size(), range.retEnd = retvals.size(), range.phiEnd = phis.size();
+            ranges[&func] = range;
+        }
+    }
+
+    /// 声明没有函数体，返回空
+    ArrayRef<CallInst *> callsOf(Function *func) const
+    {
+        auto iter = ranges.find(func);
+        if (iter == ranges.end()) return {};
+        return makeArrayRef(calls).slice(iter->second.callBegin, iter->second.callEnd - iter->second.callBegin);
+    }
+
+    ArrayRef<Value *> returnsOf(Function *func) const
+    {
+        auto iter = ranges.find(func);
+        if (iter == ranges.end()) return {};
+        return makeArrayRef(retvals).slice(iter->second.retBegin, iter->second.retEnd - iter->second.retBegin);
+    }
+
+    ArrayRef<PHINode *> phisOf(Function *func) const
+    {
+        auto iter = ranges.find(func);
+        if (iter == ranges.end()) return {};
+        return makeArrayRef(phis).slice(iter->second.phiBegin, iter->second.phiEnd - iter->second.phiBegin);
+    }
+};
+
+/// 上下文无关的函数指针分析：在值流图上单调地传播函数集合，直到不动点。
+/// 结点是形参、phi 结点、调用的返回值和每个函数的返回值，边在被调用值指向新的函数时加入；
+/// 集合只增不减且只包含模块中的函数，因此一定终止，最小不动点与传播顺序无关
+struct FlowGraph
+{
+    std::map<Value *, unsigned> nodes;
+    std::map<Function *, unsigned> returns;               // 函数 -> 返回值的结点
+    std::vector<std::set<Function *> > pointsTo;
+    std::vector<std::vector<unsigned> > succs;
+    std::vector<std::vector<CallInst *> > calls;          // 结点作为被调用值的调用点
+    std::map<CallInst *, std::set<Function *> > callees; // 调用点 -> 被调用的函数
+    std::deque<unsigned> worklist;
+    std::vector<bool> queued;
+
+    void build(Module &M, const ModuleIndex &index)
+    {
+        for (Function &func : M) {
+            for (PHINode *phinode : index.phisOf(&func))
+                for (Value *incomingvalue : phinode->incoming_values())
+                    flow(incomingvalue, node(phinode));
+            for (Value *retval : index.returnsOf(&func))
+                flow(retval, returnNode(&func));
+            for (CallInst *callinst : index.callsOf(&func)) {
+                Value *operand = callinst->getCalledOperand();
+                if (Function *callee = dyn_cast<Function>(operand)) link(callinst, callee);
+                else if (tracked(operand)) calls[node(operand)].push_back(callinst);
+            }
+        }
+    }
+
+    void solve()
+    {
+        while (!worklist.empty())
+        {
+            unsigned n = worklist.front();
+            worklist.pop_front();
+            queued[n] = false;
+            // 加入边时可能扩容，不能持有引用
+            for (size_t i = 0; i < succs[n].size(); ++i)
+                propagate(n, succs[n][i]);
+            for (size_t i = 0; i < calls[n].size(); ++i) {
+                std::vector<Function *> targets(pointsTo[n].begin(), pointsTo[n].end());
+                for (Function *callee : targets)
+                    link(calls[n][i], callee);
+            }
+        }
+    }
+
+    /// 值可能指向的函数，不支持的值为空集
+    std::set<Function *> valuesOf(Value *value)
+    {
+        if (Function *func = dyn_cast<Function>(value)) return std::set<Function *>{func};
+        auto iter = nodes.find(value);
+        return iter == nodes.end() ? std::set<Function *>() : pointsTo[iter->second];
+    }
+
+    std::set<Function *> returnsOf(Function *func)
+    {
+        auto iter = returns.find(func);
+        return iter == returns.end() ? std::set<Function *>() : pointsTo[iter->second];
+    }
+
+    static bool tracked(Value *value)
+    {
+        return isa<Argument>(value) || isa<PHINode>(value) || isa<CallInst>(value);
+    }
+
+    unsigned newNode()
+    {
+        pointsTo.emplace_back();
+        succs.emplace_back();
+        calls.emplace_back();
+        queued.push_back(false);
+        return pointsTo.size() - 1;
+    }
+
+    unsigned node(Value *value)
+    {
+        auto iter = nodes.find(value);
+        if (iter != nodes.end()) return iter->second;
+        unsigned n = newNode();
+        nodes[value] = n;
+        return n;
+    }
+
+    unsigned returnNode(Function *func)
+    {
+        auto iter = returns.find(func);
+        if (iter != returns.end()) return iter->second;
+        unsigned n = newNode();
+        returns[func] = n;
+        return n;
+    }
+
+    void enqueue(unsigned n)
+    {
+        if (!queued[n]) queued[n] = true, worklist.push_back(n);
+    }
+
+    /// value 流向结点 to：函数直接加入集合，其余支持的值加边
+    void flow(Value *value, unsigned to)
+    {
+        if (Function *func = dyn_cast<Function>(value)) {
+            if (pointsTo[to].insert(func).second) enqueue(to);
+        }
+        else if (tracked(value)) {
+            unsigned from = node(value);
+            succs[from].push_back(to);
+            propagate(from, to);
+        }
+    }
+
+    void propagate(unsigned from, unsigned to)
+    {
+        if (from == to) return;
+        size_t size = pointsTo[to].size();
+        pointsTo[to].insert(pointsTo[from].begin(), pointsTo[from].end());
+        if (pointsTo[to].size() != size) enqueue(to);
+    }
+
+    /// 调用点调用 callee：实参流向形参，返回值流向调用的结果
+    void link(CallInst *callinst, Function *callee)
+    {
+        if (!callees[callinst].insert(callee).second || callee->isDeclaration()) return;
+        unsigned argnum = std::min<unsigned>(callinst->arg_size(), callee->arg_size());
+        for (unsigned i = 0; i < argnum; ++i)
+            flow(callinst->getArgOperand(i), node(callee->getArg(i)));
+        unsigned from = returnNode(callee), to = node(callinst);
+        succs[from].push_back(to);
+        propagate(from, to);
+    }
+};
+
 ///!TODO TO BE COMPLETED BY YOU FOR ASSIGNMENT 2
 /// Updated 11/10/2017 by fargo: make all functions
 /// processed by mem2reg before this pass.
 struct FuncPtrPass : public ModulePass
 {
     static char ID; // Pass identification, replacement for typeid
-    FuncPtrPass() : ModulePass(ID) {}
+    FuncPtrPass(unsigned long maxSteps = DefaultMaxSteps) : ModulePass(ID), maxSteps(maxSteps) {}
     std::map<int, std::set<std::string> > lineFuncList;
-    std::map<Function *, CallInst *> funcUser;
     std::set<BasicBlock *> selectedBlock;
+    std::map<PHINode *, std::pair<size_t, size_t> > activePhis; // 正在展开的 phi 结点 -> 展开时的帧数和 phi 的嵌套层数
+    size_t phiDepth = 0;
+    int chaseLimit = 0;                     // 回溯形参时只能进入比它低的帧，保证回溯一定终止
+    ModuleIndex index;
+    FlowGraph graph;                // 递归和超出预算时的后备结果
+
+    /// 展开的步数上限，一步是压入一帧或展开一个 phi 结点。不计上限时，没有缓存命中的展开次数是
+    /// 调用图中不含重复函数的调用路径数乘以沿途 phi 的分支数，最坏随函数个数指数增长
+    /// （例如每层两次调用下一层并交换实参的链）。每一步只遍历一个函数的调用点或返回值、一个 phi 的入边，
+    /// 形参回溯和查找登记不超过展开的深度，查询缓存不超过 2 * (MaxMemoDepth + 1) 次，
+    /// 因此总的工作量不超过 maxSteps 乘以这些量中的最大者。
+    /// 超出时所有调用点改用 graph 的上下文无关结果，它包含上下文敏感的结果；标准错误上总是给出警告，退出码为 2
+    static const unsigned long DefaultMaxSteps = 1ul << 22;
+    unsigned long maxSteps;
+    unsigned long steps = 0;
+    bool exhausted = false;
+
+    /// 值可能指向的函数，以及解析到它时选定的基本块。
+    /// 被调函数的函数体、返回值在这些基本块中继续展开，形参回溯到调用者的 phi 结点时选择一致的分支
+    struct Target
+    {
+        Function *func;
+        std::set<BasicBlock *> selected;
+    };
+
+    static const size_t MaxMemoDepth = 8;
+
+    /// 调用串：若干层帧的 (函数, 调用点) 组成的不可变单链表，最内层在表头，空串为 nullptr。
+    /// 相同的调用串只创建一次，压栈是一次查找，比较只需比较指针
+    struct CallString
+    {
+        Function *func;
+        CallInst *callinst;
+        const CallString *rest;
+    };
+    std::deque<CallString> callStrings;
+    DenseMap<std::pair<std::pair<Function *, CallInst *>, const CallString *>, const CallString *> callStringIds;
+
+    /// 正在展开的 handleFunction / handleFunctionReturn，每帧登记函数的一个调用点，形参在其中回溯。
+    /// 同一函数最多展开一次，递归调用使用 graph 的结果，因此展开的深度不超过函数的个数
+    struct Frame
+    {
+        Function *func;
+        CallInst *callinst;
+        int chaseLimit; // 外层的 chaseLimit，弹出时恢复
+        unsigned known; // contexts 中已经求出的层数，查询时才求
+        const CallString *contexts[MaxMemoDepth + 1]; // 到这一帧为止最内 k 层的调用串，不足 k 层时为完整的调用串
+    };
+    std::vector<Frame> frames;
+
+    /// 可以缓存的一次展开（函数体、返回值或 phi 结点）实际依赖的上下文，嵌套的展开结束时并入外层
+    struct Scope
+    {
+        int consulted; // 查询过的最外层的登记所在的帧，-1 表示查询过不存在的登记，与整个上下文有关
+        std::set<Function *> phis; // 访问过其中 phi 结点的函数，与外层在这些函数中选定的基本块有关
+        size_t cut;    // 截断的 phi 环中最外层的 phi 的嵌套层数，与截断时正在展开的 phi 有关
+    };
+    std::vector<Scope> scopes;
+
+    /// 在相同的上下文中展开过的结果：函数体的遍历只记下遍历过（lineFuncList 只增不减，
+    /// 再次遍历不会得到新的结果），返回值和 phi 结点保存解析出的函数。
+    /// 没有查询过外层登记的展开在任何调用点、任何上下文中都只需进行一次
+    struct MemoEntry
+    {
+        Value *value;                                             // 函数体或返回值所属的函数，或者 phi 结点
+        bool returns;
+        const CallString *context;                               // 查询过的各层登记；没有查询过时为空串
+        bool whole;                                               // context 必须是完整的上下文
+        size_t chase;                                             // 展开时 chaseLimit 到栈顶的帧数
+        std::set<Function *> phis;
+        std::set<BasicBlock *> selected;                          // 展开前在 phis 中选定的基本块
+        std::vector<Target> targets;                              // 只保存相对展开前新选定的基本块
+    };
+    std::map<std::pair<Value *, bool>, unsigned> memoSizes;      // 保存过的上下文层数，第 size 位表示 size 层，whole 的在其后
+    std::unordered_map<size_t, std::vector<MemoEntry> > memo;     // 值、调用串和 whole 的散列 -> 展开过的上下文
 
     bool runOnModule(Module &M) override 
     {
@@ -82,78 +361,319 @@ struct FuncPtrPass : public ModulePass
         // self::errs().write_escaped(M.getName()) << '\n';
         // M.print(self::errs(), nullptr);
         // self::errs() << "------------------------------\n";
-        std::stack<CallInst *> callinstStack;
-        for (Function &func : M) {
-            if (func.isDeclaration()) continue;
-            for (BasicBlock &block : func) {
-                for (Instruction &inst : block) {
-                    if (isa<llvm::DbgInfoIntrinsic>(inst)) continue;
-                    if (CallInst *callinst = dyn_cast<CallInst>(&inst)) {
-                        handleCallInst(callinst, false, callinstStack);
-                    }
-                }
-            }
+        index.build(M);
+        graph.build(M, index);
+        graph.solve();
+        for (CallInst *callinst : index.calls) {
+            handleCallInst(callinst);
+        }
+        // 超出预算时放弃上下文敏感的结果，使用上下文无关的结果
+        if (exhausted) {
+            llvm::errs() << "warning: analysis budget of " << maxSteps
+                         << " steps exhausted, falling back to context-insensitive results\n";
+            for (auto &item : graph.callees)
+                for (Function *callee : item.second)
+                    saveResult(callee, item.first);
         }
         printResult();
         return false;
     }
 
-    void handleCallInst(CallInst *callinst, bool isInnerCall, std::stack<CallInst *> callinstStack)
+    /// 先解析被调用的值，再逐个展开被调函数；被调函数不在解析返回值时压入的帧中展开
+    void handleCallInst(CallInst *callinst)
     {
-        callinstStack.push(callinst);
-
-        Value *operand = callinst->getCalledOperand();
-        handleValue(operand, isInnerCall, callinstStack);
+        std::vector<Target> targets;
+        handleValue(callinst->getCalledOperand(), targets);
+        std::set<BasicBlock *> selected = selectedBlock;
+        for (const Target &target : targets) {
+            selectedBlock = target.selected;
+            handleFunction(target.func, callinst);
+        }
+        selectedBlock = std::move(selected);
+    }
 
-        callinstStack.pop();
+    /// 调用的返回值：被调用的值解析出的每个函数的返回值
+    void handleCallReturn(CallInst *callinst, std::vector<Target> &targets)
+    {
+        std::vector<Target> callees;
+        handleValue(callinst->getCalledOperand(), callees);
+        std::set<BasicBlock *> selected = selectedBlock;
+        for (const Target &callee : callees) {
+            selectedBlock = callee.selected;
+            handleFunctionReturn(callee.func, callinst, targets);
+        }
+        selectedBlock = std::move(selected);
     }
 
-    void handleFunctionReturn(Function *func, std::stack<CallInst *> callinstStack)
+    void handleFunctionReturn(Function *func, CallInst *callinst, std::vector<Target> &targets)
     {
-        funcUser[func] = callinstStack.top(), callinstStack.pop();
+        // 递归：返回值在上下文无关的结果中
+        int active = userFrame(func);
+        if (active >= 0) {
+            consult(active);
+            for (Function *retfunc : graph.returnsOf(func))
+                targets.push_back(Target{retfunc, selectedBlock});
+            return;
+        }
+        pushFrame(func, callinst);
 
-        // 在调用的 func 函数中遍历寻找 return 语句
-        for (BasicBlock &block : *func) {
-            for (Instruction &inst : block) {
-                if (isa<llvm::DbgInfoIntrinsic>(inst)) continue;
-                if (ReturnInst *returninst = dyn_cast<ReturnInst>(&inst)) {
-                    Value *retval = returninst->getReturnValue();
-                    handleValue(retval, false, callinstStack);
-                }
+        // 在调用的 func 函数中遍历 return 语句的返回值
+        if (!recall(func, true, targets)) {
+            size_t begin = targets.size();
+            for (Value *retval : index.returnsOf(func)) {
+                handleValue(retval, targets);
             }
+            leave(func, targets, begin);
+            store(func, true, targets, begin);
         }
 
-        funcUser.erase(func);
+        popFrame();
+    }
+
+    /// 返回到调用者之后，func 中选定的基本块不会再被查询，去掉之后合并相同的结果，
+    /// 否则逐层返回的 phi 结点使结果的个数随嵌套深度指数增长
+    void leave(Function *func, std::vector<Target> &targets, size_t begin)
+    {
+        size_t end = begin;
+        for (size_t i = begin; i < targets.size(); ++i) {
+            Target &target = targets[i];
+            for (auto iter = target.selected.begin(); iter != target.selected.end();) {
+                if ((*iter)->getParent() == func) iter = target.selected.erase(iter);
+                else ++iter;
+            }
+            bool duplicate = false;
+            for (size_t j = begin; j < end && !duplicate; ++j)
+                duplicate = targets[j].func == target.func && targets[j].selected == target.selected;
+            if (!duplicate) targets[end++] = std::move(target);
+        }
+        targets.resize(end);
     }
 
-    void handleFunction(Function *func, std::stack<CallInst *> callinstStack)
+    void handleFunction(Function *func, CallInst *user)
     {
         // 跳过名称由 "llvm." 开头的函数
         // if (func->isIntrinsic()) return;
-        funcUser[func] = callinstStack.top(), callinstStack.pop();
-        saveResult(func, funcUser[func]);
-
-        // 遍历 func 内部调用的函数
-        for (BasicBlock &block : *func) {
-            for (Instruction &inst : block) {
-                if (isa<llvm::DbgInfoIntrinsic>(inst)) continue;
-                if (CallInst *callinst = dyn_cast<CallInst>(&inst)) {
-                    handleCallInst(callinst, false, callinstStack);
-                }
+        // 先记录调用点本身的结果，函数体的遍历只依赖于查询过的登记
+        saveResult(func, user);
+        // 递归：函数体已经在外层展开，其中调用的函数使用上下文无关的结果
+        int active = userFrame(func);
+        if (active >= 0) {
+            consult(active);
+            flood(func);
+            return;
+        }
+        pushFrame(func, user);
+
+        // 遍历 func 内部调用的函数；函数体内的调用压栈后都会弹出，结果与栈中更早的调用无关
+        std::vector<Target> none;
+        if (!recall(func, false, none)) {
+            for (CallInst *callinst : index.callsOf(func)) {
+                handleCallInst(callinst);
             }
+            store(func, false, none, 0);
         }
 
-        funcUser.erase(func);
+        popFrame();
     }
 
-    void handlePHINode(PHINode *phinode, bool isInnerCall, std::stack<CallInst *> callinstStack)
+    /// func 函数体内的调用点及其调用的函数体内的调用点，全部记录上下文无关的结果，每个函数只需记录一次
+    void flood(Function *func)
+    {
+        if (!flooded.insert(func).second) return;
+        for (CallInst *callinst : index.callsOf(func)) {
+            for (Function *callee : graph.callees[callinst]) {
+                saveResult(callee, callinst);
+                flood(callee);
+            }
+        }
+    }
+    std::set<Function *> flooded;
+
+    void pushFrame(Function *func, CallInst *callinst)
+    {
+        step();
+        frames.push_back(Frame{func, callinst, chaseLimit, 0, {nullptr}});
+        chaseLimit = frames.size();
+        openScope();
+    }
+
+    void step()
+    {
+        if (++steps > maxSteps) exhausted = true;
+    }
+
+    void popFrame()
+    {
+        closeScope();
+        chaseLimit = frames.back().chaseLimit;
+        frames.pop_back();
+    }
+
+    void openScope()
+    {
+        scopes.push_back(Scope{(int)frames.size(), {}, SIZE_MAX});
+    }
+
+    void closeScope()
+    {
+        Scope scope = scopes.back();
+        scopes.pop_back();
+        if (scopes.empty()) return;
+        Scope &outer = scopes.back();
+        outer.consulted = std::min(outer.consulted, scope.consulted);
+        outer.phis.insert(scope.phis.begin(), scope.phis.end());
+        outer.cut = std::min(outer.cut, scope.cut);
+    }
+
+    /// func 的登记所在的帧，没有展开时为 -1
+    int userFrame(Function *func)
+    {
+        int index = frames.size() - 1;
+        while (index >= 0 && frames[index].func != func) --index;
+        return index;
+    }
+
+    /// 当前展开的结果依赖于第 index 帧的登记
+    void consult(int index)
+    {
+        if (!scopes.empty()) scopes.back().consulted = std::min(scopes.back().consulted, index);
+    }
+
+    const CallString *push(const CallString *rest, Function *func, CallInst *callinst)
+    {
+        const CallString *&id = callStringIds[std::make_pair(std::make_pair(func, callinst), rest)];
+        if (!id) callStrings.push_back(CallString{func, callinst, rest}), id = &callStrings.back();
+        return id;
+    }
+
+    /// 当前上下文最内 size 层的调用串，size 不超过 MaxMemoDepth
+    const CallString *contextOf(size_t size)
+    {
+        return frames.empty() ? nullptr : contextAt(frames.size() - 1, size);
+    }
+
+    /// 到第 index 帧为止最内 size 层的调用串：这一帧接在外一帧的 size - 1 层之前
+    const CallString *contextAt(size_t index, size_t size)
+    {
+        if (size == 0) return nullptr;
+        Frame &frame = frames[index];
+        while (frame.known < size) {
+            const CallString *rest = index > 0 ? contextAt(index - 1, frame.known) : nullptr;
+            frame.contexts[++frame.known] = push(rest, frame.func, frame.callinst);
+        }
+        return frame.contexts[size];
+    }
+
+    /// 在相同的上下文中展开过时直接取出解析的结果，并把它依赖的上下文记入当前的展开
+    bool recall(Value *value, bool returns, std::vector<Target> &targets)
+    {
+        auto iter = memoSizes.find(std::make_pair(value, returns));
+        if (iter == memoSizes.end()) return false;
+        for (size_t size = 0; size <= MaxMemoDepth && size <= frames.size(); ++size)
+        {
+            const MemoEntry *entry = nullptr;
+            if (iter->second >> size & 1) entry = lookup(value, returns, contextOf(size), false);
+            // whole 的上下文只能在完整的上下文中匹配
+            if (!entry && size == frames.size() && (iter->second >> (MaxMemoDepth + 1 + size) & 1))
+                entry = lookup(value, returns, contextOf(size), true);
+            if (!entry) continue;
+            Scope &scope = scopes.back();
+            scope.consulted = std::min(scope.consulted, entry->whole ? -1 : (int)(frames.size() - size));
+            scope.phis.insert(entry->phis.begin(), entry->phis.end());
+            for (const Target &target : entry->targets) {
+                targets.push_back(Target{target.func, selectedBlock});
+                targets.back().selected.insert(target.selected.begin(), target.selected.end());
+            }
+            return true;
+        }
+        return false;
+    }
+
+    const MemoEntry *lookup(Value *value, bool returns, const CallString *context, bool whole)
+    {
+        auto found = memo.find(llvm::hash_combine(value, returns, context, whole));
+        if (found == memo.end()) return nullptr;
+        for (const MemoEntry &entry : found->second)
+        {
+            if (entry.value != value || entry.returns != returns || entry.context != context || entry.whole != whole) continue;
+            if (entry.chase != frames.size() - chaseLimit) continue;
+            if (entry.selected != selectedIn(entry.phis)) continue;
+            return &entry;
+        }
+        return nullptr;
+    }
+
+    /// 保存当前展开的结果，targets 中从 begin 开始的是这次展开解析出的函数
+    void store(Value *value, bool returns, const std::vector<Target> &targets, size_t begin)
+    {
+        // 超出预算时展开不完整
+        if (exhausted) return;
+        const Scope &scope = scopes.back();
+        // 依赖很多层上下文的展开几乎不会再遇到，保存和比较的开销反而超过重新展开
+        size_t size = frames.size() - std::max(scope.consulted, 0);
+        if (size > MaxMemoDepth) return;
+        MemoEntry entry;
+        entry.value = value;
+        entry.returns = returns;
+        entry.context = contextOf(size);
+        entry.whole = scope.consulted < 0;
+        entry.chase = frames.size() - chaseLimit;
+        entry.phis = scope.phis;
+        entry.selected = selectedIn(scope.phis);
+        for (size_t i = begin; i < targets.size(); ++i) {
+            entry.targets.push_back(Target{targets[i].func, {}});
+            for (BasicBlock *block : targets[i].selected)
+                if (!selectedBlock.count(block)) entry.targets.back().selected.insert(block);
+        }
+        memoSizes[std::make_pair(value, returns)] |= 1u << (entry.whole ? MaxMemoDepth + 1 + size : size);
+        memo[llvm::hash_combine(value, returns, entry.context, entry.whole)].push_back(std::move(entry));
+    }
+
+    /// 选定的基本块中属于 funcs 的部分：phi 结点只查询所在函数中选定的基本块
+    std::set<BasicBlock *> selectedIn(const std::set<Function *> &funcs)
+    {
+        std::set<BasicBlock *> selected;
+        for (BasicBlock *block : selectedBlock)
+            if (funcs.count(block->getParent())) selected.insert(block);
+        return selected;
+    }
+
+    void handlePHINode(PHINode *phinode, std::vector<Target> &targets)
+    {
+        // 同一帧内 phi 结点的环：使用上下文无关的结果。环只在一帧之内判断，截断与否只取决于这一帧的展开
+        auto active = activePhis.find(phinode);
+        if (active != activePhis.end() && active->second.first == frames.size()) {
+            if (!scopes.empty()) scopes.back().cut = std::min(scopes.back().cut, active->second.second);
+            for (Function *func : graph.valuesOf(phinode))
+                targets.push_back(Target{func, selectedBlock});
+            return;
+        }
+        step();
+        bool outer = active != activePhis.end();
+        std::pair<size_t, size_t> outerActive = outer ? active->second : std::make_pair(0ul, 0ul);
+        activePhis[phinode] = std::make_pair(frames.size(), ++phiDepth);
+        openScope();
+        scopes.back().phis.insert(phinode->getFunction());
+        if (!recall(phinode, false, targets)) {
+            size_t begin = targets.size();
+            handleIncomingValues(phinode, targets);
+            // 截断在更外层的 phi 结点上时，结果与外层正在展开的 phi 有关
+            if (scopes.back().cut >= phiDepth) store(phinode, false, targets, begin);
+        }
+        closeScope();
+        --phiDepth;
+        if (outer) activePhis[phinode] = outerActive;
+        else activePhis.erase(phinode);
+    }
+
+    void handleIncomingValues(PHINode *phinode, std::vector<Target> &targets)
     {
         // 保证同一基本块内的 phi 结点的前驱基本块一致（保证了test14的精确结果：32 : plus）
         for (BasicBlock *block : selectedBlock) {
             int i = phinode->getBasicBlockIndex(block);
             if (i != -1) { // 如果在当前 phi 结点的前驱基本块中存在已经被选定的基本块，直接选定对应分支处理后 return
                 Value *incomingvalue = phinode->getIncomingValue(i);
-                handleValue(incomingvalue, isInnerCall, callinstStack);
+                handleValue(incomingvalue, targets);
                 return;
             }
         }
@@ -163,46 +683,57 @@ struct FuncPtrPass : public ModulePass
             BasicBlock *incomingblock = phinode->getIncomingBlock(i);
 
             selectedBlock.insert(incomingblock);
-            handleValue(incomingvalue, isInnerCall, callinstStack);
+            handleValue(incomingvalue, targets);
             selectedBlock.erase(incomingblock);
         }
     }
 
-    void handleValue(Value *value, bool isInnerCall, std::stack<CallInst *> callinstStack)
+    /// 值可能指向的函数加入 targets
+    void handleValue(Value *value, std::vector<Target> &targets)
     {
+        if (exhausted) return;
         if (CallInst *callinst = dyn_cast<CallInst>(value)) {
-            handleCallInst(callinst, true, callinstStack);
+            handleCallReturn(callinst, targets);
         }
         else if (PHINode *phinode = dyn_cast<PHINode>(value)) {
-            handlePHINode(phinode, isInnerCall, callinstStack);
+            handlePHINode(phinode, targets);
         }
         else if (Function *func = dyn_cast<Function>(value)) {
-            if (isInnerCall)
-                handleFunctionReturn(func, callinstStack);
-            else
-                handleFunction(func, callinstStack);
+            targets.push_back(Target{func, selectedBlock});
         }
         else if (Argument *argument = dyn_cast<Argument>(value)) {
-            handleArgument(argument, isInnerCall, callinstStack);
+            handleArgument(argument, targets);
         }
         else {
-            self::errs() << "Unsupported Value: " << *value << ".\n";
+            if (self::hasErrs()) self::errs() << "Unsupported Value: " << *value << ".\n";
         }
     }
 
-    void handleArgument(Argument *argument, bool isInnerCall, std::stack<CallInst *> callinstStack)
+    void handleArgument(Argument *argument, std::vector<Target> &targets)
     {
         unsigned int argindex = argument->getArgNo();
         Function *parentfunc = argument->getParent();
 
         // 嵌套调用时，回溯寻找参数
-        if (funcUser.find(parentfunc) != funcUser.end()) {
-            CallInst *callinst = funcUser[parentfunc];
+        int index = userFrame(parentfunc);
+        if (index >= 0 && index >= chaseLimit) {
+            // 递归调用把形参传给自己：回溯不再向外，使用上下文无关的结果
+            consult(index);
+            for (Function *func : graph.valuesOf(argument))
+                targets.push_back(Target{func, selectedBlock});
+        }
+        else if (index >= 0) {
+            consult(index);
+            CallInst *callinst = frames[index].callinst;
             Value *operand = callinst->getArgOperand(argindex);
-            handleValue(operand, isInnerCall, callinstStack);
+            int limit = chaseLimit;
+            chaseLimit = index;
+            handleValue(operand, targets);
+            chaseLimit = limit;
         }
         else {
-            self::errs() << "Unexpected Parent Function: " << *parentfunc << ".\n";
+            consult(-1);
+            if (self::hasErrs()) self::errs() << "Unexpected Parent Function: " << *parentfunc << ".\n";
         }
     }
 
@@ -235,6 +766,7 @@ struct FuncPtrPass : public ModulePass
 };
 
 char FuncPtrPass::ID = 0;
+const unsigned long FuncPtrPass::DefaultMaxSteps;
 static RegisterPass<FuncPtrPass> X("funcptrpass",
                                    "Print function call instruction");
 
@@ -242,6 +774,9 @@ cl::opt<std::string>
     InputFilename(cl::Positional, cl::desc("<filename>.bc"), cl::init(""));
 cl::opt<bool> StdErrOption("stderr", llvm::cl::desc("Enable stderr output"));
 cl::alias StdErrOptionShort("e", llvm::cl::aliasopt(StdErrOption));
+cl::opt<unsigned long> MaxStepsOption("max-steps",
+    llvm::cl::desc("Expansion steps before falling back to context-insensitive results"),
+    llvm::cl::init(FuncPtrPass::DefaultMaxSteps));
 
 int main(int argc, char **argv) 
 {
@@ -270,6 +805,9 @@ int main(int argc, char **argv)
     Passes.add(llvm::createPromoteMemoryToRegisterPass());
 
     /// Your pass to print Function and Call Instructions
-    Passes.add(new FuncPtrPass());
+    FuncPtrPass *pass = new FuncPtrPass(MaxStepsOption);
+    Passes.add(pass);
     Passes.run(*M.get());
+    // 结果可用但不精确
+    return pass->exhausted ? 2 : 0;
 }
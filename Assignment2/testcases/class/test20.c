@@ -0,0 +1,46 @@
+#include <stdlib.h>
+int plus(int a, int b) {
+   return a+b;
+}
+
+int minus(int a, int b) {
+   return a-b;
+}
+
+int rec(int n, int (*f_fptr)(int, int)) {
+    if (n <= 0) return 0;
+    f_fptr(n, n);
+    return rec(n - 1, f_fptr);
+}
+
+int twice(int n, int (*f_fptr)(int, int)) {
+    if (n <= 0) return 0;
+    f_fptr(n, n);
+    return twice(n - 1, minus);
+}
+
+int loop(int n) {
+    int (*p_fptr)(int, int) = plus;
+    int i;
+    for (i = 0; i < n; i++) {
+        p_fptr(i, i);
+        if (i % 2) p_fptr = minus;
+    }
+    return 0;
+}
+
+int main() {
+    rec(3, plus);
+    twice(3, plus);
+    loop(3);
+    return 0;
+}
+
+// 12 : plus
+// 13 : rec
+// 18 : minus, plus
+// 19 : twice
+// 26 : minus, plus
+// 33 : rec
+// 34 : twice
+// 35 : loop
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include <stdlib.h>
+int plus(int a, int b) {
+   return a+b;
+}
+
+int minus(int a, int b) {
+   return a-b;
+}
+
+typedef int (*fptr)(int, int);
+
+fptr g0(int x) { return x ? plus : minus; }
+fptr g1(int x) { fptr f = g0(x); fptr h = g0(x + 1); return x ? f : h; }
+fptr g2(int x) { fptr f = g1(x); fptr h = g1(x + 1); return x ? f : h; }
+fptr g3(int x) { fptr f = g2(x); fptr h = g2(x + 1); return x ? f : h; }
+fptr g4(int x) { fptr f = g3(x); fptr h = g3(x + 1); return x ? f : h; }
+fptr g5(int x) { fptr f = g4(x); fptr h = g4(x + 1); return x ? f : h; }
+fptr g6(int x) { fptr f = g5(x); fptr h = g5(x + 1); return x ? f : h; }
+fptr g7(int x) { fptr f = g6(x); fptr h = g6(x + 1); return x ? f : h; }
+fptr g8(int x) { fptr f = g7(x); fptr h = g7(x + 1); return x ? f : h; }
+fptr g9(int x) { fptr f = g8(x); fptr h = g8(x + 1); return x ? f : h; }
+fptr g10(int x) { fptr f = g9(x); fptr h = g9(x + 1); return x ? f : h; }
+fptr g11(int x) { fptr f = g10(x); fptr h = g10(x + 1); return x ? f : h; }
+fptr g12(int x) { fptr f = g11(x); fptr h = g11(x + 1); return x ? f : h; }
+fptr g13(int x) { fptr f = g12(x); fptr h = g12(x + 1); return x ? f : h; }
+fptr g14(int x) { fptr f = g13(x); fptr h = g13(x + 1); return x ? f : h; }
+fptr g15(int x) { fptr f = g14(x); fptr h = g14(x + 1); return x ? f : h; }
+fptr g16(int x) { fptr f = g15(x); fptr h = g15(x + 1); return x ? f : h; }
+fptr g17(int x) { fptr f = g16(x); fptr h = g16(x + 1); return x ? f : h; }
+fptr g18(int x) { fptr f = g17(x); fptr h = g17(x + 1); return x ? f : h; }
+fptr g19(int x) { fptr f = g18(x); fptr h = g18(x + 1); return x ? f : h; }
+fptr g20(int x) { fptr f = g19(x); fptr h = g19(x + 1); return x ? f : h; }
+
+int main() {
+    fptr t = g20(1);
+    t(1, 2);
+    return 0;
+}
+
+// 13 : g0
+// 14 : g1
+// 15 : g2
+// 16 : g3
+// 17 : g4
+// 18 : g5
+// 19 : g6
+// 20 : g7
+// 21 : g8
+// 22 : g9
+// 23 : g10
+// 24 : g11
+// 25 : g12
+// 26 : g13
+// 27 : g14
+// 28 : g15
+// 29 : g16
+// 30 : g17
+// 31 : g18
+// 32 : g19
+// 35 : g20
+// 36 : minus, plus
\ No newline at end of file